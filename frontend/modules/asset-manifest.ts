@@ -0,0 +1,65 @@
+import { createHash } from 'crypto';
+import { extname, join, relative, sep } from 'path';
+import fs from 'mz/fs';
+import { Module } from '@nuxt/types';
+const { readdir, readFile, stat, writeFile } = fs;
+
+// Read by ServeStatic::setManifest() in src/ServeStatic.cpp.
+export const MANIFEST = 'assets.txt';
+
+// The same table as getFileType() in src/ServeStatic.cpp.
+const types: { [ext: string]: string } = {
+	'.html': 'text/html',
+	'.htm': 'text/html',
+	'.css': 'text/css',
+	'.json': 'application/json',
+	'.js': 'application/javascript',
+	'.png': 'image/png',
+	'.gif': 'image/gif',
+	'.jpg': 'image/jpeg',
+	'.ico': 'image/x-icon',
+	'.svg': 'image/svg+xml',
+	'.eot': 'font/eot',
+	'.woff': 'font/woff',
+	'.woff2': 'font/woff2',
+	'.ttf': 'font/ttf',
+	'.xml': 'text/xml',
+	'.pdf': 'application/pdf',
+	'.zip': 'application/zip',
+};
+const encodings: { [ext: string]: string } = {
+	'.gz': 'gzip',
+	'.br': 'br',
+};
+
+async function walk(dir: string): Promise<string[]> {
+	const files = await Promise.all((await readdir(dir)).map(async (name) => {
+		const path = join(dir, name);
+		return (await stat(path)).isDirectory() ? walk(path) : [path];
+	}));
+	return ([] as string[]).concat(...files);
+}
+
+// One line per generated file, with tab-separated fields: the URL it is served under relative to
+// the output directory, its content encoding, size, content hash and content type. Compressed
+// copies are listed under the URL of the file they compress.
+async function manifestLine(dir: string, path: string) {
+	const data = await readFile(path);
+	let url = `/${relative(dir, path).split(sep).join('/')}`;
+	const encoding = encodings[extname(url)] || 'identity';
+	if (encoding !== 'identity') url = url.substring(0, url.length - extname(url).length);
+	const hash = createHash('sha1').update(data).digest('hex').substring(0, 16);
+	const type = types[extname(url)] || 'text/plain';
+	return [url, encoding, data.length, hash, type].join('\t');
+}
+
+const assetManifestModule: Module = function () {
+	this.nuxt.hook('generate:done', async (generator: { distPath: string }) => {
+		const dir = generator.distPath;
+		const files = (await walk(dir)).filter(path => relative(dir, path) !== MANIFEST);
+		const lines = await Promise.all(files.map(path => manifestLine(dir, path)));
+		await writeFile(join(dir, MANIFEST), `${lines.sort().join('\n')}\n`);
+	});
+};
+
+export default assetManifestModule;
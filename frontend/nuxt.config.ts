@@ -83,13 +83,13 @@ const config: Configuration = {
 		dir: '../data/www/',
 		fallback: true,
 	},
-	buildModules: ['@nuxt/typescript-build', 'modules/last-modified', 'nuxt-compress'],
+	buildModules: ['@nuxt/typescript-build', 'modules/asset-manifest', 'nuxt-compress'],
 	'nuxt-compress': {
 		gzip: {
 			cache: true,
 		},
 		brotli: {
-			threshold: Infinity,
+			cache: true,
 		},
 	},
 };
@@ -14,6 +14,7 @@ interface ScanMessage {
 }
 
 interface ConfigSetting {
+	id: number,
 	title: string,
 	description: string,
 }
@@ -62,12 +63,38 @@ interface JsonConfig extends ConfigSetting {
 }
 
 interface EffectConfig {
+	id: number,
 	name: string,
 	config: (StringConfig | NumberConfig | ColorConfig | SelectConfig | BooleanConfig | JsonConfig)[],
 }
 
+export interface StripSettings {
+	name: string,
+	length: number,
+	pin: number,
+	chipset: string,
+	order: string,
+	hdr: boolean,
+	maxMilliamps: number,
+}
+
+interface StripInfo extends StripSettings {
+	id: number,
+}
+
+export interface StripOptions {
+	pixels: number,
+	maxStrips: number,
+	pins: number[],
+	chipsets: string[],
+	orders: string[],
+}
+
 interface EffectConfigMessage {
 	type: 'effectConfig',
+	messageTypes: { [type: string]: number },
+	strips: StripInfo[],
+	stripOptions: StripOptions,
 	effects: EffectConfig[],
 }
 
@@ -90,9 +117,95 @@ export interface GlobalStatsMessage {
 	brightness: number,
 	on: boolean,
 	followSun: boolean,
+	powerBudget: number,
+}
+
+export interface PowerMessage {
+	type: 'power',
+	budget: number,
+	draw: number,
+	strips: {
+		draw: number,
+		requested: number,
+		limit: number,
+	}[],
+}
+
+export interface ScenesMessage {
+	type: 'scenes',
+	scenes: string[],
 }
 
-type Message = ScanMessage | EffectConfigMessage | ConfigMessage | GlobalStatsMessage;
+export interface PlaylistMessage {
+	type: 'playlist',
+	scenes: string[],
+	interval: number,
+	beats: number,
+	enabled: boolean,
+}
+
+// Durations in microseconds, over the last few dozen frames.
+export interface StageStats {
+	min: number,
+	avg: number,
+	p99: number,
+}
+
+export interface PerfStatsMessage {
+	type: 'perfStats',
+	stages: { [stage: string]: StageStats },
+	strips: StageStats[],
+	// histogram[i] counts frames shorter than histogramBase << i microseconds; the last bucket
+	// counts the rest.
+	histogramBase: number,
+	histogram: number[],
+	heap: HeapStats,
+}
+
+export interface HeapTagStats {
+	bytes: number,
+	count: number,
+	allocations: number,
+}
+
+// Sampled every 10 seconds; fragmentation is the percentage of free heap outside the largest
+// block.
+export interface HeapStats {
+	free?: number,
+	largestBlock?: number,
+	fragmentation?: number,
+	minLargestBlock?: number,
+	minFree: number,
+	warning: boolean,
+	largestBlockHistory: number[],
+	tags: { [tag: string]: HeapTagStats },
+}
+
+export type StripQuality = 'full' | 'noDither' | 'halfRate' | 'quarterRate';
+
+// Frame times are in microseconds.
+export interface FramesMessage {
+	type: 'frames',
+	deadline: number,
+	lastMicros: number,
+	overruns: { render: number, show: number, external: number },
+	// histogram[i] counts overruns late by less than histogramBase << i microseconds; the last
+	// bucket counts the rest.
+	histogramBase: number,
+	histogram: number[],
+	strips: {
+		quality: StripQuality,
+		renderMicros: number,
+	}[],
+}
+
+export interface ErrorMessage {
+	type: 'error',
+	error: string,
+}
+
+type Message = ScanMessage | EffectConfigMessage | ConfigMessage | GlobalStatsMessage | ScenesMessage | PlaylistMessage
+	| PowerMessage | PerfStatsMessage | FramesMessage | ErrorMessage;
 export namespace Outgoing {
 	export interface UpdateEffectMessage {
 		type: 'updateEffect',
@@ -114,17 +227,72 @@ export namespace Outgoing {
 		brightness?: number,
 		on?: boolean,
 		followSun?: boolean,
+		powerBudget?: number,
+	}
+
+	export interface SceneMessage {
+		type: 'saveScene' | 'recallScene' | 'deleteScene',
+		name: string,
+	}
+
+	export interface SetPlaylistMessage {
+		type: 'setPlaylist',
+		scenes?: string[],
+		interval?: number,
+		beats?: number,
+		enabled?: boolean,
 	}
 
-	export type Message = UpdateEffectMessage | RemoveEffectMessage | GlobalStatsMessage;
+	export interface BeatMessage {
+		type: 'beat',
+	}
+
+	// The controller restarts to apply new strips.
+	export interface SetStripsMessage {
+		type: 'setStrips',
+		strips: StripSettings[],
+	}
+
+	export type Message = UpdateEffectMessage | RemoveEffectMessage | GlobalStatsMessage | SceneMessage
+		| SetPlaylistMessage | BeatMessage | SetStripsMessage;
+}
+
+interface Schema {
+	messageTypes: { [type: string]: number },
+	strips: { [name: string]: number },
+	effects: { [name: string]: EffectConfig },
+}
+
+// Replaces names with the numeric IDs advertised in the schema, which the controller can
+// dispatch without any string matching. Anything the schema doesn't know is sent as-is.
+function compact(obj: Outgoing.Message, schema: Schema | null): any {
+	if (!schema || !(obj.type in schema.messageTypes)) return obj;
+	const message: any = { ...obj, type: schema.messageTypes[obj.type] };
+	if (obj.type === 'updateEffect' || obj.type === 'removeEffect') {
+		const effect = schema.effects[obj.effect];
+		if (!(obj.strip in schema.strips) || !effect) return obj;
+		message.strip = schema.strips[obj.strip];
+		message.effect = effect.id;
+		if (obj.type === 'updateEffect') {
+			message.config = effect.config.map(({ title }) => (title in obj.config ? obj.config[title] : null));
+		}
+	}
+	return message;
 }
 
 interface Ws {
 	connected: boolean,
 	networks: Network[],
 	effectConfig: EffectConfig[] | null,
+	strips: StripInfo[],
+	stripOptions: StripOptions | null,
 	config: ConfigMessage | null,
 	globalConfig: GlobalStatsMessage | null,
+	scenes: string[],
+	playlist: PlaylistMessage | null,
+	power: PowerMessage | null,
+	perfStats: PerfStatsMessage | null,
+	frames: FramesMessage | null,
 	send: (obj: Outgoing.Message) => boolean,
 }
 
@@ -137,16 +305,24 @@ declare module 'vue/types/vue' {
 
 const myPlugin: Plugin = (context, inject) => {
 	let ws: WebSocket | null = null;
+	let schema: Schema | null = null;
 	const state = Vue.observable({
 		connected: false,
 		networks: [],
 		effectConfig: null,
+		strips: [],
+		stripOptions: null,
 		config: null,
 		globalConfig: null,
+		scenes: [],
+		playlist: null,
+		power: null,
+		perfStats: null,
+		frames: null,
 		send(obj: Outgoing.Message) {
 			if (!ws) return false;
 			try {
-				ws.send(encode(obj));
+				ws.send(encode(compact(obj, schema)));
 				return true;
 			} catch (e) {
 				return false;
@@ -185,10 +361,31 @@ const myPlugin: Plugin = (context, inject) => {
 							});
 						});
 						state.effectConfig = message.effects;
+						state.strips = message.strips || [];
+						state.stripOptions = message.stripOptions || null;
+						schema = {
+							messageTypes: message.messageTypes || {},
+							strips: {},
+							effects: {},
+						};
+						(message.strips || []).forEach(({ id, name }) => { schema!.strips[name] = id; });
+						message.effects.forEach(effect => { schema!.effects[effect.name] = effect; });
 					} else if (message.type === 'config') {
 						state.config = message;
 					} else if (message.type === 'globalStats') {
 						state.globalConfig = message;
+					} else if (message.type === 'scenes') {
+						state.scenes = message.scenes;
+					} else if (message.type === 'playlist') {
+						state.playlist = message;
+					} else if (message.type === 'power') {
+						state.power = message;
+					} else if (message.type === 'perfStats') {
+						state.perfStats = message;
+					} else if (message.type === 'frames') {
+						state.frames = message;
+					} else if (message.type === 'error') {
+						console.error('Controller rejected message:', message.error);
 					}
 				};
 				fileReader.readAsArrayBuffer(e.data);
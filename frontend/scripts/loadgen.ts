@@ -0,0 +1,290 @@
+// Load generator for the controller's WebSocket control plane.
+//
+//   yarn loadgen <host> [--clients 8] [--duration 30] [--rate 20] [--reconnect 10] [--abuse 50]
+//
+// Every client connects to ws://<host>/ws and sends updateEffect and updateGlobal commands at
+// --rate per second each, reconnecting every --reconnect seconds. One in every --abuse messages
+// is either larger than the controller accepts or split into several WebSocket frames. /metrics
+// is polled meanwhile for the heap, overruns and dropped messages.
+//
+// test/test_loadgen runs the same workload against the firmware built for the host, for numbers
+// that don't depend on the network or a board: `pio test -e loadgen`.
+/// <reference path="./ws.d.ts" />
+import http from 'http';
+import WebSocket from 'ws';
+import { decode, encode } from '@msgpack/msgpack';
+
+// MESSAGE_POOL_SLOT_SIZE in src/MessageAssembler.h.
+const MAX_MESSAGE_SIZE = 4096;
+
+interface Options {
+	host: string,
+	clients: number,
+	duration: number,
+	rate: number,
+	reconnect: number,
+	abuse: number,
+}
+
+// As EffectConfig's toJson() in src/Effect.h describes each field.
+interface ConfigSetting {
+	type: string,
+	min?: number,
+	max?: number,
+	stepBy?: number,
+	minLength?: number,
+	maxLength?: number,
+	options?: string[],
+	defaultValue?: any,
+}
+
+interface Schema {
+	messageTypes: { [type: string]: number },
+	strips: { id: number }[],
+	effects: { id: number, config: ConfigSetting[] }[],
+}
+
+function parseOptions(argv: string[]): Options {
+	const options: Options = {
+		host: '', clients: 8, duration: 30, rate: 20, reconnect: 10, abuse: 50,
+	};
+	for (let i = 0; i < argv.length; i++) {
+		const arg = argv[i];
+		if (arg.startsWith('--')) {
+			const key = arg.substring(2) as keyof Options;
+			if (!(key in options) || key === 'host') throw new Error(`Unknown option ${arg}`);
+			(options as any)[key] = Number(argv[++i]);
+		} else {
+			options.host = arg;
+		}
+	}
+	if (!options.host) {
+		throw new Error('Usage: loadgen <host> [--clients n] [--duration s] [--rate n] '
+			+ '[--reconnect s] [--abuse n]');
+	}
+	return options;
+}
+
+const stats = {
+	commands: 0,
+	oversized: 0,
+	fragmented: 0,
+	connects: 0,
+	errors: {} as { [error: string]: number },
+	broadcasts: {} as { [type: string]: number },
+	bytesIn: 0,
+	latencies: [] as number[],
+};
+
+function pick<T>(list: T[]): T {
+	return list[Math.floor(Math.random() * list.length)];
+}
+
+function randomInt(max: number) {
+	return Math.floor(Math.random() * max);
+}
+
+// A value for the field that the controller accepts, like the UI would send.
+function randomValue(setting: ConfigSetting) {
+	if (setting.type === 'number') {
+		const step = setting.stepBy || 1;
+		const steps = Math.floor((setting.max! - setting.min!) / step + 1e-9);
+		return setting.min! + step * randomInt(steps + 1);
+	}
+	if (setting.type === 'color') {
+		return { r: randomInt(256), g: randomInt(256), b: randomInt(256) };
+	}
+	if (setting.type === 'select') {
+		return pick(setting.options!);
+	}
+	if (setting.type === 'boolean') {
+		return Math.random() < 0.5;
+	}
+	if (setting.type === 'string') {
+		const maxLength = Math.min(setting.maxLength!, 32);
+		const length = setting.minLength! + randomInt(maxLength - setting.minLength! + 1);
+		return Array.from({ length }, () => String.fromCharCode(97 + randomInt(26))).join('');
+	}
+	return setting.defaultValue;
+}
+
+class Client {
+	private ws: WebSocket | null = null;
+
+	private schema: Schema | null = null;
+
+	private timer: NodeJS.Timeout | null = null;
+
+	private sent = 0;
+
+	// Brightness values sent but not yet seen in a globalStats broadcast, with when they were sent.
+	private pending = new Map<number, number>();
+
+	constructor(private options: Options) {}
+
+	start() {
+		this.ws = new WebSocket(`ws://${this.options.host}/ws`);
+		this.ws.binaryType = 'arraybuffer';
+		this.ws.on('open', () => {
+			stats.connects++;
+			this.timer = setInterval(() => this.tick(), 1000 / this.options.rate);
+		});
+		this.ws.on('message', (data) => {
+			if (typeof data === 'string') return;
+			stats.bytesIn += (data as ArrayBuffer).byteLength;
+			const message = decode(data as ArrayBuffer) as any;
+			stats.broadcasts[message.type] = (stats.broadcasts[message.type] || 0) + 1;
+			if (message.type === 'effectConfig') {
+				this.schema = message;
+			} else if (message.type === 'globalStats') {
+				const sentAt = this.pending.get(message.brightness);
+				if (sentAt !== undefined) {
+					stats.latencies.push(Date.now() - sentAt);
+					this.pending.clear();
+				}
+			} else if (message.type === 'error') {
+				stats.errors[message.error] = (stats.errors[message.error] || 0) + 1;
+			}
+		});
+		this.ws.on('close', () => this.stop());
+		this.ws.on('error', () => this.stop());
+	}
+
+	stop() {
+		if (this.timer) clearInterval(this.timer);
+		this.timer = null;
+		if (this.ws) this.ws.terminate();
+		this.ws = null;
+	}
+
+	restart() {
+		this.stop();
+		this.start();
+	}
+
+	private tick() {
+		const { ws, schema } = this;
+		if (!ws || ws.readyState !== WebSocket.OPEN || !schema) return;
+		this.sent++;
+		if (this.options.abuse && this.sent % this.options.abuse === 0) {
+			this.abuse(ws, schema);
+		} else if (this.sent % 2) {
+			const effect = pick(schema.effects);
+			ws.send(encode({
+				type: schema.messageTypes.updateEffect,
+				strip: pick(schema.strips).id,
+				effect: effect.id,
+				config: effect.config.map(randomValue),
+			}));
+		} else {
+			const brightness = 1 + Math.floor(Math.random() * 255);
+			this.pending.set(brightness, Date.now());
+			ws.send(encode({ type: schema.messageTypes.updateGlobal, brightness }));
+		}
+		stats.commands++;
+	}
+
+	private abuse(ws: WebSocket, schema: Schema) {
+		if (this.sent % (this.options.abuse * 2) === 0) {
+			stats.oversized++;
+			ws.send(encode({ type: schema.messageTypes.beat, padding: 'x'.repeat(MAX_MESSAGE_SIZE) }));
+			return;
+		}
+		stats.fragmented++;
+		const message = encode({
+			type: schema.messageTypes.beat,
+			padding: 'x'.repeat(MAX_MESSAGE_SIZE / 2),
+		});
+		const pieces = 4;
+		const size = Math.ceil(message.length / pieces);
+		for (let i = 0; i < pieces; i++) {
+			ws.send(message.subarray(i * size, (i + 1) * size), { fin: i === pieces - 1 });
+		}
+	}
+}
+
+function scrapeMetrics(host: string): Promise<{ [name: string]: number }> {
+	return new Promise((resolve, reject) => {
+		http.get(`http://${host}/metrics`, (res) => {
+			let body = '';
+			res.on('data', (chunk) => { body += chunk; });
+			res.on('end', () => {
+				const metrics: { [name: string]: number } = {};
+				body.split('\n').forEach((line) => {
+					const [name, value] = line.split(' ');
+					if (name && !name.startsWith('#')) metrics[name] = Number(value);
+				});
+				resolve(metrics);
+			});
+		}).on('error', reject);
+	});
+}
+
+function percentile(sorted: number[], p: number) {
+	if (!sorted.length) return NaN;
+	return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+async function main() {
+	const options = parseOptions(process.argv.slice(2));
+	const before = await scrapeMetrics(options.host).catch(() => ({} as { [name: string]: number }));
+	let minFree = Infinity;
+	let minLargestBlock = Infinity;
+	const poll = setInterval(async () => {
+		try {
+			const metrics = await scrapeMetrics(options.host);
+			minFree = Math.min(minFree, metrics.lighting_heap_free_bytes);
+			minLargestBlock = Math.min(minLargestBlock, metrics.lighting_heap_largest_free_block_bytes);
+		} catch (e) {
+			console.error('Couldn\'t scrape /metrics:', e.message);
+		}
+	}, 1000);
+
+	const clients = Array.from({ length: options.clients }, () => new Client(options));
+	clients.forEach((client, i) => {
+		// Staggered so the clients don't all connect at once.
+		setTimeout(() => client.start(), (i * 1000) / options.clients);
+	});
+	// A random client each time, so on average every client reconnects every --reconnect seconds.
+	const reconnect = options.reconnect ? setInterval(() => pick(clients).restart(),
+		(options.reconnect * 1000) / options.clients) : null;
+
+	const start = Date.now();
+	await new Promise(resolve => setTimeout(resolve, options.duration * 1000));
+	const seconds = (Date.now() - start) / 1000;
+	if (reconnect) clearInterval(reconnect);
+	clearInterval(poll);
+	clients.forEach(client => client.stop());
+	const after = await scrapeMetrics(options.host).catch(() => ({} as { [name: string]: number }));
+	// Sums over every label set of the metric.
+	const total = (metrics: { [name: string]: number }, name: string) => Object.keys(metrics)
+		.filter(key => key === name || key.startsWith(`${name}{`))
+		.reduce((sum, key) => sum + metrics[key], 0);
+	const delta = (name: string) => total(after, name) - total(before, name);
+
+	const received = Object.keys(stats.broadcasts)
+		.reduce((sum, type) => sum + stats.broadcasts[type], 0);
+	const latencies = stats.latencies.sort((a, b) => a - b);
+	console.log(`${options.clients} clients for ${seconds.toFixed(1)}s, ${stats.connects} connects`);
+	console.log(`commands: ${stats.commands} (${(stats.commands / seconds).toFixed(1)}/s), `
+		+ `${stats.oversized} oversized, ${stats.fragmented} fragmented`);
+	console.log(`controller: ${delta('lighting_ws_messages_in_total')} messages in, `
+		+ `${delta('lighting_ws_messages_out_total')} out, `
+		+ `${delta('lighting_ws_messages_dropped_total')} dropped`);
+	console.log(`fan-out: ${received} messages (${(received / seconds).toFixed(1)}/s), `
+		+ `${(stats.bytesIn / seconds / 1024).toFixed(1)} KiB/s across clients`);
+	Object.keys(stats.broadcasts).sort().forEach((type) => {
+		console.log(`  ${type}: ${stats.broadcasts[type]}`);
+	});
+	console.log(`updateGlobal to globalStats: p50 ${percentile(latencies, 0.5)}ms, `
+		+ `p99 ${percentile(latencies, 0.99)}ms, max ${latencies[latencies.length - 1]}ms`);
+	console.log('errors:', stats.errors);
+	console.log(`frames: ${delta('lighting_frames_rendered_total')}, `
+		+ `${delta('lighting_frame_overruns_total')} overruns`);
+	console.log(`heap: ${minFree} min free, ${minLargestBlock} min largest block`);
+}
+
+main().catch((e) => {
+	console.error(e.message);
+	process.exit(1);
+});
@@ -0,0 +1,129 @@
+// Measures what loading the UI from the controller costs with each content encoding.
+//
+//   yarn transfer <host> [--runs 5]
+//
+// For each Accept-Encoding below, fetches / and every /_nuxt/ asset it references over at most
+// six connections, like a browser, and reports the bytes on the wire and how long it took until
+// the last asset arrived, a stand-in for DOMContentLoaded, which waits for Nuxt's deferred
+// scripts. It then opens /ws as the UI does once loaded, and reports time-to-interactive as when the effect
+// schema and the first config message have both come back, which is when the UI can show the
+// effect forms. To measure a slow link, throttle the host first, e.g.
+//   tc qdisc add dev wlan0 root tbf rate 1mbit burst 32kbit latency 400ms
+/// <reference path="./ws.d.ts" />
+import http from 'http';
+import zlib from 'zlib';
+import WebSocket from 'ws';
+import { decode } from '@msgpack/msgpack';
+
+const ENCODINGS = ['br, gzip', 'gzip', 'identity'];
+
+interface Result {
+	bytes: number,
+	ms: number,
+	interactiveMs: number,
+	encodings: { [encoding: string]: number },
+}
+
+function fetch(agent: http.Agent, host: string, path: string, acceptEncoding: string)
+	: Promise<{ body: Buffer, encoding: string }> {
+	return new Promise((resolve, reject) => {
+		http.get({ host, path, agent, headers: { 'Accept-Encoding': acceptEncoding } }, (res) => {
+			const chunks: Buffer[] = [];
+			res.on('data', (chunk: Buffer) => chunks.push(chunk));
+			res.on('end', () => {
+				if (res.statusCode !== 200) {
+					reject(new Error(`${path}: ${res.statusCode}`));
+					return;
+				}
+				resolve({
+					body: Buffer.concat(chunks),
+					encoding: (res.headers['content-encoding'] as string) || 'identity',
+				});
+			});
+		}).on('error', reject);
+	});
+}
+
+// Resolves once /ws has sent both the effect schema and the strips' config.
+function firstConfig(host: string): Promise<void> {
+	return new Promise((resolve, reject) => {
+		const ws = new WebSocket(`ws://${host}/ws`);
+		ws.binaryType = 'arraybuffer';
+		const seen = new Set<string>();
+		ws.on('message', (data) => {
+			if (typeof data === 'string') return;
+			seen.add((decode(data as ArrayBuffer) as any).type);
+			if (seen.has('effectConfig') && seen.has('config')) {
+				ws.terminate();
+				resolve();
+			}
+		});
+		ws.on('error', reject);
+		ws.on('close', () => reject(new Error('/ws closed before sending the config')));
+	});
+}
+
+async function load(host: string, acceptEncoding: string): Promise<Result> {
+	const agent = new http.Agent({ keepAlive: true, maxSockets: 6 });
+	const result: Result = {
+		bytes: 0, ms: 0, interactiveMs: 0, encodings: {},
+	};
+	const count = (response: { body: Buffer, encoding: string }) => {
+		result.bytes += response.body.length;
+		result.encodings[response.encoding] = (result.encodings[response.encoding] || 0) + 1;
+	};
+	const start = Date.now();
+	const page = await fetch(agent, host, '/', acceptEncoding);
+	count(page);
+	const decode = { br: zlib.brotliDecompressSync, gzip: zlib.gunzipSync } as
+		{ [encoding: string]: (data: Buffer) => Buffer };
+	const html = (decode[page.encoding] ? decode[page.encoding](page.body) : page.body).toString();
+	const assets = new Set<string>();
+	const pattern = /(?:src|href)="(\/_nuxt\/[^"]+)"/g;
+	let match;
+	while ((match = pattern.exec(html))) assets.add(match[1]);
+	(await Promise.all(Array.from(assets, path => fetch(agent, host, path, acceptEncoding))))
+		.forEach(count);
+	result.ms = Date.now() - start;
+	agent.destroy();
+	await firstConfig(host);
+	result.interactiveMs = Date.now() - start;
+	return result;
+}
+
+function median(values: number[]) {
+	const sorted = values.slice().sort((a, b) => a - b);
+	return sorted[Math.floor(sorted.length / 2)];
+}
+
+async function main() {
+	let host = '';
+	let runs = 5;
+	const args = process.argv.slice(2);
+	for (let i = 0; i < args.length; i++) {
+		if (args[i] === '--runs') {
+			runs = Number(args[++i]);
+		} else {
+			host = args[i];
+		}
+	}
+	if (!host) throw new Error('Usage: transfer <host> [--runs n]');
+
+	for (const acceptEncoding of ENCODINGS) {
+		const results: Result[] = [];
+		for (let i = 0; i < runs; i++) {
+			results.push(await load(host, acceptEncoding));
+		}
+		const served = Object.keys(results[0].encodings)
+			.map(encoding => `${results[0].encodings[encoding]} ${encoding}`).join(', ');
+		console.log(`Accept-Encoding: ${acceptEncoding}`);
+		console.log(`  ${(results[0].bytes / 1024).toFixed(1)} KiB (${served}), `
+			+ `median ${median(results.map(result => result.ms))}ms loaded, `
+			+ `${median(results.map(result => result.interactiveMs))}ms interactive over ${runs} loads`);
+	}
+}
+
+main().catch((e) => {
+	console.error(e.message);
+	process.exit(1);
+});
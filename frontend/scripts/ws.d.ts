@@ -0,0 +1,26 @@
+// The part of ws's client API that loadgen.ts and transfer.ts use. ws 6 is already in the
+// lockfile through webpack-bundle-analyzer, but ships no types of its own.
+declare module 'ws' {
+	import { EventEmitter } from 'events';
+
+	class WebSocket extends EventEmitter {
+		static readonly OPEN: number;
+
+		readonly readyState: number;
+
+		binaryType: 'nodebuffer' | 'arraybuffer' | 'fragments';
+
+		constructor(address: string);
+
+		send(data: ArrayBufferView | ArrayBuffer | string, options?: { fin?: boolean, binary?: boolean }): void;
+
+		terminate(): void;
+
+		on(event: 'open', listener: () => void): this;
+		on(event: 'message', listener: (data: string | ArrayBuffer) => void): this;
+		on(event: 'close', listener: (code: number, reason: string) => void): this;
+		on(event: 'error', listener: (error: Error) => void): this;
+	}
+
+	export = WebSocket;
+}
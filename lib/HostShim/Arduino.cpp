@@ -0,0 +1,143 @@
+#include "Arduino.h"
+#include "Host.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <random>
+#include <string>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+namespace {
+const auto startTime = std::chrono::steady_clock::now();
+std::atomic<bool> serialSilenced(false);
+std::mt19937 randomEngine;
+std::mutex randomLock;
+} // namespace
+
+struct HostTask {
+	std::string name;
+	std::mutex lock;
+	std::condition_variable notified;
+	uint32_t notifications = 0;
+	HostTask(const char *name) : name(name) {
+	}
+};
+
+namespace {
+thread_local HostTask *currentTask = nullptr;
+HostTask *loopTask() {
+	static HostTask task("loopTask");
+	return &task;
+}
+} // namespace
+
+unsigned long millis() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+	                                                             startTime)
+	.count();
+}
+unsigned long micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+	                                                             startTime)
+	.count();
+}
+void delay(uint32_t ms) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+void yield() {
+	std::this_thread::yield();
+}
+long random(long max) {
+	return max > 0 ? random(0, max) : 0;
+}
+long random(long min, long max) {
+	if(max <= min) return min;
+	std::lock_guard<std::mutex> guard(randomLock);
+	return std::uniform_int_distribution<long>(min, max - 1)(randomEngine);
+}
+void randomSeed(unsigned long seed) {
+	std::lock_guard<std::mutex> guard(randomLock);
+	randomEngine.seed(seed);
+}
+size_t hostStrlcpy(char *dst, const char *src, size_t size) {
+	size_t len = strlen(src);
+	if(size) {
+		size_t copied = std::min(len, size - 1);
+		memcpy(dst, src, copied);
+		dst[copied] = 0;
+	}
+	return len;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	return write(&c, 1);
+}
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+	if(!serialSilenced) fwrite(buffer, 1, size, stdout);
+	return size;
+}
+
+uint32_t EspClass::getCycleCount() {
+	auto elapsed = std::chrono::steady_clock::now() - startTime;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() *
+	       getCpuFreqMHz() / 1000;
+}
+void EspClass::restart() {
+	fflush(stdout);
+	std::exit(0);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t,
+                                   void *parameter, UBaseType_t, TaskHandle_t *handle, BaseType_t) {
+	// Tasks never return or get deleted in the firmware, so neither do these.
+	auto task = new HostTask(name);
+	if(handle) *handle = task;
+	std::thread([task, function, parameter] {
+		currentTask = task;
+		function(parameter);
+	}).detach();
+	return pdPASS;
+}
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+	if(!currentTask) currentTask = loopTask();
+	return currentTask;
+}
+char *pcTaskGetTaskName(TaskHandle_t task) {
+	return &(task ? task : xTaskGetCurrentTaskHandle())->name[0];
+}
+void vTaskDelay(TickType_t ticks) {
+	delay(ticks);
+}
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+	auto task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> guard(task->lock);
+	auto ready = [task] { return task->notifications > 0; };
+	if(ticks == portMAX_DELAY) {
+		task->notified.wait(guard, ready);
+	} else {
+		task->notified.wait_for(guard, std::chrono::milliseconds(ticks), ready);
+	}
+	auto count = task->notifications;
+	if(count) task->notifications = clearOnExit ? 0 : count - 1;
+	return count;
+}
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	{
+		std::lock_guard<std::mutex> guard(task->lock);
+		task->notifications++;
+	}
+	task->notified.notify_one();
+	return pdPASS;
+}
+BaseType_t xPortGetCoreID() {
+	return xTaskGetCurrentTaskHandle() == loopTask() ? 1 : 0;
+}
+
+namespace Host {
+void silenceSerial(bool silence) {
+	serialSilenced = silence;
+}
+} // namespace Host
@@ -0,0 +1,115 @@
+#pragma once
+// The parts of the ESP32 Arduino core and FreeRTOS the firmware uses, for building it on the host.
+// Time is the host's monotonic clock; tasks are threads.
+#include "Print.h"
+#include "Stream.h"
+#include "WString.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <math.h>
+#include <mutex>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PI 3.1415926535897932384626433832795
+#define HALF_PI 1.5707963267948966192313216916398
+#define TWO_PI 6.283185307179586476925286766559
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x02
+
+// There are no pins on the host.
+inline void pinMode(uint8_t pin, uint8_t mode) {
+}
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+}
+// Nor SNTP: the host's clock is already set.
+inline void configTime(long gmtOffset, int daylightOffset, const char *server1,
+                       const char *server2 = nullptr, const char *server3 = nullptr) {
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void yield();
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// glibc only has strlcpy from 2.38 on.
+size_t hostStrlcpy(char *dst, const char *src, size_t size);
+#define strlcpy hostStrlcpy
+
+class HardwareSerial : public Stream {
+public:
+	void begin(unsigned long baud) {
+	}
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t *buffer, size_t size) override;
+	using Print::write;
+	int available() override {
+		return 0;
+	}
+	int read() override {
+		return -1;
+	}
+	int peek() override {
+		return -1;
+	}
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+	uint32_t getFreeHeap();
+	uint32_t getMinFreeHeap();
+	uint32_t getMaxAllocHeap();
+	uint32_t getCycleCount();
+	uint32_t getCpuFreqMHz() {
+		return 240;
+	}
+	[[noreturn]] void restart();
+};
+extern EspClass ESP;
+
+// FreeRTOS, with one tick per millisecond.
+typedef struct HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY UINT32_MAX
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_TASK_NAME_LEN 16
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackDepth,
+                                   void *parameter, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+char *pcTaskGetTaskName(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+BaseType_t xPortGetCoreID();
+
+// A critical section is a recursive mutex: nothing on the host needs interrupts masked.
+struct portMUX_TYPE {
+	std::recursive_mutex mutex;
+};
+#define portMUX_INITIALIZER_UNLOCKED                                                               \
+	{}
+#define portENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->mutex.unlock()
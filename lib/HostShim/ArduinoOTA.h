@@ -0,0 +1,52 @@
+#pragma once
+// ArduinoOTA without a network: no update ever starts, so the callbacks are kept and never called.
+#include <Arduino.h>
+#include <functional>
+
+#define U_FLASH 0
+#define U_SPIFFS 100
+
+typedef enum {
+	OTA_AUTH_ERROR,
+	OTA_BEGIN_ERROR,
+	OTA_CONNECT_ERROR,
+	OTA_RECEIVE_ERROR,
+	OTA_END_ERROR
+} ota_error_t;
+
+class ArduinoOTAClass {
+public:
+	typedef std::function<void(void)> THandlerFunction;
+	typedef std::function<void(ota_error_t)> THandlerFunction_Error;
+	typedef std::function<void(unsigned int, unsigned int)> THandlerFunction_Progress;
+
+	ArduinoOTAClass &onStart(THandlerFunction fn) {
+		start = std::move(fn);
+		return *this;
+	}
+	ArduinoOTAClass &onEnd(THandlerFunction fn) {
+		end = std::move(fn);
+		return *this;
+	}
+	ArduinoOTAClass &onError(THandlerFunction_Error fn) {
+		error = std::move(fn);
+		return *this;
+	}
+	ArduinoOTAClass &onProgress(THandlerFunction_Progress fn) {
+		progress = std::move(fn);
+		return *this;
+	}
+	void begin() {
+	}
+	void handle() {
+	}
+	int getCommand() {
+		return U_FLASH;
+	}
+
+private:
+	THandlerFunction start, end;
+	THandlerFunction_Error error;
+	THandlerFunction_Progress progress;
+};
+extern ArduinoOTAClass ArduinoOTA;
@@ -0,0 +1,3 @@
+#pragma once
+// Nothing from AsyncTCP is used directly; ESPAsyncWebServer.h stands in for the network.
+#include <Arduino.h>
@@ -0,0 +1,3 @@
+#pragma once
+// Nothing from EEPROM is used; main.cpp only includes it.
+#include <Arduino.h>
@@ -0,0 +1,235 @@
+#include "ESPAsyncWebServer.h"
+#include <algorithm>
+#include <cstdarg>
+#include <strings.h>
+
+AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(size_t size) {
+	reserve(size);
+}
+AsyncWebSocketMessageBuffer::AsyncWebSocketMessageBuffer(uint8_t *data, size_t size) {
+	if(reserve(size) && data) memcpy(_data, data, size);
+}
+AsyncWebSocketMessageBuffer::~AsyncWebSocketMessageBuffer() {
+	delete[] _data;
+}
+bool AsyncWebSocketMessageBuffer::reserve(size_t size) {
+	delete[] _data;
+	_len = size;
+	_data = new uint8_t[size + 1];
+	_data[size] = 0;
+	return true;
+}
+
+AsyncWebSocketClient::~AsyncWebSocketClient() {
+	for(auto message : _messageQueue) {
+		delete message;
+	}
+}
+void AsyncWebSocketClient::close(uint16_t, const char *) {
+	std::lock_guard<std::mutex> guard(_lock);
+	if(_status == WS_CONNECTED) _status = WS_DISCONNECTING;
+}
+bool AsyncWebSocketClient::queueIsFull() {
+	std::lock_guard<std::mutex> guard(_lock);
+	return _messageQueue.size() >= WS_MAX_QUEUED_MESSAGES || _status != WS_CONNECTED;
+}
+void AsyncWebSocketClient::message(AsyncWebSocketMessage *message) {
+	if(!message) return;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		if(_status == WS_CONNECTED && _messageQueue.size() < WS_MAX_QUEUED_MESSAGES) {
+			_messageQueue.push_back(message);
+			return;
+		}
+	}
+	delete message;
+}
+size_t AsyncWebSocketClient::printf(const char *format, ...) {
+	char buffer[64];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if(len < 0) return 0;
+	len = std::min((size_t)len, sizeof(buffer) - 1);
+	text(buffer, len);
+	return len;
+}
+size_t AsyncWebSocketClient::queueLength() {
+	std::lock_guard<std::mutex> guard(_lock);
+	return _messageQueue.size();
+}
+size_t AsyncWebSocketClient::deliver(size_t max) {
+	size_t sent = 0;
+	while(sent < max) {
+		AsyncWebSocketMessage *message;
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			if(_messageQueue.empty()) break;
+			message = _messageQueue.front();
+			_messageQueue.pop_front();
+		}
+		if(_onSend) _onSend(message->opcode(), message->data(), message->length());
+		delete message;
+		sent++;
+	}
+	return sent;
+}
+
+AsyncWebSocket::~AsyncWebSocket() {
+	for(auto client : _clients) {
+		delete client;
+	}
+}
+size_t AsyncWebSocket::count() {
+	std::lock_guard<std::recursive_mutex> guard(_lock);
+	return std::count_if(_clients.begin(), _clients.end(),
+	                     [](AsyncWebSocketClient *client) { return client->status() == WS_CONNECTED; });
+}
+AsyncWebSocketClient *AsyncWebSocket::client(uint32_t id) {
+	std::lock_guard<std::recursive_mutex> guard(_lock);
+	for(auto client : _clients) {
+		if(client->id() == id && client->status() == WS_CONNECTED) return client;
+	}
+	return nullptr;
+}
+void AsyncWebSocket::cleanupClients(uint16_t maxClients) {
+	std::lock_guard<std::recursive_mutex> guard(_lock);
+	if(count() > maxClients) _clients.front()->close();
+}
+AsyncWebSocketClient *AsyncWebSocket::connect() {
+	AsyncWebSocketClient *client;
+	{
+		std::lock_guard<std::recursive_mutex> guard(_lock);
+		client = new AsyncWebSocketClient(this, _nextId++);
+		_clients.push_back(client);
+	}
+	_handleEvent(client, WS_EVT_CONNECT, nullptr, nullptr, 0);
+	return client;
+}
+void AsyncWebSocket::disconnect(AsyncWebSocketClient *client) {
+	{
+		std::lock_guard<std::recursive_mutex> guard(_lock);
+		auto found = std::find(_clients.begin(), _clients.end(), client);
+		if(found == _clients.end()) return;
+		_clients.erase(found);
+		std::lock_guard<std::mutex> clientGuard(client->_lock);
+		client->_status = WS_DISCONNECTED;
+	}
+	// Raised before the client goes away, so whoever handles it is done with the client by the time
+	// it's freed.
+	_handleEvent(client, WS_EVT_DISCONNECT, nullptr, nullptr, 0);
+	delete client;
+}
+void AsyncWebSocket::finishClosing() {
+	std::vector<AsyncWebSocketClient *> closing;
+	forEachClient([&](AsyncWebSocketClient *client) {
+		if(client->status() == WS_DISCONNECTING) closing.push_back(client);
+	});
+	for(auto client : closing) {
+		disconnect(client);
+	}
+}
+void AsyncWebSocket::receive(AsyncWebSocketClient *client, const uint8_t *data, size_t len,
+                             uint8_t opcode, size_t frameSize, size_t packetSize) {
+	frameSize = std::max<size_t>(frameSize, 1);
+	packetSize = std::max<size_t>(packetSize, 1);
+	AwsFrameInfo info = {};
+	info.message_opcode = opcode;
+	size_t offset = 0;
+	do {
+		info.opcode = info.num ? WS_CONTINUATION : opcode;
+		info.len = std::min(frameSize, len - offset);
+		info.final = offset + info.len == len;
+		info.index = 0;
+		do {
+			size_t packet = std::min<size_t>(packetSize, info.len - info.index);
+			// The library hands the handler a writable pointer into its receive buffer.
+			std::vector<uint8_t> buffer(data + offset + info.index, data + offset + info.index + packet);
+			buffer.push_back(0);
+			_handleEvent(client, WS_EVT_DATA, &info, buffer.data(), packet);
+			info.index += packet;
+		} while(info.index < info.len);
+		offset += info.len;
+		info.num++;
+	} while(offset < len);
+}
+
+String AsyncWebServerResponse::header(const String &name) const {
+	for(auto &header : _headers) {
+		if(header.first == name) return header.second;
+	}
+	return String();
+}
+String AsyncChunkedResponse::body() {
+	String text;
+	uint8_t buffer[512];
+	size_t index = 0;
+	while(size_t len = _filler(buffer, sizeof(buffer), index)) {
+		text += String(std::string((const char *)buffer, len));
+		index += len;
+	}
+	return text;
+}
+
+AsyncFileResponse::AsyncFileResponse(fs::File content, const String &path, const String &contentType,
+                                     bool download, AwsTemplateProcessor)
+: AsyncWebServerResponse(content ? 200 : 404, contentType), _content(content) {
+	String name = path.length() ? path : String(content ? content.name() : "");
+	if(name.endsWith(".gz")) addHeader("Content-Encoding", "gzip");
+	if(download) addHeader("Content-Disposition", "attachment");
+}
+String AsyncFileResponse::body() {
+	String text;
+	if(!_content) return text;
+	_content.seek(0);
+	uint8_t buffer[512];
+	while(size_t len = _content.read(buffer, sizeof(buffer))) {
+		text += String(std::string((const char *)buffer, len));
+	}
+	return text;
+}
+
+String AsyncWebServerRequest::header(const char *name) const {
+	for(auto &header : _headers) {
+		if(strcasecmp(header.first.c_str(), name) == 0) return header.second;
+	}
+	return String();
+}
+
+namespace {
+class AsyncCallbackWebHandler : public AsyncWebHandler {
+	String _uri;
+	WebRequestMethodComposite _method;
+	ArRequestHandlerFunction _onRequest;
+
+public:
+	AsyncCallbackWebHandler(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest)
+	: _uri(uri), _method(method), _onRequest(std::move(onRequest)) {
+	}
+	bool canHandle(AsyncWebServerRequest *request) override {
+		return (request->method() & _method) && request->url() == _uri;
+	}
+	void handleRequest(AsyncWebServerRequest *request) override {
+		_onRequest(request);
+	}
+};
+} // namespace
+
+// Handlers added with addHandler() belong to the caller; on() makes its own.
+AsyncWebServer::~AsyncWebServer() {
+	for(auto handler : _handlers) {
+		if(dynamic_cast<AsyncCallbackWebHandler *>(handler)) delete handler;
+	}
+}
+AsyncWebHandler &AsyncWebServer::on(const char *uri, WebRequestMethodComposite method,
+                                    ArRequestHandlerFunction onRequest) {
+	return addHandler(new AsyncCallbackWebHandler(uri, method, std::move(onRequest)));
+}
+void AsyncWebServer::handle(AsyncWebServerRequest *request) {
+	for(auto handler : _handlers) {
+		if(handler->canHandle(request)) return handler->handleRequest(request);
+	}
+	if(_notFound) return _notFound(request);
+	request->send(404);
+}
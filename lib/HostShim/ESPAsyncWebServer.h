@@ -0,0 +1,415 @@
+#pragma once
+// ESPAsyncWebServer's WebSocket and response classes, with the network replaced by calls a test
+// makes: connect(), receive() and disconnect() on AsyncWebSocket stand in for the remote end
+// talking, deliver() on a client for its socket sending what's queued. Queueing follows the
+// library: a client takes at most WS_MAX_QUEUED_MESSAGES and deletes anything beyond that, or
+// anything sent after it has disconnected. HTTP requests are made up by the test and passed to
+// AsyncWebServer::handle(), which routes them like the library.
+#include "AsyncTCP.h"
+#include "FS.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#define WS_MAX_QUEUED_MESSAGES 32
+#define DEFAULT_MAX_WS_CLIENTS 8
+#define DEBUGF(...)
+
+typedef enum {
+	HTTP_GET = 0b00000001,
+	HTTP_POST = 0b00000010,
+	HTTP_DELETE = 0b00000100,
+	HTTP_PUT = 0b00001000,
+	HTTP_PATCH = 0b00010000,
+	HTTP_HEAD = 0b00100000,
+	HTTP_OPTIONS = 0b01000000,
+	HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+typedef enum { RCT_NOT_USED = -1, RCT_DEFAULT = 0, RCT_HTTP, RCT_WS, RCT_EVENT, RCT_MAX } RequestedConnectionType;
+
+typedef enum { WS_CONTINUATION, WS_TEXT, WS_BINARY, WS_DISCONNECT = 0x08, WS_PING, WS_PONG } AwsFrameType;
+typedef enum { WS_DISCONNECTED, WS_CONNECTED, WS_DISCONNECTING } AwsClientStatus;
+typedef enum { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA } AwsEventType;
+
+typedef struct {
+	uint8_t message_opcode;
+	uint32_t num;
+	uint8_t final;
+	uint8_t masked;
+	uint8_t opcode;
+	uint64_t len;
+	uint8_t mask[4];
+	uint64_t index;
+} AwsFrameInfo;
+
+class AsyncWebSocketMessageBuffer {
+	uint8_t *_data = nullptr;
+	size_t _len = 0;
+	bool _lock = false;
+	// Messages on different clients' queues share the buffer and are freed on the network's thread.
+	std::atomic<uint32_t> _count{ 0 };
+
+public:
+	AsyncWebSocketMessageBuffer() = default;
+	AsyncWebSocketMessageBuffer(size_t size);
+	AsyncWebSocketMessageBuffer(uint8_t *data, size_t size);
+	AsyncWebSocketMessageBuffer(const AsyncWebSocketMessageBuffer &) = delete;
+	~AsyncWebSocketMessageBuffer();
+	void operator++(int) {
+		_count++;
+	}
+	void operator--(int) {
+		uint32_t count = _count;
+		while(count && !_count.compare_exchange_weak(count, count - 1)) {
+		}
+	}
+	bool reserve(size_t size);
+	void lock() {
+		_lock = true;
+	}
+	void unlock() {
+		_lock = false;
+	}
+	uint8_t *get() {
+		return _data;
+	}
+	size_t length() {
+		return _len;
+	}
+	uint32_t count() {
+		return _count;
+	}
+	bool canDelete() {
+		return !_count;
+	}
+};
+
+class AsyncWebSocketMessage {
+protected:
+	uint8_t _opcode;
+
+public:
+	AsyncWebSocketMessage(uint8_t opcode) : _opcode(opcode) {
+	}
+	virtual ~AsyncWebSocketMessage() = default;
+	uint8_t opcode() const {
+		return _opcode;
+	}
+	virtual const uint8_t *data() const = 0;
+	virtual size_t length() const = 0;
+};
+class AsyncWebSocketBasicMessage : public AsyncWebSocketMessage {
+	std::vector<uint8_t> _data;
+
+public:
+	AsyncWebSocketBasicMessage(const char *data, size_t len, uint8_t opcode = WS_TEXT, bool mask = false)
+	: AsyncWebSocketMessage(opcode), _data((const uint8_t *)data, (const uint8_t *)data + len) {
+	}
+	const uint8_t *data() const override {
+		return _data.data();
+	}
+	size_t length() const override {
+		return _data.size();
+	}
+};
+class AsyncWebSocketMultiMessage : public AsyncWebSocketMessage {
+	AsyncWebSocketMessageBuffer *_WSbuffer;
+
+public:
+	AsyncWebSocketMultiMessage(AsyncWebSocketMessageBuffer *buffer, uint8_t opcode = WS_TEXT, bool mask = false)
+	: AsyncWebSocketMessage(opcode), _WSbuffer(buffer) {
+		if(_WSbuffer) (*_WSbuffer)++;
+	}
+	~AsyncWebSocketMultiMessage() override {
+		if(_WSbuffer) (*_WSbuffer)--;
+	}
+	const uint8_t *data() const override {
+		return _WSbuffer ? _WSbuffer->get() : nullptr;
+	}
+	size_t length() const override {
+		return _WSbuffer ? _WSbuffer->length() : 0;
+	}
+};
+
+class AsyncWebSocket;
+class AsyncWebSocketClient {
+	friend class AsyncWebSocket;
+	AsyncWebSocket *_server;
+	uint32_t _id;
+	AwsClientStatus _status = WS_CONNECTED;
+	std::mutex _lock;
+	std::deque<AsyncWebSocketMessage *> _messageQueue;
+	std::function<void(uint8_t opcode, const uint8_t *data, size_t len)> _onSend;
+
+	~AsyncWebSocketClient();
+
+public:
+	AsyncWebSocketClient(AsyncWebSocket *server, uint32_t id) : _server(server), _id(id) {
+	}
+	uint32_t id() {
+		return _id;
+	}
+	AwsClientStatus status() {
+		return _status;
+	}
+	AsyncWebSocket *server() {
+		return _server;
+	}
+	void close(uint16_t code = 0, const char *message = nullptr);
+	void ping(uint8_t *data = nullptr, size_t len = 0) {
+	}
+	bool queueIsFull();
+	void message(AsyncWebSocketMessage *message);
+	void text(const char *message, size_t len) {
+		this->message(new AsyncWebSocketBasicMessage(message, len));
+	}
+	void text(const char *message) {
+		text(message, strlen(message));
+	}
+	void binary(const char *message, size_t len) {
+		this->message(new AsyncWebSocketBasicMessage(message, len, WS_BINARY));
+	}
+	void binary(const uint8_t *message, size_t len) {
+		binary((const char *)message, len);
+	}
+	void binary(AsyncWebSocketMessageBuffer *buffer) {
+		if(buffer) message(new AsyncWebSocketMultiMessage(buffer, WS_BINARY));
+	}
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+	// Host side.
+	size_t queueLength();
+	// Sends up to max queued messages in order, passing each to the onSend callback, and frees them
+	// as the library does once they're acknowledged. Returns how many went.
+	size_t deliver(size_t max = SIZE_MAX);
+	void onSend(std::function<void(uint8_t opcode, const uint8_t *data, size_t len)> callback) {
+		_onSend = std::move(callback);
+	}
+};
+
+typedef std::function<void(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type,
+                           void *arg, uint8_t *data, size_t len)>
+AwsEventHandler;
+
+class AsyncWebServerRequest;
+typedef std::function<String(const String &)> AwsTemplateProcessor;
+typedef std::function<void(AsyncWebServerRequest *request)> ArRequestHandlerFunction;
+
+class AsyncWebHandler {
+protected:
+	String _username;
+	String _password;
+
+public:
+	virtual ~AsyncWebHandler() = default;
+	AsyncWebHandler &setAuthentication(const char *username, const char *password) {
+		_username = username;
+		_password = password;
+		return *this;
+	}
+	virtual bool canHandle(AsyncWebServerRequest *request) {
+		return false;
+	}
+	virtual void handleRequest(AsyncWebServerRequest *request) {
+	}
+};
+
+class AsyncWebSocket : public AsyncWebHandler {
+	String _url;
+	AwsEventHandler _eventHandler;
+	uint32_t _nextId = 1;
+	std::recursive_mutex _lock;
+	std::list<AsyncWebSocketClient *> _clients;
+
+public:
+	AsyncWebSocket(const String &url) : _url(url) {
+	}
+	~AsyncWebSocket();
+	const char *url() const {
+		return _url.c_str();
+	}
+	void onEvent(AwsEventHandler handler) {
+		_eventHandler = std::move(handler);
+	}
+	size_t count();
+	// Connected clients only, like the library.
+	AsyncWebSocketClient *client(uint32_t id);
+	void cleanupClients(uint16_t maxClients = DEFAULT_MAX_WS_CLIENTS);
+	void _handleEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len) {
+		if(_eventHandler) _eventHandler(this, client, type, arg, data, len);
+	}
+
+	// Host side, called from whichever thread stands in for the AsyncTCP task.
+	AsyncWebSocketClient *connect();
+	// Raises WS_EVT_DISCONNECT and frees the client along with whatever it still had queued.
+	void disconnect(AsyncWebSocketClient *client);
+	// Disconnects the clients that close() was called on.
+	void finishClosing();
+	// Raises WS_EVT_DATA for a message split into frames of up to frameSize bytes, each arriving in
+	// packets of up to packetSize bytes.
+	void receive(AsyncWebSocketClient *client, const uint8_t *data, size_t len, uint8_t opcode = WS_BINARY,
+	             size_t frameSize = SIZE_MAX, size_t packetSize = SIZE_MAX);
+	template <typename F> void forEachClient(F callback) {
+		std::lock_guard<std::recursive_mutex> guard(_lock);
+		for(auto client : _clients) {
+			callback(client);
+		}
+	}
+};
+
+typedef std::function<size_t(uint8_t *buffer, size_t maxLen, size_t index)> AwsResponseFiller;
+
+class AsyncWebServerResponse {
+protected:
+	int _code;
+	String _contentType;
+	std::vector<std::pair<String, String>> _headers;
+
+public:
+	AsyncWebServerResponse(int code, const String &contentType) : _code(code), _contentType(contentType) {
+	}
+	virtual ~AsyncWebServerResponse() = default;
+	void setCode(int code) {
+		_code = code;
+	}
+	void addHeader(const String &name, const String &value) {
+		_headers.emplace_back(name, value);
+	}
+
+	// Host side.
+	int code() const {
+		return _code;
+	}
+	const String &contentType() const {
+		return _contentType;
+	}
+	String header(const String &name) const;
+	// The whole body, produced the way the library would send it.
+	virtual String body() {
+		return String();
+	}
+};
+class AsyncChunkedResponse : public AsyncWebServerResponse {
+	AwsResponseFiller _filler;
+
+public:
+	AsyncChunkedResponse(const String &contentType, AwsResponseFiller filler)
+	: AsyncWebServerResponse(200, contentType), _filler(std::move(filler)) {
+	}
+	String body() override;
+};
+
+class AsyncBasicResponse : public AsyncWebServerResponse {
+	String _content;
+
+public:
+	AsyncBasicResponse(int code, const String &contentType = String(), const String &content = String())
+	: AsyncWebServerResponse(code, contentType), _content(content) {
+	}
+	String body() override {
+		return _content;
+	}
+};
+class AsyncFileResponse : public AsyncWebServerResponse {
+	fs::File _content;
+
+public:
+	// Like the library, a .gz file is sent as such, with its Content-Encoding set.
+	AsyncFileResponse(fs::File content, const String &path, const String &contentType = String(),
+	                  bool download = false, AwsTemplateProcessor callback = nullptr);
+	AsyncFileResponse(fs::FS &fs, const String &path, const String &contentType = String(),
+	                  bool download = false, AwsTemplateProcessor callback = nullptr)
+	: AsyncFileResponse(fs.open(path, FILE_READ), path, contentType, download, callback) {
+	}
+	String body() override;
+};
+
+class AsyncWebServerRequest {
+	WebRequestMethodComposite _method;
+	String _url;
+	std::vector<std::pair<String, String>> _headers;
+	AsyncWebServerResponse *_response = nullptr;
+
+public:
+	AsyncWebServerRequest(WebRequestMethodComposite method = HTTP_GET, const String &url = "/")
+	: _method(method), _url(url) {
+	}
+	~AsyncWebServerRequest() {
+		delete _response;
+	}
+	WebRequestMethodComposite method() const {
+		return _method;
+	}
+	const String &url() const {
+		return _url;
+	}
+	// Every header is kept, so there's no need to ask for the interesting ones.
+	void addInterestingHeader(const String &name) {
+	}
+	String header(const char *name) const;
+	bool hasHeader(const char *name) const {
+		return header(name).length();
+	}
+	bool isExpectedRequestedConnType(RequestedConnectionType, RequestedConnectionType = RCT_NOT_USED,
+	                                 RequestedConnectionType = RCT_NOT_USED) {
+		return true;
+	}
+	bool authenticate(const char *username, const char *password) {
+		return true;
+	}
+	void requestAuthentication() {
+		send(401);
+	}
+	void send(AsyncWebServerResponse *response) {
+		delete _response;
+		_response = response;
+	}
+	void send(int code) {
+		send(new AsyncBasicResponse(code));
+	}
+	AsyncWebServerResponse *beginChunkedResponse(const String &contentType, AwsResponseFiller callback) {
+		return new AsyncChunkedResponse(contentType, std::move(callback));
+	}
+	AsyncWebServerResponse *beginResponse(fs::FS &fs, const String &path,
+	                                      const String &contentType = String(), bool download = false,
+	                                      AwsTemplateProcessor callback = nullptr) {
+		return new AsyncFileResponse(fs, path, contentType, download, callback);
+	}
+
+	// Host side.
+	void setHeader(const String &name, const String &value) {
+		_headers.emplace_back(name, value);
+	}
+	AsyncWebServerResponse *response() {
+		return _response;
+	}
+};
+
+class AsyncWebServer {
+	std::vector<AsyncWebHandler *> _handlers;
+	ArRequestHandlerFunction _notFound;
+
+public:
+	AsyncWebServer(uint16_t port) {
+	}
+	~AsyncWebServer();
+	AsyncWebHandler &addHandler(AsyncWebHandler *handler) {
+		_handlers.push_back(handler);
+		return *handler;
+	}
+	AsyncWebHandler &on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest);
+	void onNotFound(ArRequestHandlerFunction fn) {
+		_notFound = std::move(fn);
+	}
+	void begin() {
+	}
+
+	// Host side: the first handler that takes the request handles it, and the not-found handler
+	// anything none of them takes.
+	void handle(AsyncWebServerRequest *request);
+};
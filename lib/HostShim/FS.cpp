@@ -0,0 +1,202 @@
+#include "FS.h"
+#include "SPIFFS.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs {
+namespace {
+bool isDirectory(const std::string &path) {
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+bool isFile(const std::string &path) {
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+void makeParents(const std::string &path) {
+	for(auto slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+		::mkdir(path.substr(0, slash).c_str(), 0755);
+	}
+}
+// Every file below directory, as paths relative to the filesystem's root, like SPIFFS lists them.
+void listFiles(const std::string &root, const std::string &directory, std::vector<std::string> &files) {
+	DIR *dir = opendir((root + directory).c_str());
+	if(!dir) return;
+	while(auto entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if(name == "." || name == "..") continue;
+		auto path = (directory == "/" ? "" : directory) + "/" + name;
+		if(isDirectory(root + path)) {
+			listFiles(root, path, files);
+		} else {
+			files.push_back(path);
+		}
+	}
+	closedir(dir);
+	std::sort(files.begin(), files.end());
+}
+} // namespace
+
+struct FileImpl {
+	FS *fs;
+	std::string path;
+	FILE *file = nullptr;
+	bool writable = false;
+	bool directory = false;
+	std::vector<std::string> entries;
+	size_t nextEntry = 0;
+	~FileImpl() {
+		if(file) fclose(file);
+	}
+};
+
+size_t File::write(uint8_t c) {
+	return write(&c, 1);
+}
+size_t File::write(const uint8_t *buffer, size_t size) {
+	if(!impl || !impl->file || !impl->writable) return 0;
+	bool partial;
+	if(!impl->fs->spend(partial)) return 0;
+	size_t len = partial ? size / 2 : size;
+	len = fwrite(buffer, 1, len, impl->file);
+	fflush(impl->file);
+	return len;
+}
+int File::available() {
+	if(!impl || !impl->file) return 0;
+	return size() - position();
+}
+int File::read() {
+	uint8_t c;
+	return read(&c, 1) ? c : -1;
+}
+int File::peek() {
+	if(!impl || !impl->file) return -1;
+	int c = fgetc(impl->file);
+	if(c != EOF) ungetc(c, impl->file);
+	return c == EOF ? -1 : c;
+}
+size_t File::read(uint8_t *buffer, size_t size) {
+	if(!impl || !impl->file) return 0;
+	return fread(buffer, 1, size, impl->file);
+}
+bool File::seek(uint32_t position, SeekMode mode) {
+	if(!impl || !impl->file) return false;
+	return fseek(impl->file, position, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+}
+size_t File::position() const {
+	if(!impl || !impl->file) return 0;
+	return ftell(impl->file);
+}
+size_t File::size() const {
+	if(!impl || !impl->file) return 0;
+	struct stat info;
+	return fstat(fileno(impl->file), &info) == 0 ? info.st_size : 0;
+}
+void File::close() {
+	impl.reset();
+}
+File::operator bool() const {
+	return impl && (impl->file || impl->directory);
+}
+const char *File::name() const {
+	return impl ? impl->path.c_str() : nullptr;
+}
+bool File::isDirectory() const {
+	return impl && impl->directory;
+}
+File File::openNextFile(const char *mode) {
+	if(!impl || !impl->directory || impl->nextEntry == impl->entries.size()) return File();
+	return impl->fs->open(impl->entries[impl->nextEntry++].c_str(), mode);
+}
+void File::rewindDirectory() {
+	if(impl) impl->nextEntry = 0;
+}
+
+std::string FS::hostPath(const char *path) const {
+	return root + (path[0] == '/' ? "" : "/") + path;
+}
+bool FS::spend(bool &partial) {
+	partial = powerBudget == 1;
+	if(powerBudget == 0) return false;
+	if(powerBudget > 0) powerBudget--;
+	return true;
+}
+File FS::open(const char *path, const char *mode) {
+	auto host = hostPath(path);
+	auto impl = std::make_shared<FileImpl>();
+	impl->fs = this;
+	impl->path = path;
+	if(mode[0] == 'r') {
+		if(isDirectory(host)) {
+			impl->directory = true;
+			listFiles(root, strcmp(path, "/") ? path : "/", impl->entries);
+			return File(impl);
+		}
+		impl->file = fopen(host.c_str(), "rb");
+		return impl->file ? File(impl) : File();
+	}
+	// Creating or truncating the file is a write of its own; a cut there leaves it as it was.
+	bool partial;
+	if(!spend(partial) || partial) return File();
+	makeParents(host);
+	impl->file = fopen(host.c_str(), mode[0] == 'a' ? "ab" : "wb");
+	impl->writable = true;
+	return impl->file ? File(impl) : File();
+}
+bool FS::exists(const char *path) {
+	auto host = hostPath(path);
+	return isFile(host) || isDirectory(host);
+}
+bool FS::remove(const char *path) {
+	bool partial;
+	if(!isFile(hostPath(path)) || !spend(partial) || partial) return false;
+	return unlink(hostPath(path).c_str()) == 0;
+}
+bool FS::rename(const char *pathFrom, const char *pathTo) {
+	bool partial;
+	if(!isFile(hostPath(pathFrom)) || exists(pathTo) || !spend(partial) || partial) return false;
+	makeParents(hostPath(pathTo));
+	return ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()) == 0;
+}
+bool FS::mkdir(const char *path) {
+	auto host = hostPath(path);
+	makeParents(host + "/");
+	return isDirectory(host);
+}
+bool FS::rmdir(const char *path) {
+	return ::rmdir(hostPath(path).c_str()) == 0;
+}
+void FS::format() {
+	std::vector<std::string> files;
+	listFiles(root, "/", files);
+	for(auto &file : files) {
+		unlink(hostPath(file.c_str()).c_str());
+	}
+}
+
+bool SPIFFSFS::begin(bool, const char *, uint8_t) {
+	if(getRoot().empty()) {
+		char directory[] = "/tmp/spiffs-XXXXXX";
+		if(!mkdtemp(directory)) return false;
+		setRoot(directory);
+	}
+	return isDirectory(getRoot());
+}
+size_t SPIFFSFS::usedBytes() {
+	std::vector<std::string> files;
+	listFiles(getRoot(), "/", files);
+	size_t used = 0;
+	for(auto &file : files) {
+		struct stat info;
+		if(stat(hostPath(file.c_str()).c_str(), &info) == 0) used += info.st_size;
+	}
+	return used;
+}
+} // namespace fs
+
+fs::SPIFFSFS SPIFFS;
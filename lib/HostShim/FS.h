@@ -0,0 +1,110 @@
+#pragma once
+// The ESP32 core's FS, over a directory on the host. Paths behave like SPIFFS: any path can be
+// opened for writing without creating its directories first, and rename() fails when the new path
+// exists.
+//
+// For testing what a power cut does, cutPowerAfter() lets a given number of writes through and
+// then freezes the files: the write that crosses the limit lands half-way, or not at all for a
+// remove or rename, and nothing after it does. Reads keep working.
+#include "Stream.h"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class FS;
+struct FileImpl;
+
+class File : public Stream {
+	std::shared_ptr<FileImpl> impl;
+
+public:
+	File() = default;
+	File(std::shared_ptr<FileImpl> impl) : impl(std::move(impl)) {
+	}
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t *buffer, size_t size) override;
+	using Print::write;
+	int available() override;
+	int read() override;
+	int peek() override;
+	void flush() override {
+	}
+	size_t read(uint8_t *buffer, size_t size);
+	bool seek(uint32_t position, SeekMode mode = SeekSet);
+	size_t position() const;
+	size_t size() const;
+	void close();
+	operator bool() const;
+	const char *name() const;
+	bool isDirectory() const;
+	File openNextFile(const char *mode = FILE_READ);
+	void rewindDirectory();
+};
+
+class FS {
+	friend class File;
+	std::string root;
+	int powerBudget = -1;
+
+	// Counts a write against the power budget: false once the power is out, and partial for the
+	// write that uses up the budget.
+	bool spend(bool &partial);
+
+protected:
+	std::string hostPath(const char *path) const;
+
+public:
+	FS(const std::string &root = std::string()) : root(root) {
+	}
+	File open(const char *path, const char *mode = FILE_READ);
+	File open(const String &path, const char *mode = FILE_READ) {
+		return open(path.c_str(), mode);
+	}
+	bool exists(const char *path);
+	bool exists(const String &path) {
+		return exists(path.c_str());
+	}
+	bool remove(const char *path);
+	bool remove(const String &path) {
+		return remove(path.c_str());
+	}
+	bool rename(const char *pathFrom, const char *pathTo);
+	bool rename(const String &pathFrom, const String &pathTo) {
+		return rename(pathFrom.c_str(), pathTo.c_str());
+	}
+	bool mkdir(const char *path);
+	bool rmdir(const char *path);
+
+	// Host side.
+	void setRoot(const std::string &directory) {
+		root = directory;
+	}
+	const std::string &getRoot() const {
+		return root;
+	}
+	// -1 restores the power, as after a reboot.
+	void cutPowerAfter(int writes) {
+		powerBudget = writes;
+	}
+	bool powerCut() const {
+		return powerBudget == 0;
+	}
+	// Removes every file.
+	void format();
+};
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
@@ -0,0 +1,67 @@
+#include "FastLED.h"
+
+CFastLED FastLED;
+
+// FastLED's hsv2rgb_spectrum: hue sweeps through the three primaries evenly.
+CRGB::CRGB(const CHSV &hsv) {
+	uint8_t value = hsv.v;
+	uint8_t invsat = 255 - hsv.s;
+	uint8_t floor = (value * invsat) / 256;
+	uint8_t colorAmplitude = value - floor;
+	uint8_t hue = (hsv.h * 192) / 256;
+	uint8_t section = hue / 64;
+	uint8_t offset = hue % 64;
+	uint8_t rampUp = floor + (offset * 4 * colorAmplitude) / 256;
+	uint8_t rampDown = floor + ((63 - offset) * 4 * colorAmplitude) / 256;
+	if(section == 0) {
+		r = rampDown, g = rampUp, b = floor;
+	} else if(section == 1) {
+		r = floor, g = rampDown, b = rampUp;
+	} else {
+		r = rampUp, g = floor, b = rampDown;
+	}
+}
+
+// Like CLEDController::computeAdjustment(): brightness, correction and temperature multiply.
+void CLEDController::showLeds(uint8_t brightness) {
+	uint32_t scale[3];
+	for(auto c = 0; c < 3; c++) {
+		scale[c] = brightness ? (brightness * (correction.raw[c] + 1) * (temperature.raw[c] + 1)) >> 16 : 0;
+	}
+	sent.resize(count);
+	for(auto i = 0; i < count; i++) {
+		for(auto c = 0; c < 3; c++) {
+			sent[i].raw[c] = (data[i].raw[c] * (scale[c] + 1)) >> 8;
+		}
+	}
+	shows++;
+}
+
+void CFastLED::show(uint8_t scale) {
+	for(auto controller : controllers) {
+		controller->showLeds(scale);
+	}
+	shows++;
+}
+
+void CFastLED::setDither(uint8_t ditherMode) {
+	for(auto controller : controllers) {
+		controller->setDither(ditherMode);
+	}
+}
+
+void CFastLED::reset() {
+	for(auto controller : controllers) {
+		delete controller;
+	}
+	controllers.clear();
+}
+
+void fill_solid(CRGB *leds, int numToFill, const CRGB &color) {
+	for(auto i = 0; i < numToFill; i++) {
+		leds[i] = color;
+	}
+}
+
+void random16_add_entropy(uint16_t entropy) {
+}
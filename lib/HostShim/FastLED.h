@@ -0,0 +1,197 @@
+#pragma once
+// The parts of FastLED 3.3 the firmware uses. Controllers don't drive a pin: each keeps a copy of
+// what it last sent, with brightness, color correction and temperature applied the way FastLED
+// scales them, and counts its shows.
+#include <Arduino.h>
+#include <vector>
+
+#define FASTLED_USING_NAMESPACE
+
+#define DISABLE_DITHER 0x00
+#define BINARY_DITHER 0x01
+
+enum EOrder { RGB = 0012, RBG = 0021, GRB = 0102, GBR = 0120, BRG = 0201, BGR = 0210 };
+
+enum LEDColorCorrection {
+	TypicalSMD5050 = 0xFFB0F0,
+	TypicalLEDStrip = 0xFFB0F0,
+	Typical8mmPixel = 0xFFE08C,
+	TypicalPixelString = 0xFFE08C,
+	UncorrectedColor = 0xFFFFFF,
+};
+
+struct CHSV {
+	union {
+		struct {
+			uint8_t h, s, v;
+		};
+		uint8_t raw[3];
+	};
+	CHSV() = default;
+	CHSV(uint8_t h, uint8_t s, uint8_t v) : h(h), s(s), v(v) {
+	}
+};
+
+struct CRGB {
+	union {
+		struct {
+			uint8_t r, g, b;
+		};
+		uint8_t raw[3];
+	};
+	enum HTMLColorCode {
+		Black = 0x000000,
+		Blue = 0x0000FF,
+		Green = 0x008000,
+		Red = 0xFF0000,
+		White = 0xFFFFFF,
+	};
+	CRGB() = default;
+	CRGB(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b) {
+	}
+	CRGB(uint32_t colorcode) : r(colorcode >> 16), g(colorcode >> 8), b(colorcode) {
+	}
+	CRGB(HTMLColorCode colorcode) : CRGB((uint32_t)colorcode) {
+	}
+	CRGB(LEDColorCorrection colorcode) : CRGB((uint32_t)colorcode) {
+	}
+	CRGB(const CHSV &hsv);
+	uint8_t &operator[](uint8_t x) {
+		return raw[x];
+	}
+	const uint8_t &operator[](uint8_t x) const {
+		return raw[x];
+	}
+	bool operator==(const CRGB &other) const {
+		return r == other.r && g == other.g && b == other.b;
+	}
+	bool operator!=(const CRGB &other) const {
+		return !(*this == other);
+	}
+};
+
+template <uint8_t DATA_PIN, EOrder RGB_ORDER> class WS2812B {};
+template <uint8_t DATA_PIN, EOrder RGB_ORDER> class WS2811 {};
+template <uint8_t DATA_PIN, EOrder RGB_ORDER> class SK6812 {};
+
+class CLEDController {
+	CRGB *data;
+	int count;
+	CRGB correction = UncorrectedColor;
+	CRGB temperature = UncorrectedColor;
+	uint8_t dither = BINARY_DITHER;
+	uint8_t pin;
+	std::vector<CRGB> sent;
+	uint32_t shows = 0;
+
+public:
+	CLEDController(uint8_t pin, CRGB *data, int count) : data(data), count(count), pin(pin) {
+	}
+	void showLeds(uint8_t brightness = 255);
+	CLEDController &setCorrection(CRGB correction) {
+		this->correction = correction;
+		return *this;
+	}
+	CRGB getCorrection() {
+		return correction;
+	}
+	CLEDController &setTemperature(CRGB temperature) {
+		this->temperature = temperature;
+		return *this;
+	}
+	CRGB getTemperature() {
+		return temperature;
+	}
+	CLEDController &setDither(uint8_t ditherMode = BINARY_DITHER) {
+		dither = ditherMode;
+		return *this;
+	}
+	uint8_t getDither() {
+		return dither;
+	}
+	CRGB *leds() {
+		return data;
+	}
+	int size() {
+		return count;
+	}
+
+	// Host side.
+	uint8_t getPin() const {
+		return pin;
+	}
+	// What went out on the last show, scaled.
+	const std::vector<CRGB> &lastSent() const {
+		return sent;
+	}
+	uint32_t showCount() const {
+		return shows;
+	}
+};
+
+class CFastLED {
+	std::vector<CLEDController *> controllers;
+	uint8_t brightness = 255;
+	uint32_t shows = 0;
+
+public:
+	template <template <uint8_t, EOrder> class Chipset, uint8_t Pin, EOrder Order>
+	CLEDController &addLeds(CRGB *data, int count) {
+		controllers.push_back(new CLEDController(Pin, data, count));
+		return *controllers.back();
+	}
+	void setBrightness(uint8_t scale) {
+		brightness = scale;
+	}
+	uint8_t getBrightness() {
+		return brightness;
+	}
+	// Sends every controller's pixels, as one batch on the ESP32's RMT driver.
+	void show(uint8_t scale);
+	void show() {
+		show(brightness);
+	}
+	void setDither(uint8_t ditherMode = BINARY_DITHER);
+	int count() {
+		return controllers.size();
+	}
+	CLEDController &operator[](int x) {
+		return *controllers[x];
+	}
+
+	// Host side.
+	uint32_t showCount() const {
+		return shows;
+	}
+	// Forgets every controller, for tests that set up strips more than once.
+	void reset();
+};
+extern CFastLED FastLED;
+
+void fill_solid(CRGB *leds, int numToFill, const CRGB &color);
+void random16_add_entropy(uint16_t entropy);
+
+// Runs the statement that follows once every period, the first time a period after it's reached.
+class CEveryNMillis {
+	uint32_t period;
+	uint32_t previous;
+
+public:
+	CEveryNMillis(uint32_t period) : period(period), previous(millis()) {
+	}
+	bool ready() {
+		uint32_t now = millis();
+		if(now - previous < period) return false;
+		previous = now;
+		return true;
+	}
+	operator bool() {
+		return ready();
+	}
+};
+#define FASTLED_CONCAT_(a, b) a##b
+#define FASTLED_CONCAT(a, b) FASTLED_CONCAT_(a, b)
+#define EVERY_N_MILLIS(n)                                                                          \
+	static CEveryNMillis FASTLED_CONCAT(everyN, __LINE__)(n);                                       \
+	if(FASTLED_CONCAT(everyN, __LINE__))
+#define EVERY_N_SECONDS(n) EVERY_N_MILLIS((n)*1000UL)
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Controls for tests that only exist on the host.
+namespace Host {
+// Drops everything written to Serial, for tests whose output would drown in the firmware's logs.
+void silenceSerial(bool silence);
+// Adds a data partition backed by path, which is created erased (all 0xFF) if it doesn't exist or
+// has a different size. Partitions stay until removePartitions().
+void addPartition(const char *label, uint8_t subtype, uint32_t size, const char *path);
+// Unmaps and forgets every partition; their files are kept.
+void removePartitions();
+// The simulated heap behind operator new and the firmware's Heap functions. Free bytes count whole
+// free blocks, headers included.
+struct HeapStats {
+	size_t totalBytes; // HOST_HEAP_SIZE
+	size_t freeBytes;
+	size_t largestFreeBlock; // the largest allocation that would succeed
+	size_t minFreeBytes;
+	size_t liveBlocks;
+	uint32_t allocations; // since start
+};
+HeapStats heapStats();
+} // namespace Host
@@ -0,0 +1,176 @@
+// The firmware's heap on the host. operator new and Heap's backing functions allocate from one
+// fixed region, first fit with free blocks kept in address order and merged with their
+// neighbours, like the ESP32's heap, so the firmware's fragmentation shows up in ESP's numbers.
+// Memory the C library allocates for itself isn't counted.
+#include "Host.h"
+#include <Arduino.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#ifndef HOST_HEAP_SIZE
+#define HOST_HEAP_SIZE (512 * 1024)
+#endif
+
+namespace Heap {
+void *backingAllocate(size_t size);
+void *backingReallocate(void *ptr, size_t size);
+void backingFree(void *ptr);
+} // namespace Heap
+
+namespace {
+struct alignas(16) Block {
+	size_t size; // header included
+	Block *nextFree; // in use if this is inUse
+};
+Block *const inUse = (Block *)1;
+constexpr size_t minBlock = 2 * sizeof(Block);
+
+alignas(16) uint8_t region[HOST_HEAP_SIZE];
+std::mutex lock;
+Block *freeList = nullptr;
+bool initialized = false;
+size_t freeBytes = 0;
+size_t minFreeBytes = 0;
+size_t liveBlocks = 0;
+uint32_t allocations = 0;
+
+void initialize() {
+	freeList = (Block *)region;
+	freeList->size = HOST_HEAP_SIZE;
+	freeList->nextFree = nullptr;
+	freeBytes = minFreeBytes = HOST_HEAP_SIZE;
+	initialized = true;
+}
+bool owns(void *ptr) {
+	return ptr >= region && ptr < region + HOST_HEAP_SIZE;
+}
+void *allocate(size_t size) {
+	size_t needed = (size + sizeof(Block) + alignof(Block) - 1) / alignof(Block) * alignof(Block);
+	if(needed < minBlock) needed = minBlock;
+	std::lock_guard<std::mutex> guard(lock);
+	if(!initialized) initialize();
+	for(Block **link = &freeList; *link; link = &(*link)->nextFree) {
+		Block *block = *link;
+		if(block->size < needed) continue;
+		if(block->size - needed >= minBlock) {
+			auto rest = (Block *)((uint8_t *)block + needed);
+			rest->size = block->size - needed;
+			rest->nextFree = block->nextFree;
+			block->size = needed;
+			*link = rest;
+		} else {
+			*link = block->nextFree;
+		}
+		block->nextFree = inUse;
+		freeBytes -= block->size;
+		if(freeBytes < minFreeBytes) minFreeBytes = freeBytes;
+		liveBlocks++;
+		allocations++;
+		return block + 1;
+	}
+	return nullptr;
+}
+void release(void *ptr) {
+	if(!ptr) return;
+	if(!owns(ptr)) return free(ptr);
+	auto block = (Block *)ptr - 1;
+	std::lock_guard<std::mutex> guard(lock);
+	if(block->nextFree != inUse) abort(); // freed twice
+	freeBytes += block->size;
+	liveBlocks--;
+	Block *previous = nullptr;
+	Block **link = &freeList;
+	while(*link && *link < block) {
+		previous = *link;
+		link = &(*link)->nextFree;
+	}
+	block->nextFree = *link;
+	*link = block;
+	if(block->nextFree && (uint8_t *)block + block->size == (uint8_t *)block->nextFree) {
+		block->size += block->nextFree->size;
+		block->nextFree = block->nextFree->nextFree;
+	}
+	if(previous && (uint8_t *)previous + previous->size == (uint8_t *)block) {
+		previous->size += block->size;
+		previous->nextFree = block->nextFree;
+	}
+}
+void *reallocate(void *ptr, size_t size) {
+	if(!ptr) return allocate(size);
+	if(!owns(ptr)) return realloc(ptr, size);
+	auto available = ((Block *)ptr - 1)->size - sizeof(Block);
+	if(size <= available) return ptr;
+	auto moved = allocate(size);
+	if(!moved) return nullptr;
+	memcpy(moved, ptr, available);
+	release(ptr);
+	return moved;
+}
+} // namespace
+
+Host::HeapStats Host::heapStats() {
+	std::lock_guard<std::mutex> guard(lock);
+	if(!initialized) initialize();
+	size_t largest = 0;
+	for(auto block = freeList; block; block = block->nextFree) {
+		if(block->size > largest) largest = block->size;
+	}
+	return HeapStats{ HOST_HEAP_SIZE, freeBytes, largest > sizeof(Block) ? largest - sizeof(Block) : 0,
+		              minFreeBytes, liveBlocks, allocations };
+}
+
+uint32_t EspClass::getFreeHeap() {
+	return Host::heapStats().freeBytes;
+}
+uint32_t EspClass::getMinFreeHeap() {
+	return Host::heapStats().minFreeBytes;
+}
+uint32_t EspClass::getMaxAllocHeap() {
+	return Host::heapStats().largestFreeBlock;
+}
+
+void *Heap::backingAllocate(size_t size) {
+	return allocate(size);
+}
+void *Heap::backingReallocate(void *ptr, size_t size) {
+	return reallocate(ptr, size);
+}
+void Heap::backingFree(void *ptr) {
+	release(ptr);
+}
+
+void *operator new(size_t size) {
+	auto ptr = allocate(size);
+	if(!ptr) throw std::bad_alloc();
+	return ptr;
+}
+void *operator new[](size_t size) {
+	return operator new(size);
+}
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+	return allocate(size);
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+	return allocate(size);
+}
+void operator delete(void *ptr) noexcept {
+	release(ptr);
+}
+void operator delete[](void *ptr) noexcept {
+	release(ptr);
+}
+void operator delete(void *ptr, size_t) noexcept {
+	release(ptr);
+}
+void operator delete[](void *ptr, size_t) noexcept {
+	release(ptr);
+}
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+	release(ptr);
+}
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+	release(ptr);
+}
@@ -0,0 +1,54 @@
+#include "Preferences.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+using Namespace = std::map<std::string, std::vector<uint8_t>>;
+std::mutex lock;
+std::map<std::string, Namespace> &store() {
+	static std::map<std::string, Namespace> store;
+	return store;
+}
+} // namespace
+
+bool Preferences::begin(const char *name, bool) {
+	this->name = name;
+	started = true;
+	return true;
+}
+bool Preferences::clear() {
+	if(!started) return false;
+	std::lock_guard<std::mutex> guard(lock);
+	store()[name].clear();
+	return true;
+}
+bool Preferences::remove(const char *key) {
+	if(!started) return false;
+	std::lock_guard<std::mutex> guard(lock);
+	return store()[name].erase(key);
+}
+size_t Preferences::put(const char *key, const void *value, size_t len) {
+	if(!started) return 0;
+	std::lock_guard<std::mutex> guard(lock);
+	auto bytes = (const uint8_t *)value;
+	store()[name][key].assign(bytes, bytes + len);
+	return len;
+}
+size_t Preferences::get(const char *key, void *value, size_t maxLen) const {
+	if(!started) return 0;
+	std::lock_guard<std::mutex> guard(lock);
+	auto &entries = store()[name];
+	auto entry = entries.find(key);
+	if(entry == entries.end() || entry->second.size() > maxLen) return 0;
+	memcpy(value, entry->second.data(), entry->second.size());
+	return entry->second.size();
+}
+size_t Preferences::getBytesLength(const char *key) const {
+	if(!started) return 0;
+	std::lock_guard<std::mutex> guard(lock);
+	auto &entries = store()[name];
+	auto entry = entries.find(key);
+	return entry == entries.end() ? 0 : entry->second.size();
+}
@@ -0,0 +1,48 @@
+#pragma once
+// The ESP32 core's Preferences over an in-memory NVS. Namespaces are shared by every instance and
+// live as long as the process, so a test can "reboot" by opening them again.
+#include <Arduino.h>
+
+class Preferences {
+	std::string name;
+	bool started = false;
+
+	size_t put(const char *key, const void *value, size_t len);
+	size_t get(const char *key, void *value, size_t maxLen) const;
+
+public:
+	bool begin(const char *name, bool readOnly = false);
+	void end() {
+		started = false;
+	}
+	bool clear();
+	bool remove(const char *key);
+	size_t putUChar(const char *key, uint8_t value) {
+		return put(key, &value, sizeof(value));
+	}
+	size_t putBool(const char *key, bool value) {
+		return putUChar(key, value);
+	}
+	size_t putUInt(const char *key, uint32_t value) {
+		return put(key, &value, sizeof(value));
+	}
+	size_t putBytes(const char *key, const void *value, size_t len) {
+		return len ? put(key, value, len) : 0;
+	}
+	uint8_t getUChar(const char *key, uint8_t defaultValue = 0) const {
+		get(key, &defaultValue, sizeof(defaultValue));
+		return defaultValue;
+	}
+	bool getBool(const char *key, bool defaultValue = false) const {
+		return getUChar(key, defaultValue);
+	}
+	uint32_t getUInt(const char *key, uint32_t defaultValue = 0) const {
+		get(key, &defaultValue, sizeof(defaultValue));
+		return defaultValue;
+	}
+	size_t getBytesLength(const char *key) const;
+	// Like NVS, nothing is copied unless the whole value fits.
+	size_t getBytes(const char *key, void *buffer, size_t maxLen) const {
+		return get(key, buffer, maxLen);
+	}
+};
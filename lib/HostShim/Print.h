@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include "WString.h"
+
+class Print;
+class Printable {
+public:
+	virtual ~Printable() = default;
+	virtual size_t printTo(Print &p) const = 0;
+};
+
+// Arduino's Print: everything funnels into write().
+class Print {
+public:
+	virtual ~Print() = default;
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size) {
+		size_t written = 0;
+		while(size--) {
+			if(!write(*buffer++)) break;
+			written++;
+		}
+		return written;
+	}
+	size_t write(const char *str) {
+		return write((const uint8_t *)str, strlen(str));
+	}
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+		char buffer[256];
+		va_list args;
+		va_start(args, format);
+		int len = vsnprintf(buffer, sizeof(buffer), format, args);
+		va_end(args);
+		if(len < 0) return 0;
+		if((size_t)len < sizeof(buffer)) return write((const uint8_t *)buffer, len);
+		std::string text(len + 1, 0);
+		va_start(args, format);
+		vsnprintf(&text[0], text.size(), format, args);
+		va_end(args);
+		return write((const uint8_t *)text.data(), len);
+	}
+	size_t print(const char *str) {
+		return write(str);
+	}
+	size_t print(const String &str) {
+		return write(str.c_str());
+	}
+	size_t print(char c) {
+		return write((uint8_t)c);
+	}
+	size_t print(int number) {
+		return printf("%d", number);
+	}
+	size_t print(unsigned number) {
+		return printf("%u", number);
+	}
+	size_t print(long number) {
+		return printf("%ld", number);
+	}
+	size_t print(unsigned long number) {
+		return printf("%lu", number);
+	}
+	size_t print(double number, int digits = 2) {
+		return printf("%.*f", digits, number);
+	}
+	size_t print(const Printable &printable) {
+		return printable.printTo(*this);
+	}
+	// The ESP32 core's, formatted with strftime() and asctime()'s format by default.
+	size_t print(const struct tm *timeinfo, const char *format = nullptr) {
+		char buffer[64];
+		size_t len = strftime(buffer, sizeof(buffer), format ? format : "%c", timeinfo);
+		return write((const uint8_t *)buffer, len);
+	}
+	size_t println() {
+		return write("\r\n");
+	}
+	size_t println(const struct tm *timeinfo, const char *format = nullptr) {
+		return print(timeinfo, format) + println();
+	}
+	template <typename T> size_t println(const T &value) {
+		return print(value) + println();
+	}
+};
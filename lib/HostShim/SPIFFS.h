@@ -0,0 +1,18 @@
+#pragma once
+#include "FS.h"
+
+namespace fs {
+// Lives in a fresh temporary directory unless setRoot() picks one first.
+class SPIFFSFS : public FS {
+public:
+	bool begin(bool formatOnFail = false, const char *basePath = "/spiffs", uint8_t maxOpenFiles = 10);
+	void end() {
+	}
+	size_t totalBytes() {
+		return 0x170000;
+	}
+	size_t usedBytes();
+};
+} // namespace fs
+
+extern fs::SPIFFSFS SPIFFS;
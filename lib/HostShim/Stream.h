@@ -0,0 +1,33 @@
+#pragma once
+#include "Print.h"
+
+// Arduino's Stream: a Print that can be read from too.
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual void flush() {
+	}
+	virtual size_t readBytes(char *buffer, size_t length) {
+		size_t count = 0;
+		while(count < length) {
+			int c = read();
+			if(c < 0) break;
+			buffer[count++] = (char)c;
+		}
+		return count;
+	}
+	size_t readBytes(uint8_t *buffer, size_t length) {
+		return readBytes((char *)buffer, length);
+	}
+	// Without a timeout: the data is either there or not coming.
+	String readStringUntil(char terminator) {
+		String text;
+		int c;
+		while((c = read()) >= 0 && c != terminator) {
+			text += (char)c;
+		}
+		return text;
+	}
+};
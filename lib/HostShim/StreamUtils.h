@@ -0,0 +1,35 @@
+#pragma once
+// StreamUtils' ReadBufferingStream: reads the upstream Stream in blocks rather than byte by byte.
+#include "Stream.h"
+#include <vector>
+
+class ReadBufferingStream : public Stream {
+	Stream &upstream;
+	std::vector<uint8_t> buffer;
+	size_t position = 0;
+	size_t filled = 0;
+
+	bool fill() {
+		if(position < filled) return true;
+		position = 0;
+		filled = upstream.readBytes(buffer.data(), buffer.size());
+		return filled > 0;
+	}
+
+public:
+	ReadBufferingStream(Stream &upstream, size_t capacity) : upstream(upstream), buffer(capacity) {
+	}
+	int available() override {
+		return filled - position + upstream.available();
+	}
+	int read() override {
+		return fill() ? buffer[position++] : -1;
+	}
+	int peek() override {
+		return fill() ? buffer[position] : -1;
+	}
+	size_t write(uint8_t c) override {
+		return upstream.write(c);
+	}
+	using Print::write;
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Arduino's String, over std::string.
+class String {
+	std::string value;
+
+public:
+	String() = default;
+	String(const char *str) : value(str ? str : "") {
+	}
+	String(const std::string &str) : value(str) {
+	}
+	explicit String(char c) : value(1, c) {
+	}
+	explicit String(int number) : value(std::to_string(number)) {
+	}
+	explicit String(unsigned number) : value(std::to_string(number)) {
+	}
+	explicit String(long number) : value(std::to_string(number)) {
+	}
+	explicit String(unsigned long number) : value(std::to_string(number)) {
+	}
+	const char *c_str() const {
+		return value.c_str();
+	}
+	unsigned length() const {
+		return value.size();
+	}
+	void reserve(unsigned size) {
+		value.reserve(size);
+	}
+	char charAt(unsigned index) const {
+		return index < value.size() ? value[index] : 0;
+	}
+	char operator[](unsigned index) const {
+		return charAt(index);
+	}
+	bool concat(const String &str) {
+		value += str.value;
+		return true;
+	}
+	String &operator+=(const String &str) {
+		value += str.value;
+		return *this;
+	}
+	String &operator+=(const char *str) {
+		value += str;
+		return *this;
+	}
+	String &operator+=(char c) {
+		value += c;
+		return *this;
+	}
+	bool equals(const String &str) const {
+		return value == str.value;
+	}
+	bool operator==(const String &str) const {
+		return value == str.value;
+	}
+	bool operator==(const char *str) const {
+		return value == str;
+	}
+	bool operator!=(const String &str) const {
+		return value != str.value;
+	}
+	bool operator!=(const char *str) const {
+		return value != str;
+	}
+	bool operator<(const String &str) const {
+		return value < str.value;
+	}
+	bool startsWith(const String &prefix) const {
+		return value.compare(0, prefix.value.size(), prefix.value) == 0;
+	}
+	bool endsWith(const String &suffix) const {
+		return value.size() >= suffix.value.size() &&
+		       value.compare(value.size() - suffix.value.size(), suffix.value.size(), suffix.value) == 0;
+	}
+	int indexOf(char c, unsigned from = 0) const {
+		auto index = value.find(c, from);
+		return index == std::string::npos ? -1 : (int)index;
+	}
+	int indexOf(const String &str, unsigned from = 0) const {
+		auto index = value.find(str.value, from);
+		return index == std::string::npos ? -1 : (int)index;
+	}
+	int lastIndexOf(char c) const {
+		auto index = value.rfind(c);
+		return index == std::string::npos ? -1 : (int)index;
+	}
+	String substring(unsigned from) const {
+		return from < value.size() ? String(value.substr(from)) : String();
+	}
+	String substring(unsigned from, unsigned to) const {
+		if(from > to) std::swap(from, to);
+		return from < value.size() ? String(value.substr(from, to - from)) : String();
+	}
+	long toInt() const {
+		return strtol(value.c_str(), nullptr, 10);
+	}
+	float toFloat() const {
+		return strtof(value.c_str(), nullptr);
+	}
+	void trim() {
+		auto first = value.find_first_not_of(" \t\r\n");
+		auto last = value.find_last_not_of(" \t\r\n");
+		value = first == std::string::npos ? "" : value.substr(first, last - first + 1);
+	}
+	void toLowerCase() {
+		for(auto &c : value) c = tolower(c);
+	}
+	friend String operator+(String lhs, const String &rhs) {
+		lhs += rhs;
+		return lhs;
+	}
+	friend String operator+(String lhs, const char *rhs) {
+		lhs += rhs;
+		return lhs;
+	}
+	friend String operator+(const char *lhs, const String &rhs) {
+		return String(lhs) + rhs;
+	}
+};
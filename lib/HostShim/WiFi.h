@@ -0,0 +1,75 @@
+#pragma once
+// The ESP32 core's WiFi without a radio: scans find no networks and connecting never completes, so
+// the events the firmware listens for never come.
+#include "esp_wifi.h"
+#include <Arduino.h>
+#include <functional>
+
+typedef enum {
+	SYSTEM_EVENT_WIFI_READY,
+	SYSTEM_EVENT_SCAN_DONE,
+	SYSTEM_EVENT_STA_START,
+	SYSTEM_EVENT_STA_STOP,
+	SYSTEM_EVENT_STA_CONNECTED,
+	SYSTEM_EVENT_STA_DISCONNECTED,
+	SYSTEM_EVENT_STA_AUTHMODE_CHANGE,
+	SYSTEM_EVENT_STA_GOT_IP,
+	SYSTEM_EVENT_STA_LOST_IP,
+} system_event_id_t;
+typedef system_event_id_t WiFiEvent_t;
+
+typedef struct {
+	struct {
+		struct {
+			struct {
+				uint32_t addr;
+			} ip, netmask, gw;
+		} ip_info;
+	} got_ip;
+} WiFiEventInfo_t;
+
+typedef std::function<void(WiFiEvent_t event, WiFiEventInfo_t info)> WiFiEventFuncCb;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+class IPAddress : public Printable {
+	uint32_t address;
+
+public:
+	IPAddress(uint32_t address = 0) : address(address) {
+	}
+	operator uint32_t() const {
+		return address;
+	}
+	size_t printTo(Print &p) const override {
+		return p.printf("%u.%u.%u.%u", address & 0xFF, (address >> 8) & 0xFF, (address >> 16) & 0xFF,
+		                address >> 24);
+	}
+};
+
+class WiFiClass {
+public:
+	int begin(const char *ssid, const char *passphrase = nullptr) {
+		return 0;
+	}
+	int onEvent(WiFiEventFuncCb callback, WiFiEvent_t event) {
+		return 0;
+	}
+	int16_t scanNetworks(bool async = false) {
+		return async ? WIFI_SCAN_RUNNING : 0;
+	}
+	int16_t scanComplete() {
+		return 0;
+	}
+	String SSID(uint8_t networkItem) {
+		return String();
+	}
+	int32_t RSSI(uint8_t networkItem) {
+		return 0;
+	}
+	wifi_auth_mode_t encryptionType(uint8_t networkItem) {
+		return WIFI_AUTH_OPEN;
+	}
+};
+extern WiFiClass WiFi;
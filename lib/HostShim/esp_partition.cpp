@@ -0,0 +1,116 @@
+#include "Host.h"
+#include "esp_partition.h"
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+struct HostPartition {
+	esp_partition_t info;
+	uint8_t *flash;
+};
+std::vector<std::unique_ptr<HostPartition>> partitions;
+
+HostPartition *find(const esp_partition_t *partition) {
+	for(auto &entry : partitions) {
+		if(&entry->info == partition) return entry.get();
+	}
+	return nullptr;
+}
+bool inRange(const esp_partition_t *partition, size_t offset, size_t size) {
+	return offset <= partition->size && size <= partition->size - offset;
+}
+} // namespace
+
+void Host::addPartition(const char *label, uint8_t subtype, uint32_t size, const char *path) {
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) abort();
+	struct stat st;
+	fstat(fd, &st);
+	bool erased = st.st_size != (off_t)size;
+	if(erased && ftruncate(fd, size) != 0) abort();
+	auto flash = (uint8_t *)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(flash == MAP_FAILED) abort();
+	if(erased) memset(flash, 0xFF, size);
+	std::unique_ptr<HostPartition> partition(new HostPartition());
+	partition->info.type = ESP_PARTITION_TYPE_DATA;
+	partition->info.subtype = (esp_partition_subtype_t)subtype;
+	partition->info.address = partitions.empty() ?
+	                          0x10000 :
+	                          partitions.back()->info.address + partitions.back()->info.size;
+	partition->info.size = size;
+	strncpy(partition->info.label, label, sizeof(partition->info.label) - 1);
+	partition->flash = flash;
+	partitions.push_back(std::move(partition));
+}
+
+void Host::removePartitions() {
+	for(auto &partition : partitions) {
+		munmap(partition->flash, partition->info.size);
+	}
+	partitions.clear();
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label) {
+	for(auto &partition : partitions) {
+		auto &info = partition->info;
+		if(info.type != type) continue;
+		if(subtype != ESP_PARTITION_SUBTYPE_ANY && info.subtype != subtype) continue;
+		if(label && strcmp(info.label, label) != 0) continue;
+		return &info;
+	}
+	return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+	auto entry = find(partition);
+	if(!entry) return ESP_ERR_INVALID_ARG;
+	if(!inRange(partition, src_offset, size)) return ESP_ERR_INVALID_SIZE;
+	memcpy(dst, entry->flash + src_offset, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+	auto entry = find(partition);
+	if(!entry) return ESP_ERR_INVALID_ARG;
+	if(!inRange(partition, dst_offset, size)) return ESP_ERR_INVALID_SIZE;
+	auto in = (const uint8_t *)src;
+	for(size_t i = 0; i < size; i++) {
+		entry->flash[dst_offset + i] &= in[i];
+	}
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+	auto entry = find(partition);
+	if(!entry) return ESP_ERR_INVALID_ARG;
+	if(offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) return ESP_ERR_INVALID_SIZE;
+	if(!inRange(partition, offset, size)) return ESP_ERR_INVALID_SIZE;
+	memset(entry->flash + offset, 0xFF, size);
+	return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition,
+                             size_t offset,
+                             size_t size,
+                             spi_flash_mmap_memory_t memory,
+                             const void **out_ptr,
+                             spi_flash_mmap_handle_t *out_handle) {
+	auto entry = find(partition);
+	if(!entry) return ESP_ERR_INVALID_ARG;
+	if(!inRange(partition, offset, size)) return ESP_ERR_INVALID_SIZE;
+	*out_ptr = entry->flash + offset;
+	*out_handle = 0;
+	return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+}
@@ -0,0 +1,17 @@
+#pragma once
+// There's no radio on the host, so power saving is accepted and does nothing.
+#include "esp_err.h"
+
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+typedef enum {
+	WIFI_AUTH_OPEN,
+	WIFI_AUTH_WEP,
+	WIFI_AUTH_WPA_PSK,
+	WIFI_AUTH_WPA2_PSK,
+	WIFI_AUTH_WPA_WPA2_PSK,
+	WIFI_AUTH_WPA2_ENTERPRISE,
+} wifi_auth_mode_t;
+
+inline esp_err_t esp_wifi_set_ps(wifi_ps_type_t type) {
+	return ESP_OK;
+}
@@ -0,0 +1,96 @@
+# Compiles the generated frontend in data/www into src/EmbeddedFrontend.cpp for the embedded
+# environment in platformio.ini. Run `yarn generate` in frontend first.
+#
+# Every file goes in compressed when the build made a .gz copy of it, and as it is otherwise. The
+# ETags are content hashes, computed the same way as frontend/modules/asset-manifest.ts does.
+#
+# The .br copies are left out. Browsers only offer br over HTTPS and the controller serves plain
+# HTTP, so they would never be sent, and the UI has to share app0 (0x138000 bytes) with the
+# firmware.
+import hashlib
+import os
+
+Import("env")
+
+# The same table as getFileType() in src/ServeStatic.cpp.
+TYPES = {
+    ".html": "text/html",
+    ".htm": "text/html",
+    ".css": "text/css",
+    ".json": "application/json",
+    ".js": "application/javascript",
+    ".png": "image/png",
+    ".gif": "image/gif",
+    ".jpg": "image/jpeg",
+    ".ico": "image/x-icon",
+    ".svg": "image/svg+xml",
+    ".eot": "font/eot",
+    ".woff": "font/woff",
+    ".woff2": "font/woff2",
+    ".ttf": "font/ttf",
+    ".xml": "text/xml",
+    ".pdf": "application/pdf",
+    ".zip": "application/zip",
+}
+# Only read by ServeStatic; the embedded table carries the same information.
+SKIP = {"assets.txt"}
+
+
+def collect(root):
+    files = {}
+    for dir, _, names in os.walk(root):
+        for name in names:
+            path = os.path.join(dir, name)
+            url = "/" + os.path.relpath(path, root).replace(os.sep, "/")
+            if name in SKIP or url.endswith(".br"):
+                continue
+            gzip = url.endswith(".gz")
+            if gzip:
+                url = url[:-3]
+            # Prefer the compressed copy.
+            if gzip or url not in files:
+                files[url] = (path, gzip)
+    return files
+
+
+def generate(root, out):
+    lines = [
+        "// Generated by scripts/embed_frontend.py from data/www; don't edit.",
+        '#include "ServeEmbedded.h"',
+        "#if EMBEDDED_FRONTEND",
+    ]
+    table = []
+    total = 0
+    for i, (url, (path, gzip)) in enumerate(sorted(collect(root).items())):
+        with open(path, "rb") as f:
+            data = f.read()
+        total += len(data)
+        etag = hashlib.sha1(data).hexdigest()[:16]
+        lines.append("static const uint8_t file%d[] = {" % i)
+        for start in range(0, len(data), 16):
+            lines.append("\t" + ", ".join("0x%02x" % b for b in data[start:start + 16]) + ",")
+        lines.append("};")
+        table.append('\t{"%s", "%s", "\\"%s\\"", file%d, sizeof(file%d), %s},' % (
+            url, TYPES.get(os.path.splitext(url)[1], "text/plain"), etag, i, i,
+            "true" if gzip else "false"))
+    lines.append("const EmbeddedFile embeddedFiles[] = {")
+    lines += table
+    lines.append("};")
+    lines.append("const size_t embeddedFileCount = %d;" % len(table))
+    lines.append("#endif")
+    contents = "\n".join(lines) + "\n"
+    # Left alone when nothing changed, so it isn't recompiled on every build.
+    if os.path.exists(out):
+        with open(out) as f:
+            if f.read() == contents:
+                return
+    with open(out, "w") as f:
+        f.write(contents)
+    print("Embedded %d frontend files, %d bytes" % (len(table), total))
+
+
+project = env.subst("$PROJECT_DIR")
+root = os.path.join(project, "data", "www")
+if not os.path.isdir(root):
+    raise SystemExit("%s doesn't exist; run `yarn generate` in frontend first" % root)
+generate(root, os.path.join(project, "src", "EmbeddedFrontend.cpp"))
@@ -0,0 +1,166 @@
+#pragma once
+#include "Heap.h"
+#include "Metrics.h"
+#include <ArduinoJson.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// Every broadcast is a complete state snapshot, so a client only ever needs the latest one of
+// each channel: a newer message replaces any that hasn't been handed to the socket yet.
+enum class BroadcastChannel : uint8_t {
+	WifiList,
+	GlobalStats,
+	Config,
+	Scenes,
+	Playlist,
+	Power,
+	PerfStats,
+	Frames,
+	Count
+};
+
+// Messages handed to a client's socket but not yet acknowledged. Anything beyond this waits in
+// the client's pending slots, where it can still be replaced by a newer snapshot.
+#define BROADCAST_MAX_IN_FLIGHT 2
+
+using SharedBuffer = std::shared_ptr<AsyncWebSocketMessageBuffer>;
+
+struct BroadcastClient {
+	uint32_t id;
+	SharedBuffer pending[(uint8_t)BroadcastChannel::Count];
+	std::atomic<uint8_t> inFlight;
+	uint32_t sent = 0;
+	uint32_t dropped = 0;
+	BroadcastClient(uint32_t id) : id(id), inFlight(0) {
+	}
+	uint8_t queued() const {
+		uint8_t count = 0;
+		for(auto &buffer : pending) {
+			if(buffer) count++;
+		}
+		return count;
+	}
+};
+
+struct BroadcastStats {
+	uint32_t clientId;
+	uint8_t queued;
+	uint8_t inFlight;
+	uint32_t sent;
+	uint32_t dropped;
+};
+
+namespace BroadcastDetail {
+// Keeps the shared buffer alive until AsyncWebSocketMultiMessage's destructor has unlocked it:
+// base classes are destroyed in reverse order, so this one outlives the message.
+struct BufferHolder {
+	SharedBuffer buffer;
+	std::shared_ptr<BroadcastClient> client;
+	BufferHolder(SharedBuffer buffer, std::shared_ptr<BroadcastClient> client)
+	: buffer(std::move(buffer)), client(std::move(client)) {
+	}
+};
+struct TrackedMessage : private BufferHolder, public AsyncWebSocketMultiMessage {
+	TrackedMessage(SharedBuffer buffer, std::shared_ptr<BroadcastClient> client)
+	: BufferHolder(std::move(buffer), std::move(client)),
+	  AsyncWebSocketMultiMessage(BufferHolder::buffer.get(), WS_BINARY) {
+		Heap::charge(HeapTag::WebSocket, sizeof(TrackedMessage));
+	}
+	virtual ~TrackedMessage() {
+		BufferHolder::client->inFlight--;
+		Heap::release(HeapTag::WebSocket, sizeof(TrackedMessage));
+	}
+};
+// The buffer and its len + 1 bytes of content are charged to HeapTag::WebSocket until the last
+// reference goes away.
+template <typename... Args> SharedBuffer makeBuffer(size_t len, Args &&... args) {
+	auto size = sizeof(AsyncWebSocketMessageBuffer) + len + 1;
+	Heap::charge(HeapTag::WebSocket, size);
+	return SharedBuffer(new AsyncWebSocketMessageBuffer(std::forward<Args>(args)...),
+	                    [size](AsyncWebSocketMessageBuffer *buffer) {
+		                    Heap::release(HeapTag::WebSocket, size);
+		                    delete buffer;
+	                    });
+}
+} // namespace BroadcastDetail
+
+class Broadcaster {
+	AsyncWebSocket &ws;
+	std::mutex lock;
+	SharedBuffer latest[(uint8_t)BroadcastChannel::Count];
+	std::map<uint32_t, std::shared_ptr<BroadcastClient>> clients;
+
+	void publish(BroadcastChannel channel, SharedBuffer buffer) {
+		std::lock_guard<std::mutex> guard(lock);
+		latest[(uint8_t)channel] = buffer;
+		for(auto &client : clients) {
+			auto &slot = client.second->pending[(uint8_t)channel];
+			if(slot) {
+				client.second->dropped++;
+				Metrics::increment(Metrics::Metric::MessagesDropped);
+			}
+			slot = buffer;
+		}
+	}
+
+public:
+	Broadcaster(AsyncWebSocket &ws) : ws(ws) {
+	}
+	// Serializes the document once; every client shares the resulting buffer.
+	bool publish(BroadcastChannel channel, const JsonDocument &doc) {
+		size_t len = measureMsgPack(doc);
+		auto buffer = BroadcastDetail::makeBuffer(len, len);
+		if(!buffer->get()) return false;
+		serializeMsgPack(doc, (char *)buffer->get(), len + 1);
+		publish(channel, std::move(buffer));
+		return true;
+	}
+	bool publish(BroadcastChannel channel, const uint8_t *data, size_t len) {
+		auto buffer = BroadcastDetail::makeBuffer(len, (uint8_t *)data, len);
+		if(!buffer->get()) return false;
+		publish(channel, std::move(buffer));
+		return true;
+	}
+	// A new client starts out with the latest snapshot of every channel queued.
+	void addClient(uint32_t id) {
+		std::shared_ptr<BroadcastClient> client(new BroadcastClient(id));
+		std::lock_guard<std::mutex> guard(lock);
+		for(auto i = 0; i < (uint8_t)BroadcastChannel::Count; i++) {
+			client->pending[i] = latest[i];
+		}
+		clients[id] = std::move(client);
+	}
+	void removeClient(uint32_t id) {
+		std::lock_guard<std::mutex> guard(lock);
+		clients.erase(id);
+	}
+	// Hands pending messages to the clients that have room for them; called from loop().
+	void pump() {
+		std::lock_guard<std::mutex> guard(lock);
+		for(auto &entry : clients) {
+			auto &client = entry.second;
+			AsyncWebSocketClient *socket = ws.client(client->id);
+			if(!socket || socket->status() != WS_CONNECTED) continue;
+			for(auto &slot : client->pending) {
+				if(!slot) continue;
+				if(client->inFlight >= BROADCAST_MAX_IN_FLIGHT || socket->queueIsFull()) break;
+				client->inFlight++;
+				client->sent++;
+				Metrics::increment(Metrics::Metric::MessagesOut);
+				socket->message(new BroadcastDetail::TrackedMessage(std::move(slot), client));
+				slot.reset();
+			}
+		}
+	}
+	template <typename F> void forEachClient(F callback) {
+		std::lock_guard<std::mutex> guard(lock);
+		for(auto &entry : clients) {
+			auto &client = *entry.second;
+			callback(BroadcastStats{ client.id, client.queued(), client.inFlight, client.sent, client.dropped });
+		}
+	}
+};
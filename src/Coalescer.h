@@ -0,0 +1,41 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+// Runs a consumer at most once per interval while its input keeps changing. The last change is
+// always picked up: a change that lands inside the interval is handled when it ends. touch() may
+// be called from any task, due() only from the one that runs the consumer.
+struct Throttle {
+	uint32_t interval;
+	std::atomic<bool> dirty;
+	uint32_t last = 0;
+	Throttle(uint32_t interval) : interval(interval), dirty(false) {
+	}
+	void touch() {
+		dirty = true;
+	}
+	bool due(uint32_t now) {
+		if(now - last < interval || !dirty.exchange(false)) return false;
+		last = now;
+		return true;
+	}
+};
+
+// Runs a consumer once its input has stopped changing for quietPeriod. Like Throttle, touch() may
+// be called from any task.
+struct Debounce {
+	uint32_t quietPeriod;
+	std::atomic<bool> dirty;
+	std::atomic<uint32_t> changed;
+	Debounce(uint32_t quietPeriod) : quietPeriod(quietPeriod), dirty(false), changed(0) {
+	}
+	void touch(uint32_t now) {
+		changed = now;
+		dirty = true;
+	}
+	bool due(uint32_t now) {
+		// Signed, since another task's touch() can be stamped later than now.
+		if(!dirty || (int32_t)(now - changed) < (int32_t)quietPeriod) return false;
+		return dirty.exchange(false);
+	}
+};
@@ -0,0 +1,208 @@
+#pragma once
+#include "Configuration.h"
+#include "Effect.h"
+#include "Persistence.h"
+#include <string.h>
+#include <vector>
+
+// Binary effect config, keyed by strip, effect and field index. It is laid out to be read where
+// it sits (a memory-mapped partition or a file buffer) without building a document:
+//
+//   ConfigHeader
+//   for each record:  RecordHeader, then fieldCount times FieldHeader + value padded to 4 bytes
+//
+// Values are stored by the field's schema type: String and Json as length-prefixed text, Number
+// as a double, Color as packed 0xRRGGBB, Select as the option index and Boolean as one byte.
+// All integers are little-endian, like the ESP32 itself.
+namespace ConfigFormat {
+constexpr uint32_t magic = 0x4746434C; // "LCFG"
+constexpr uint16_t version = 1;
+
+struct ConfigHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recordCount;
+	uint32_t sequence; // increases with every write; picks the newest copy when there are several
+	uint32_t payloadSize;
+	uint32_t checksum; // FNV-1a over the payload
+};
+struct RecordHeader {
+	uint8_t strip;
+	uint8_t effect;
+	uint8_t fieldCount;
+	uint8_t reserved;
+};
+struct FieldHeader {
+	uint8_t field;
+	uint8_t type;
+	uint16_t length;
+};
+
+inline uint32_t checksum(const uint8_t *data, size_t len) {
+	return PersistenceService::hash(data, len);
+}
+inline size_t padded(size_t len) {
+	return (len + 3) & ~(size_t)3;
+}
+// Whether a stored value is one the field takes. Effects divide by some numbers and index the
+// options by selects, so values saved under an older schema mustn't reach them out of range.
+inline bool inRange(const EffectConfig::Configuration &field, const EffectConfigValue &value) {
+	using EffectConfig::DataType;
+	using namespace strict_variant;
+	if(field.type == DataType::Number) {
+		auto num = get<double>(&value);
+		return num && *num >= field.specs.num.min && *num <= field.specs.num.max;
+	} else if(field.type == DataType::Select) {
+		auto index = get<uintptr_t>(&value);
+		return index && *index < field.specs.sel.optionCount;
+	}
+	return true;
+}
+
+class Writer {
+	std::vector<uint8_t> &out;
+	uint16_t recordCount = 0;
+
+	void append(const void *data, size_t len) {
+		auto bytes = (const uint8_t *)data;
+		out.insert(out.end(), bytes, bytes + len);
+		out.resize(padded(out.size()));
+	}
+	void appendField(uint8_t field, EffectConfig::DataType type, const void *data, size_t len) {
+		FieldHeader header{ field, (uint8_t)type, (uint16_t)len };
+		out.insert(out.end(), (const uint8_t *)&header, (const uint8_t *)(&header + 1));
+		append(data, len);
+	}
+
+public:
+	Writer(std::vector<uint8_t> &out) : out(out) {
+		out.assign(sizeof(ConfigHeader), 0);
+	}
+	void addRecord(uintptr_t stripIndex, uintptr_t effectIndex, const EffectConfigData &config) {
+		using EffectConfig::DataType;
+		using namespace strict_variant;
+		auto &effect = Configuration::effects[effectIndex];
+		RecordHeader record{ (uint8_t)stripIndex, (uint8_t)effectIndex, (uint8_t)config.size(), 0 };
+		out.insert(out.end(), (const uint8_t *)&record, (const uint8_t *)(&record + 1));
+		for(auto &entry : config) {
+			auto *value = &entry.second;
+			auto type = effect.config[entry.first].type;
+			if(type == DataType::String || type == DataType::Json) {
+				auto str = get<std::string>(value);
+				appendField(entry.first, type, str->c_str(), str->size());
+			} else if(type == DataType::Number) {
+				appendField(entry.first, type, get<double>(value), sizeof(double));
+			} else if(type == DataType::Color) {
+				appendField(entry.first, type, get<uint32_t>(value), sizeof(uint32_t));
+			} else if(type == DataType::Select) {
+				uint32_t index = *get<uintptr_t>(value);
+				appendField(entry.first, type, &index, sizeof(index));
+			} else if(type == DataType::Boolean) {
+				uint8_t flag = *get<bool>(value);
+				appendField(entry.first, type, &flag, sizeof(flag));
+			}
+		}
+		recordCount++;
+	}
+	// Fills in the header; out is complete afterwards.
+	void finish(uint32_t sequence = 0) {
+		ConfigHeader header{ magic,
+			                 version,
+			                 recordCount,
+			                 sequence,
+			                 (uint32_t)(out.size() - sizeof(ConfigHeader)),
+			                 checksum(out.data() + sizeof(ConfigHeader), out.size() - sizeof(ConfigHeader)) };
+		memcpy(out.data(), &header, sizeof(header));
+	}
+};
+
+class Reader {
+	const uint8_t *data;
+	size_t size;
+	ConfigHeader header;
+
+	// Decodes one record and advances pos past it. Returns false if the data is truncated; matches
+	// is cleared if the record doesn't fit the current schema, values out of range included.
+	bool readRecord(const uint8_t *&pos,
+	                const uint8_t *end,
+	                RecordHeader &record,
+	                EffectConfigData &config,
+	                bool &matches) const {
+		using EffectConfig::DataType;
+		if(end - pos < (ptrdiff_t)sizeof(RecordHeader)) return false;
+		memcpy(&record, pos, sizeof(record));
+		pos += sizeof(record);
+		matches =
+		record.strip < Configuration::strips.size() && record.effect < Configuration::effectCount;
+		for(auto i = 0; i < record.fieldCount; i++) {
+			FieldHeader field;
+			if(end - pos < (ptrdiff_t)sizeof(FieldHeader)) return false;
+			memcpy(&field, pos, sizeof(field));
+			pos += sizeof(field);
+			if(end - pos < (ptrdiff_t)padded(field.length)) return false;
+			auto value = pos;
+			pos += padded(field.length);
+			if(!matches) continue;
+			auto &effect = Configuration::effects[record.effect];
+			if(field.field >= effect.configLength || (uint8_t)effect.config[field.field].type != field.type) {
+				matches = false;
+				continue;
+			}
+			auto type = (DataType)field.type;
+			if(type == DataType::String || type == DataType::Json) {
+				config[field.field] = std::string((const char *)value, field.length);
+			} else if(type == DataType::Number && field.length == sizeof(double)) {
+				double num;
+				memcpy(&num, value, sizeof(num));
+				config[field.field] = num;
+			} else if(type == DataType::Color && field.length == sizeof(uint32_t)) {
+				uint32_t color;
+				memcpy(&color, value, sizeof(color));
+				config[field.field] = color;
+			} else if(type == DataType::Select && field.length == sizeof(uint32_t)) {
+				uint32_t index;
+				memcpy(&index, value, sizeof(index));
+				config[field.field] = (uintptr_t)index;
+			} else if(type == DataType::Boolean && field.length == 1) {
+				config[field.field] = (bool)*value;
+			} else {
+				matches = false;
+				continue;
+			}
+			if(!inRange(effect.config[field.field], config[field.field])) matches = false;
+		}
+		return true;
+	}
+
+public:
+	Reader(const uint8_t *data, size_t size) : data(data), size(size) {
+		memset(&header, 0, sizeof(header));
+		if(data && size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+	}
+	bool valid() const {
+		return header.magic == magic && header.version == version &&
+		       header.payloadSize <= size - sizeof(header) &&
+		       checksum(data + sizeof(header), header.payloadSize) == header.checksum;
+	}
+	uint32_t sequence() const {
+		return header.sequence;
+	}
+	// Size of the whole config, header included.
+	size_t length() const {
+		return sizeof(header) + header.payloadSize;
+	}
+	// Calls callback(stripIndex, effectIndex, config) for every record that matches the schema.
+	template <typename F> void forEach(F callback) const {
+		if(!valid()) return;
+		auto pos = data + sizeof(header);
+		auto end = pos + header.payloadSize;
+		for(auto i = 0; i < header.recordCount; i++) {
+			RecordHeader record;
+			EffectConfigData config;
+			bool matches;
+			if(!readRecord(pos, end, record, config, matches)) break;
+			if(matches) callback(record.strip, record.effect, config);
+		}
+	}
+};
+} // namespace ConfigFormat
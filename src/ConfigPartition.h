@@ -0,0 +1,71 @@
+#pragma once
+#include "ConfigFormat.h"
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+
+// Data partition from partitions.csv that holds the binary effect config. It is memory-mapped,
+// so the config is read straight from flash. The partition is split into two slots and a write
+// goes to the one not holding the newest copy, with the header written last: until then the
+// slot fails validation and the previous copy is still used.
+#define CONFIG_PARTITION_LABEL "config"
+
+class ConfigPartition {
+	const esp_partition_t *partition = nullptr;
+	const uint8_t *mapped = nullptr;
+	spi_flash_mmap_handle_t handle;
+	size_t slotSize = 0;
+	int current = -1;
+	uint32_t sequence = 0;
+
+public:
+	// Returns false if the partition table has no config partition, e.g. on a unit that was only
+	// ever updated over the air.
+	bool begin() {
+		partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+		                                     CONFIG_PARTITION_LABEL);
+		if(!partition) return false;
+		const void *ptr;
+		if(esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &ptr, &handle) != ESP_OK) {
+			partition = nullptr;
+			return false;
+		}
+		mapped = (const uint8_t *)ptr;
+		slotSize = partition->size / 2 / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+		for(int slot = 0; slot < 2; slot++) {
+			ConfigFormat::Reader reader(mapped + slot * slotSize, slotSize);
+			if(reader.valid() && (current < 0 || reader.sequence() > sequence)) {
+				current = slot;
+				sequence = reader.sequence();
+			}
+		}
+		return true;
+	}
+	bool available() const {
+		return partition;
+	}
+	// The newest config, in place in flash, or null if none has been written yet.
+	const uint8_t *data(size_t &len) const {
+		if(current < 0) return nullptr;
+		len = slotSize;
+		return mapped + current * slotSize;
+	}
+	bool write(const uint8_t *data, size_t len) {
+		using ConfigFormat::ConfigHeader;
+		if(!partition || len < sizeof(ConfigHeader) || len > slotSize) return false;
+		int slot = current == 0 ? 1 : 0;
+		size_t offset = slot * slotSize;
+		ConfigHeader header;
+		memcpy(&header, data, sizeof(header));
+		header.sequence = sequence + 1;
+		size_t eraseSize = (len + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+		if(esp_partition_erase_range(partition, offset, eraseSize) != ESP_OK ||
+		   esp_partition_write(partition, offset + sizeof(header), data + sizeof(header),
+		                       len - sizeof(header)) != ESP_OK ||
+		   esp_partition_write(partition, offset, &header, sizeof(header)) != ESP_OK) {
+			return false;
+		}
+		current = slot;
+		sequence = header.sequence;
+		return true;
+	}
+};
@@ -1,14 +1,149 @@
 #pragma once
 #include "Effect.h"
 #include "Lighting.h"
+#include "Trace.h"
 #include <FastLED.h>
+#include <vector>
+
+// Length of the strip used when NVS holds no strip settings.
+#define DEFAULT_STRIP_LENGTH 840
+// Every strip's pixels are carved out of one arena, reserved at build time. It's sized for the
+// default strip with HDR on, which takes three pixels per LED (see GenericLightStrip::arenaSize()).
+#define PIXEL_ARENA_SIZE (DEFAULT_STRIP_LENGTH * 3)
+
 namespace Configuration {
-CRGB leds[840];
+// Used when NVS holds no strip settings.
+const StripSettings defaultStrips[] = {
+	{ "default", DEFAULT_STRIP_LENGTH, 12, StripChipset::WS2812B, StripOrder::BGR },
+};
+constexpr size_t defaultStripCount = sizeof(defaultStrips) / sizeof(*defaultStrips);
 
-const GenericLightStrip strips[] = { LightStrip<840>("default", [](CRGB *leds, uintptr_t count) {
-	FastLED.addLeds<WS2812B, 12, BGR>(leds, count);
-}) };
+// Data pins a strip can be attached to. Every pin, chipset and color order combination is compiled
+// in, so keep this to the pins that are wired up.
+template <uint8_t... Pins> struct PinList {};
+using StripPins = PinList<12, 13, 25, 26, 27, 32>;
+
+CRGB pixelArena[PIXEL_ARENA_SIZE];
+// Filled in by beginStrips() and fixed from then on.
+std::vector<GenericLightStrip> strips;
 
 const EffectCreator effects[] = { addEffect<RainbowEffect>(), addEffect<Rainbow2Effect>(),
 	                              addEffect<SolidEffect>(), addEffect<RedGreenEffect>(), addEffect<BounceEffect>() };
-} // namespace Configuration
\ No newline at end of file
+
+constexpr uintptr_t effectCount = sizeof(effects) / sizeof(*effects);
+
+template <template <uint8_t, EOrder> class Chipset, EOrder Order>
+CLEDController *addLeds(uint8_t, CRGB *, uintptr_t, PinList<>) {
+	return nullptr;
+}
+template <template <uint8_t, EOrder> class Chipset, EOrder Order, uint8_t Pin, uint8_t... Rest>
+CLEDController *addLeds(uint8_t pin, CRGB *data, uintptr_t len, PinList<Pin, Rest...>) {
+	if(pin != Pin) return addLeds<Chipset, Order>(pin, data, len, PinList<Rest...>());
+	return &FastLED.addLeds<Chipset, Pin, Order>(data, len);
+}
+template <EOrder Order> CLEDController *addLeds(const StripSettings &settings, CRGB *data) {
+	switch(settings.chipset) {
+	case StripChipset::WS2812B:
+		return addLeds<WS2812B, Order>(settings.pin, data, settings.length, StripPins());
+	case StripChipset::WS2811:
+		return addLeds<WS2811, Order>(settings.pin, data, settings.length, StripPins());
+	case StripChipset::SK6812:
+		return addLeds<SK6812, Order>(settings.pin, data, settings.length, StripPins());
+	default:
+		return nullptr;
+	}
+}
+// Returns null if the pin, chipset or order isn't compiled in.
+inline CLEDController *addLeds(const StripSettings &settings, CRGB *data) {
+	switch(settings.order) {
+	case StripOrder::RGB:
+		return addLeds<RGB>(settings, data);
+	case StripOrder::GRB:
+		return addLeds<GRB>(settings, data);
+	case StripOrder::BGR:
+		return addLeds<BGR>(settings, data);
+	default:
+		return nullptr;
+	}
+}
+template <uint8_t... Pins> bool validPin(uint8_t pin, PinList<Pins...>) {
+	for(uint8_t valid : { Pins... }) {
+		if(pin == valid) return true;
+	}
+	return false;
+}
+
+// Checks a whole set of strips, including that they have pins of their own and fit in the pixel
+// arena together.
+inline bool validStrips(const StripSettings *settings, size_t count) {
+	if(count == 0 || count > STRIP_MAX) return false;
+	size_t pixels = 0;
+	for(size_t i = 0; i < count; i++) {
+		auto &strip = settings[i];
+		auto nameLength = strnlen(strip.name, sizeof(strip.name));
+		if(nameLength == 0 || nameLength == sizeof(strip.name)) return false;
+		if(!strip.length || !validPin(strip.pin, StripPins())) return false;
+		if(strip.chipset >= StripChipset::Count || strip.order >= StripOrder::Count) return false;
+		for(size_t j = 0; j < i; j++) {
+			if(strcmp(settings[j].name, strip.name) == 0 || settings[j].pin == strip.pin) return false;
+		}
+		pixels += GenericLightStrip::arenaSize(strip);
+	}
+	return pixels <= PIXEL_ARENA_SIZE;
+}
+
+// Lays the strips out in the pixel arena and registers them with FastLED. Strips that don't fit
+// or can't be registered are left out; the layout is printed either way.
+inline void beginStrips(const StripSettings *settings, size_t count) {
+	strips.reserve(count);
+	size_t offset = 0;
+	for(size_t i = 0; i < count; i++) {
+		auto &strip = settings[i];
+		auto size = GenericLightStrip::arenaSize(strip);
+		if(offset + size > PIXEL_ARENA_SIZE) {
+			Serial.printf("strip %s: %u pixels don't fit, skipped\n", strip.name, size);
+			continue;
+		}
+		GenericLightStrip lightStrip(strip, pixelArena + offset);
+		if(strip.flags & STRIP_HDR) {
+			lightStrip.output = lightStrip.data + strip.length;
+			lightStrip.residual = (uint8_t *)(lightStrip.output + strip.length);
+			memset(lightStrip.residual, 0, strip.length * sizeof(CRGB));
+		}
+		lightStrip.controller = addLeds(strip, lightStrip.output ? lightStrip.output : lightStrip.data);
+		if(!lightStrip.controller) {
+			Serial.printf("strip %s: pin %u or chipset not supported, skipped\n", strip.name,
+			              strip.pin);
+			continue;
+		}
+		strips.push_back(lightStrip);
+		Serial.printf("strip %s: pixels %u-%u (%u bytes) on pin %u, %s %s%s\n", strip.name, offset,
+		              offset + size - 1, size * sizeof(CRGB), strip.pin,
+		              stripChipsetNames[(uint8_t)strip.chipset],
+		              stripOrderNames[(uint8_t)strip.order], strip.flags & STRIP_HDR ? ", HDR" : "");
+		offset += size;
+	}
+	Serial.printf("pixel arena: %u of %u pixels used (%u bytes free)\n", offset, PIXEL_ARENA_SIZE,
+	              (PIXEL_ARENA_SIZE - offset) * sizeof(CRGB));
+}
+// HDR strips correct and dither in their own pass, so FastLED's are turned off for them.
+inline void setCorrection(const CRGB &correction) {
+	for(auto &strip : strips) {
+		strip.correction = correction;
+		strip.controller->setCorrection(strip.output ? CRGB(UncorrectedColor) : correction);
+		if(strip.output) strip.controller->setDither(DISABLE_DITHER);
+	}
+}
+// Strips sitting this frame out aren't composited, so they're sent again as they last were.
+inline void composite(uint8_t brightness) {
+	for(auto &strip : strips) {
+		if(strip.active) strip.composite(brightness);
+	}
+}
+// Every strip goes out in one FastLED.show(), which the RMT driver sends on all pins at once.
+// Brightness is already in the pixels or the controllers (see GenericLightStrip::composite()).
+inline void show() {
+	TRACE_SCOPE("show");
+	FastLED.show(255);
+}
+} // namespace Configuration
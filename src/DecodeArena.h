@@ -0,0 +1,32 @@
+#pragma once
+#include "Heap.h"
+#include <ArduinoJson.h>
+
+// Capacity of the document that every incoming MsgPack payload is decoded into. Anything that
+// needs more than this is rejected rather than retried with a bigger document.
+#define DECODE_ARENA_SIZE 8192
+
+// One long-lived document, allocated once at boot and cleared between messages. Only one
+// payload is decoded at a time: the WebSocket handler runs on the AsyncTCP task and the config
+// file is read by loop() in BootStage::Config, before the server starts.
+class DecodeArena {
+	TaggedJsonDocument doc;
+
+public:
+	DecodeArena() : doc(DECODE_ARENA_SIZE) {
+	}
+	// Parses in a single pass. Writable char * input is parsed in place, so it has to outlive the
+	// returned object.
+	template <typename... TInput> DeserializationError decode(TInput &&... input) {
+		doc.clear();
+		if(!doc.capacity()) return DeserializationError::NoMemory;
+		return deserializeMsgPack(doc, std::forward<TInput>(input)...);
+	}
+	JsonObjectConst root() const {
+		return doc.as<JsonObjectConst>();
+	}
+	// Bytes the last decoded payload takes up.
+	size_t memoryUsage() const {
+		return doc.memoryUsage();
+	}
+};
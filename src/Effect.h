@@ -2,6 +2,7 @@
 #include <FastLED.h>
 FASTLED_USING_NAMESPACE
 #include "ArduinoJson.h"
+#include "Heap.h"
 #include "Lighting.h"
 #include <ArduinoJson.h>
 #include <FS.h>
@@ -10,10 +11,19 @@ FASTLED_USING_NAMESPACE
 #include <functional>
 #include <initializer_list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <strict_variant/variant.hpp>
+#include <type_traits>
 
+// Effect config and instances are added and removed whenever the UI toggles an effect, so their
+// maps recycle nodes rather than go back to the heap each time.
+template <typename K, typename V>
+using EffectMap =
+std::map<K, V, std::less<K>, Heap::RecyclingAllocator<std::pair<const K, V>, HeapTag::Effects>>;
 using EffectConfigValue = strict_variant::variant<std::string, double, uint32_t, uintptr_t, boolean>;
-using EffectConfigData = std::map<uintptr_t, EffectConfigValue>;
+using EffectConfigData = EffectMap<uintptr_t, EffectConfigValue>;
 namespace EffectConfig {
 enum class DataType { String, Number, Select, Boolean, Json, Color };
 
@@ -138,6 +148,20 @@ struct Configuration {
 	const char *description;
 	DataType type;
 	Specs specs;
+	// Whether validation always produces a value for this field, so effects may rely on it.
+	bool required() const {
+		if(type == String::type)
+			return specs.str.required;
+		else if(type == Number::type)
+			return specs.num.required;
+		else if(type == Color::type)
+			return specs.col.required;
+		else if(type == Select::type)
+			return specs.sel.required;
+		else if(type == Json::type)
+			return specs.json.required;
+		return true;
+	}
 	void toJson(JsonObject &j) const {
 		j["title"] = title;
 		j["description"] = description;
@@ -162,26 +186,83 @@ constexpr Configuration create(const char *title, const char *description, T dat
 } // namespace EffectConfig
 
 struct Effect {
-	CRGB *pixels;
+	PixelSpan pixels;
 	uintptr_t len;
-	EffectConfigData configData;
-	Effect(CRGB *pixels, uintptr_t len, EffectConfigData &configData)
-	: pixels(pixels), len(len), configData(configData) {
+	// Owned by EffectManager, which outlives the effect and changes it in place.
+	EffectConfigData &configData;
+	Effect(const PixelSpan &pixels, EffectConfigData &configData)
+	: pixels(pixels), len(pixels.size()), configData(configData) {
 	}
-	virtual void updateConfig(EffectConfigData &configData) {
-		this->configData = configData;
+	// Called after configData has changed.
+	virtual void updateConfig() {
 	}
 	virtual void display() = 0;
 	virtual ~Effect(){};
 };
 
+// Instances of each effect type kept in static storage. This covers a strip's running effect, a
+// set staged by a scene recall and one the playlist has prepared; any more come from the heap.
+#define EFFECT_POOL_SLOTS 4
+
+struct EffectDeleter {
+	void (*destroy)(Effect *effect);
+	void operator()(Effect *effect) const {
+		destroy(effect);
+	}
+};
+using EffectPtr = std::unique_ptr<Effect, EffectDeleter>;
+
+// Constructs effects in place in static slots, so adding and removing them doesn't fragment the
+// heap. Effects are built both by loop() and by the tasks that prepare scenes, hence the lock.
+template <typename T> class EffectPool {
+	using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+	static Slot slots[EFFECT_POOL_SLOTS];
+	static bool used[EFFECT_POOL_SLOTS];
+	static std::mutex &lock() {
+		static std::mutex lock;
+		return lock;
+	}
+	static void destroy(Effect *effect) {
+		auto object = static_cast<T *>(effect);
+		object->~T();
+		auto slot = (Slot *)object;
+		if(slot >= slots && slot < slots + EFFECT_POOL_SLOTS) {
+			std::lock_guard<std::mutex> guard(lock());
+			used[slot - slots] = false;
+		} else {
+			Heap::deallocate(HeapTag::Effects, object);
+		}
+	}
+
+public:
+	static EffectPtr create(const PixelSpan &pixels, EffectConfigData &config) {
+		void *memory = nullptr;
+		{
+			std::lock_guard<std::mutex> guard(lock());
+			for(auto i = 0; i < EFFECT_POOL_SLOTS; i++) {
+				if(!used[i]) {
+					used[i] = true;
+					memory = &slots[i];
+					break;
+				}
+			}
+		}
+		if(!memory) memory = Heap::allocate(HeapTag::Effects, sizeof(T));
+		if(!memory) abort();
+		return EffectPtr(new(memory) T(pixels, config), EffectDeleter{ destroy });
+	}
+};
+template <typename T> typename EffectPool<T>::Slot EffectPool<T>::slots[EFFECT_POOL_SLOTS];
+template <typename T> bool EffectPool<T>::used[EFFECT_POOL_SLOTS];
+
 struct EffectCreator {
-	std::function<Effect *(CRGB *pixels, uintptr_t len, EffectConfigData &config)> createFunction;
-	Effect *create(CRGB *pixels, uintptr_t len, EffectConfigData &config) const {
-		return createFunction(pixels, len, config);
+	EffectPtr (*createFunction)(const PixelSpan &pixels, EffectConfigData &config);
+	// config has to outlive the effect.
+	EffectPtr create(const PixelSpan &pixels, EffectConfigData &config) const {
+		return createFunction(pixels, config);
 	}
-	Effect *create(const GenericLightStrip *strip, EffectConfigData &config) const {
-		return create(strip->data, strip->len, config);
+	EffectPtr create(GenericLightStrip *strip, EffectConfigData &config) const {
+		return create(strip->pixels(), config);
 	}
 	const char *name;
 	const EffectConfig::Configuration *config;
@@ -190,9 +271,7 @@ struct EffectCreator {
 
 template <typename T> EffectCreator addEffect() {
 	EffectCreator e;
-	e.createFunction = [](CRGB *pixels, uintptr_t len, EffectConfigData &config) {
-		return new T(pixels, len, config);
-	};
+	e.createFunction = EffectPool<T>::create;
 	e.name = T::name;
 	e.config = T::config;
 
@@ -206,8 +285,8 @@ struct RainbowEffect : Effect {
 	static constexpr const EffectConfig::Configuration config[] = {
 		EffectConfig::create("Speed", "Animation Speed", EffectConfig::Number(1, 50, 1, 1, true)),
 	};
-	RainbowEffect(CRGB *pixels, uintptr_t len, EffectConfigData &configData)
-	: Effect(pixels, len, configData) {
+	RainbowEffect(const PixelSpan &pixels, EffectConfigData &configData)
+	: Effect(pixels, configData) {
 	}
 	void display() {
 		for(auto i = 0; i < len; i++) {
@@ -225,8 +304,8 @@ struct Rainbow2Effect : Effect {
 	static constexpr const EffectConfig::Configuration config[] = {
 		EffectConfig::create("Speed", "Animation Speed", EffectConfig::Number(1, 50, 1, 1, true)),
 	};
-	Rainbow2Effect(CRGB *pixels, uintptr_t len, EffectConfigData &configData)
-	: Effect(pixels, len, configData) {
+	Rainbow2Effect(const PixelSpan &pixels, EffectConfigData &configData)
+	: Effect(pixels, configData) {
 	}
 	void display() {
 		uint8_t hue = millis() / (unsigned long)(*strict_variant::get<double>(&configData[0])) % 256;
@@ -245,11 +324,11 @@ struct SolidEffect : Effect {
 	static constexpr const EffectConfig::Configuration config[] = {
 		EffectConfig::create("Color", "Animation Speed", EffectConfig::Color(0xFF0000, true)),
 	};
-	SolidEffect(CRGB *pixels, uintptr_t len, EffectConfigData &configData)
-	: Effect(pixels, len, configData) {
+	SolidEffect(const PixelSpan &pixels, EffectConfigData &configData)
+	: Effect(pixels, configData) {
 	}
 	void display() {
-		fill_solid(pixels, len, CRGB(*strict_variant::get<uint32_t>(&configData[0])));
+		pixels.fill(CRGB(*strict_variant::get<uint32_t>(&configData[0])));
 	}
 };
 // https://stackoverflow.com/a/8016853/4471524
@@ -261,8 +340,8 @@ struct RedGreenEffect : Effect {
 	static constexpr const EffectConfig::Configuration config[] = {
 		EffectConfig::create("Speed", "Animation Speed", EffectConfig::Number(1, 50, 1, 1, true)),
 	};
-	RedGreenEffect(CRGB *pixels, uintptr_t len, EffectConfigData &configData)
-	: Effect(pixels, len, configData) {
+	RedGreenEffect(const PixelSpan &pixels, EffectConfigData &configData)
+	: Effect(pixels, configData) {
 	}
 	void display() {
 		uintptr_t offset =
@@ -289,11 +368,11 @@ struct BounceEffect : Effect {
 		EffectConfig::create("Speed", "Animation Speed", EffectConfig::Number(1, 50, 1, 1, true)),
 	};
 	uintptr_t loc = 0;
-	BounceEffect(CRGB *pixels, uintptr_t len, EffectConfigData &configData)
-	: Effect(pixels, len, configData) {
+	BounceEffect(const PixelSpan &pixels, EffectConfigData &configData)
+	: Effect(pixels, configData) {
 	}
 	void display() {
-		fill_solid(pixels, len, CRGB::Black);
+		pixels.fill(CRGB::Black);
 		pixels[loc] = CRGB::White;
 		loc++;
 		if(loc >= len) loc = 0;
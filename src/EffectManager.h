@@ -1,11 +1,20 @@
 #pragma once
+#include "ConfigFormat.h"
+#include "ConfigPartition.h"
 #include "Configuration.h"
+#include "DecodeArena.h"
 #include "Effect.h"
+#include "Heap.h"
+#include "Metrics.h"
+#include "Perf.h"
+#include "Persistence.h"
+#include "Trace.h"
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <cmath>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <strict_variant/variant.hpp>
 #include <string>
 #include <vector>
@@ -17,59 +26,175 @@ boolean verifyNumber(double num, EffectConfig::Number &numberConfig) {
 uint32_t packColor(uint8_t r, uint8_t g, uint8_t b) {
 	return (r << 16) | (g << 8) | b;
 }
+// Upper bound for the per-strip active effects kept in NVS for a fast boot.
+#define BOOT_RECORD_SIZE 512
+
 class EffectManager {
 	FS &fs;
+	DecodeArena &arena;
+	// The config lives in the config partition; units whose partition table predates it keep it
+	// in configFile instead. legacyFile is only read to migrate the old MsgPack config.
+	ConfigPartition partition;
+	AtomicFile configFile;
+	AtomicFile legacyFile;
+	PersistenceService store;
 	//      Strip index        Effect Index   Effect Data
-	std::map<uintptr_t, std::map<uintptr_t, EffectConfigData>> stripEffectConfig;
-	std::map<uintptr_t, std::map<uintptr_t, std::unique_ptr<Effect>>> effects;
+	EffectMap<uintptr_t, EffectMap<uintptr_t, EffectConfigData>> stripEffectConfig;
+	EffectMap<uintptr_t, EffectMap<uintptr_t, EffectPtr>> effects;
 	AsyncWebSocketMessageBuffer serializedConfig;
+	std::vector<uint8_t> binaryConfig;
+	std::vector<uint8_t> bootRecord;
+	struct PendingUpdate {
+		bool remove;
+		EffectConfigData config;
+	};
 
 public:
-	EffectManager() : fs(SPIFFS) {
+	// A complete set of effects, built ahead of time so it can replace the running one at once.
+	// Swapping maps keeps their nodes in place, so the effects' references to config stay valid.
+	struct EffectSet {
+		EffectMap<uintptr_t, EffectMap<uintptr_t, EffectConfigData>> config;
+		EffectMap<uintptr_t, EffectMap<uintptr_t, EffectPtr>> effects;
+	};
+
+private:
+	std::mutex pendingLock;
+	EffectMap<std::pair<uintptr_t, uintptr_t>, PendingUpdate> pendingUpdates;
+	std::unique_ptr<EffectSet> stagedSet;
+
+	// A saved config can predate a firmware update that made a field required.
+	static bool hasRequiredFields(uintptr_t effectIndex, const EffectConfigData &config) {
+		auto &effect = Configuration::effects[effectIndex];
+		for(auto i = 0; i < effect.configLength; i++) {
+			if(effect.config[i].required() && !config.count(i)) return false;
+		}
+		return true;
+	}
+
+public:
+	EffectManager(DecodeArena &arena)
+	: fs(SPIFFS), arena(arena), configFile(fs, "/effects.bin", "/effects.bin.tmp"),
+	  legacyFile(fs, "/effects.msgpack", "/effects.msgpack.tmp"),
+	  store([this](const uint8_t *data, size_t len) {
+		  bool ok = partition.available() ? partition.write(data, len) : configFile.write(data, len);
+		  if(ok) Metrics::increment(Metrics::Metric::ConfigSaves);
+		  return ok;
+	  }) {
 	}
 	AsyncWebSocketMessageBuffer *getSerializedConfig() {
 		return &serializedConfig;
 	};
+	// Applies a config document keyed by strip name, effect name and field title.
+	void loadConfig(JsonObjectConst doc) {
+		for(auto &strip : Configuration::strips) {
+			auto stripConfig = doc[strip.name];
+			if(!stripConfig.is<JsonObject>()) continue;
+			for(auto &effect : Configuration::effects) {
+				auto i = &effect - &Configuration::effects[0];
+				auto effectConfig = stripConfig[effect.name];
+				if(!effectConfig.is<JsonObject>()) continue;
+				updateEffectConfig(&strip - &Configuration::strips[0], i, effectConfig);
+			}
+		}
+	}
+	// Applies a binary config. Its values were validated before they were saved, so they are used
+	// as they are; only records that are missing a required field are skipped.
+	bool loadBinaryConfig(const uint8_t *data, size_t len) {
+		ConfigFormat::Reader reader(data, len);
+		if(!reader.valid()) return false;
+		reader.forEach([this](uintptr_t stripIndex, uintptr_t effectIndex, EffectConfigData &config) {
+			if(hasRequiredFields(effectIndex, config)) {
+				applyEffectConfig(stripIndex, effectIndex, config);
+			}
+		});
+		return true;
+	}
+	// Builds every effect in a binary config on the calling task. Returns null if the config is
+	// invalid.
+	static std::unique_ptr<EffectSet> buildEffectSet(const uint8_t *data, size_t len) {
+		ConfigFormat::Reader reader(data, len);
+		if(!reader.valid()) return nullptr;
+		std::unique_ptr<EffectSet> set(new EffectSet);
+		for(auto &strip : Configuration::strips) {
+			set->config[&strip - &Configuration::strips[0]];
+			set->effects[&strip - &Configuration::strips[0]];
+		}
+		reader.forEach([&set](uintptr_t stripIndex, uintptr_t effectIndex, EffectConfigData &config) {
+			if(!hasRequiredFields(effectIndex, config)) return;
+			auto &stored = set->config[stripIndex][effectIndex] = std::move(config);
+			set->effects[stripIndex][effectIndex] =
+			Configuration::effects[effectIndex].create(&Configuration::strips[stripIndex], stored);
+		});
+		return set;
+	}
+	// Leaves a built set for loop() to swap in as a whole, replacing all running effects and any
+	// updates queued before it.
+	void stageEffectSet(std::unique_ptr<EffectSet> set) {
+		std::lock_guard<std::mutex> guard(pendingLock);
+		stagedSet = std::move(set);
+		pendingUpdates.clear();
+	}
+	bool queueEffectSet(const uint8_t *data, size_t len) {
+		auto set = buildEffectSet(data, len);
+		if(!set) return false;
+		stageEffectSet(std::move(set));
+		return true;
+	}
+	// Loads just the active effects from the boot record, without touching SPIFFS, so the first
+	// frame can be rendered before the full config is read by begin().
+	void beginFast(const uint8_t *bootRecord, size_t len) {
+		for(auto &strip : Configuration::strips) {
+			stripEffectConfig[&strip - &Configuration::strips[0]];
+			effects[&strip - &Configuration::strips[0]];
+		}
+		loadBinaryConfig(bootRecord, len);
+	}
 	void begin() {
 		SPIFFS.begin();
-		auto storageSize = 2048;
-		DynamicJsonDocument doc(storageSize);
-		DeserializationError err = DeserializationError::InvalidInput;
 		for(auto &strip : Configuration::strips) {
 			stripEffectConfig[&strip - &Configuration::strips[0]];
 			effects[&strip - &Configuration::strips[0]];
 		}
-		do {
-			File file = fs.open("/effects.msgpack");
-			if(!file || file.isDirectory()) {
-				break;
-			}
-			ReadBufferingStream bufferingStream(file, 64);
-			err = deserializeMsgPack(doc, bufferingStream);
-			if(err == DeserializationError::NoMemory) {
-				storageSize *= 2;
-				if(storageSize > 1048576) {
-					break;
-				}
-				doc = DynamicJsonDocument(storageSize);
-				if(!doc.size()) {
-					break;
-				}
+		// Read from wherever the newest config is: the partition, /effects.bin as saved before the
+		// partition table had one, or the MsgPack file before that. A config found anywhere but
+		// where it's saved now is saved there below.
+		bool loaded = false;
+		bool inPlace = false;
+		if(partition.begin()) {
+			size_t len;
+			auto data = partition.data(len);
+			loaded = inPlace = data && loadBinaryConfig(data, len);
+		}
+		if(!loaded) {
+			File file = configFile.open();
+			if(file) {
+				std::vector<uint8_t> data(file.size());
+				loaded = file.read(data.data(), data.size()) == data.size() &&
+				         loadBinaryConfig(data.data(), data.size());
+				inPlace = loaded && !partition.available();
 			}
-		} while(err == DeserializationError::NoMemory);
-		if(err == DeserializationError::Ok) {
-			for(auto &strip : Configuration::strips) {
-				auto stripConfig = doc[strip.name];
-				if(!stripConfig.is<JsonObject>()) continue;
-				for(auto &effect : Configuration::effects) {
-					auto i = &effect - &Configuration::effects[0];
-					auto effectConfig = stripConfig[effect.name];
-					if(!effectConfig.is<JsonObject>()) continue;
-					updateEffectConfig(&strip - &Configuration::strips[0], i, effectConfig.as<JsonObject>());
+		}
+		if(!loaded) {
+			File file = legacyFile.open();
+			if(file) {
+				ReadBufferingStream bufferingStream(file, 64);
+				auto err = arena.decode(bufferingStream);
+				if(err == DeserializationError::Ok) {
+					loadConfig(arena.root());
+					Serial.println("Migrating /effects.msgpack");
+				} else {
+					Serial.print("Couldn't load /effects.msgpack: ");
+					Serial.println(err.c_str());
 				}
 			}
 		}
 		serializeConfig();
+		if(inPlace) {
+			store.begin(binaryConfig.data(), binaryConfig.size());
+		} else {
+			store.begin(nullptr, 0);
+			saveConfig();
+		}
 	}
 	void removeEffectConfig(uintptr_t stripIndex, uintptr_t effectIndex) {
 		auto strip = stripEffectConfig.find(stripIndex);
@@ -77,14 +202,16 @@ public:
 		effects[stripIndex].erase(effectIndex);
 		strip->second.erase(effectIndex);
 	}
-	bool updateEffectConfig(uintptr_t stripIndex, uintptr_t effectIndex, JsonObjectConst effectConfig) {
+	// Validates effectConfig against the effect's schema, filling in defaults. effectConfig is
+	// either an object keyed by field title or an array indexed by field ID.
+	bool parseEffectConfig(uintptr_t effectIndex, JsonVariantConst effectConfig, EffectConfigData &config) {
 		auto effect = Configuration::effects[effectIndex];
-		EffectConfigData config;
 		bool ok = true;
+		bool byId = effectConfig.is<JsonArray>();
 		for(auto iConfig = 0; iConfig < effect.configLength; iConfig++) {
 			using EffectConfig::DataType;
 			auto &effectConfiguration = effect.config[iConfig];
-			auto incomingValue = effectConfig[effectConfiguration.title];
+			auto incomingValue = byId ? effectConfig[iConfig] : effectConfig[effectConfiguration.title];
 			auto type = effectConfiguration.type;
 			if(type == DataType::String) {
 				auto stringConfig = effectConfiguration.specs.str;
@@ -190,31 +317,100 @@ public:
 			ok = false;
 			break;
 		}
+		return ok;
+	}
+	// Takes over config's contents; the stored config is updated in place, so a running effect
+	// keeps its reference to it.
+	void applyEffectConfig(uintptr_t stripIndex, uintptr_t effectIndex, EffectConfigData &config) {
+		auto &stored = stripEffectConfig[stripIndex][effectIndex];
+		stored.swap(config);
+		auto effect = effects[stripIndex].find(effectIndex);
+		if(effect == effects[stripIndex].end()) {
+			effects[stripIndex][effectIndex] =
+			Configuration::effects[effectIndex].create(&Configuration::strips[stripIndex], stored);
+		} else {
+			effect->second->updateConfig();
+		}
+	}
+	bool updateEffectConfig(uintptr_t stripIndex, uintptr_t effectIndex, JsonVariantConst effectConfig) {
+		EffectConfigData config;
+		bool ok = parseEffectConfig(effectIndex, effectConfig, config);
 		if(ok) {
-			stripEffectConfig[stripIndex][effectIndex] = config;
-			auto effect = effects[stripIndex].find(effectIndex);
-			Serial.println(__LINE__);
-			if(effect == effects[stripIndex].end()) {
-				Serial.println("create new");
-				effects[stripIndex][effectIndex] = std::move(std::unique_ptr<Effect>(
-				Configuration::effects[effectIndex].create(&Configuration::strips[stripIndex], config)));
-			} else {
-				effect->second->updateConfig(config);
-			}
+			applyEffectConfig(stripIndex, effectIndex, config);
 		} else {
 			removeEffectConfig(stripIndex, effectIndex);
 		}
 		return ok;
 	}
+	// The WebSocket handler runs on the AsyncTCP task, so it only validates an update and leaves
+	// it here for loop() to apply between frames. A newer update for the same strip and effect
+	// replaces one that hasn't been applied yet.
+	void queueEffectConfig(uintptr_t stripIndex, uintptr_t effectIndex, JsonVariantConst effectConfig) {
+		PendingUpdate update;
+		update.remove = !parseEffectConfig(effectIndex, effectConfig, update.config);
+		std::lock_guard<std::mutex> guard(pendingLock);
+		pendingUpdates[std::make_pair(stripIndex, effectIndex)] = std::move(update);
+	}
+	void queueRemoveEffect(uintptr_t stripIndex, uintptr_t effectIndex) {
+		PendingUpdate update;
+		update.remove = true;
+		std::lock_guard<std::mutex> guard(pendingLock);
+		pendingUpdates[std::make_pair(stripIndex, effectIndex)] = std::move(update);
+	}
+	// Returns whether anything changed.
+	bool applyPendingUpdates() {
+		EffectMap<std::pair<uintptr_t, uintptr_t>, PendingUpdate> updates;
+		std::unique_ptr<EffectSet> set;
+		{
+			std::lock_guard<std::mutex> guard(pendingLock);
+			if(pendingUpdates.empty() && !stagedSet) return false;
+			updates.swap(pendingUpdates);
+			set.swap(stagedSet);
+		}
+		if(set) {
+			stripEffectConfig.swap(set->config);
+			effects.swap(set->effects);
+		}
+		for(auto &update : updates) {
+			if(update.second.remove) {
+				removeEffectConfig(update.first.first, update.first.second);
+			} else {
+				applyEffectConfig(update.first.first, update.first.second, update.second.config);
+			}
+		}
+		return true;
+	}
+	// What serializeConfig()'s document needs: names and strings are copied, titles aren't.
+	size_t configJsonSize() {
+		using namespace strict_variant;
+		size_t size = JSON_OBJECT_SIZE(1 + stripEffectConfig.size());
+		for(auto &strip : stripEffectConfig) {
+			size += JSON_OBJECT_SIZE(strip.second.size()) +
+			        JSON_STRING_SIZE(strlen(Configuration::strips[strip.first].name));
+			for(auto &effect : strip.second) {
+				size += JSON_OBJECT_SIZE(effect.second.size());
+				for(auto &config : effect.second) {
+					if(auto str = get<std::string>(&config.second)) {
+						size += JSON_STRING_SIZE(str->length());
+					} else if(Configuration::effects[effect.first].config[config.first].type ==
+					          EffectConfig::DataType::Color) {
+						size += JSON_OBJECT_SIZE(3);
+					}
+				}
+			}
+		}
+		return size;
+	}
 	void serializeConfig() {
+		TRACE_SCOPE("serializeConfig");
 		using namespace strict_variant;
-		DynamicJsonDocument doc(2048);
-		for(std::pair<uintptr_t, std::map<uintptr_t, EffectConfigData>> strip : stripEffectConfig) {
+		TaggedJsonDocument doc(configJsonSize());
+		for(auto &strip : stripEffectConfig) {
 			auto stripConfig = doc.createNestedObject(Configuration::strips[strip.first].name);
-			for(std::pair<uintptr_t, EffectConfigData> effect : strip.second) {
+			for(auto &effect : strip.second) {
 				auto effectConfig =
 				stripConfig.createNestedObject(Configuration::effects[effect.first].name);
-				for(std::pair<uintptr_t, EffectConfigValue> config : effect.second) {
+				for(auto &config : effect.second) {
 					auto *data = &config.second;
 					auto configSettings = Configuration::effects[effect.first].config[config.first];
 					if(configSettings.type == EffectConfig::DataType::String) {
@@ -243,24 +439,53 @@ public:
 		if(serializedConfig.reserve(len)) {
 			serializeMsgPack(doc, (char *)serializedConfig.get(), len + 1);
 		}
+
+		ConfigFormat::Writer writer(binaryConfig);
+		// The boot record only holds the effect each strip is displaying.
+		ConfigFormat::Writer recordWriter(bootRecord);
+		for(auto &strip : stripEffectConfig) {
+			for(auto &effect : strip.second) {
+				writer.addRecord(strip.first, effect.first, effect.second);
+			}
+			if(!strip.second.empty()) {
+				auto &active = *strip.second.begin();
+				recordWriter.addRecord(strip.first, active.first, active.second);
+			}
+		}
+		writer.finish();
+		recordWriter.finish();
+		if(bootRecord.size() > BOOT_RECORD_SIZE) {
+			bootRecord.clear();
+		}
 	}
+	const std::vector<uint8_t> &getBinaryConfig() const {
+		return binaryConfig;
+	}
+	const std::vector<uint8_t> &getBootRecord() const {
+		return bootRecord;
+	}
+	// Queues the binary config to be written in the background.
 	void saveConfig() {
-		File file = fs.open("/effects.msgpack", FILE_WRITE);
-		WriteBufferingStream bufferedFile(file, 64);
-		for(auto i = 0; i < serializedConfig.length(); i++) {
-			bufferedFile.write(serializedConfig.get()[i]);
-		}
-		bufferedFile.flush();
+		TRACE_SCOPE("saveConfig");
+		store.save(binaryConfig.data(), binaryConfig.size());
+	}
+	PersistenceStats getPersistenceStats() const {
+		return store.getStats();
 	}
 	void run() {
+		TRACE_SCOPE("EffectManager::run");
 		for(auto &strip : Configuration::strips) {
+			if(!strip.active) continue;
 			auto stripIndex = &strip - &Configuration::strips[0];
+			PERF_STRIP_SCOPE(stripIndex);
+			auto start = micros();
 			auto firstEffect = effects[stripIndex].begin();
 			if(firstEffect!=effects[stripIndex].end()) {
 				firstEffect->second->display();
 			} else {
-				fill_solid(strip.data, strip.len, CRGB::Black);
+				strip.pixels().fill(CRGB::Black);
 			}
+			strip.renderMicros = micros() - start;
 		}
 	}
 };
\ No newline at end of file
@@ -0,0 +1,166 @@
+#pragma once
+#include "Lighting.h"
+#include "Metrics.h"
+#include <ArduinoJson.h>
+#include <algorithm>
+#include <vector>
+
+// The frame rate loop() is paced to. A frame's deadline is its period, or the time the longest
+// strip takes on the wire if that's longer, since no frame can be shorter than that.
+#define FRAMES_PER_SECOND 240
+#define FRAME_PERIOD_MICROS (1000000 / FRAMES_PER_SECOND)
+// Frames per evaluation window.
+#define FRAME_WINDOW 60
+// Overruns within a window that take a strip's quality down a step.
+#define FRAME_DEGRADE_OVERRUNS 6
+// A window counts as having headroom when no frame took more than this percentage of the
+// deadline; this many such windows in a row bring a strip's quality back up a step.
+#define FRAME_HEADROOM 60
+#define FRAME_RECOVER_WINDOWS 10
+// Overrun buckets: bucket i counts frames late by less than (deadline / 4) << i; the last one
+// everything later.
+#define FRAME_HISTOGRAM_BUCKETS 5
+
+enum class OverrunCause : uint8_t { Render, Show, External, Count };
+constexpr const char *overrunCauseNames[] = { "render", "show", "external" };
+
+// Watches every frame against its deadline. An overrun is blamed on whichever of rendering
+// (including compositing), showing or everything else in loop() took longest; the last covers
+// networking, flash writes and the loop task being held up. When overruns keep happening, the
+// strip costing the most steps down in quality, and steps back up once there is headroom again.
+class FrameWatch {
+	uint32_t deadline = FRAME_PERIOD_MICROS;
+	uint32_t frame = 0;
+	uint32_t overruns[(uint8_t)OverrunCause::Count] = {};
+	uint32_t histogram[FRAME_HISTOGRAM_BUCKETS] = {};
+	uint32_t lastMicros = 0;
+	uint16_t windowFrames = 0;
+	uint16_t windowOverruns = 0;
+	uint32_t windowMax = 0;
+	uint8_t headroomWindows = 0;
+
+	static void report(const GenericLightStrip &strip) {
+		Serial.printf("strip %s: quality %s\n", strip.name,
+		              stripQualityNames[(uint8_t)strip.quality]);
+	}
+	static void updateDegradedMetric(const std::vector<GenericLightStrip> &strips) {
+		uint32_t degraded = 0;
+		for(auto &strip : strips) {
+			if(strip.quality != StripQuality::Full) degraded++;
+		}
+		Metrics::set(Metrics::Metric::DegradedStrips, degraded);
+	}
+	// The strip spending the most time per frame that can still go down. Every strip is sent on
+	// every frame in one batch whatever its quality, so only rendering and quantizing count.
+	static void degrade(std::vector<GenericLightStrip> &strips) {
+		GenericLightStrip *worst = nullptr;
+		uint32_t worstCost = 0;
+		for(auto &strip : strips) {
+			if((uint8_t)strip.quality + 1 >= (uint8_t)StripQuality::Count) continue;
+			auto cost = (strip.renderMicros + strip.hdrStats.lastMicros) / strip.frameDivisor();
+			if(!worst || cost > worstCost) {
+				worst = &strip;
+				worstCost = cost;
+			}
+		}
+		if(!worst) return;
+		worst->setQuality((StripQuality)((uint8_t)worst->quality + 1));
+		report(*worst);
+	}
+	// The most degraded strip.
+	static void recover(std::vector<GenericLightStrip> &strips) {
+		GenericLightStrip *worst = nullptr;
+		for(auto &strip : strips) {
+			if(strip.quality == StripQuality::Full) continue;
+			if(!worst || strip.quality > worst->quality) worst = &strip;
+		}
+		if(!worst) return;
+		worst->setQuality((StripQuality)((uint8_t)worst->quality - 1));
+		report(*worst);
+	}
+
+public:
+	// Call once the strips are set up.
+	void begin(const std::vector<GenericLightStrip> &strips) {
+		uintptr_t longest = 0;
+		for(auto &strip : strips) {
+			longest = std::max(longest, strip.len);
+		}
+		deadline = std::max<uint32_t>(FRAME_PERIOD_MICROS, longest * LED_WIRE_MICROS);
+	}
+	// Picks the strips that render this frame. Strips below full rate take turns, so they don't all
+	// render on the same frame.
+	void beginFrame(std::vector<GenericLightStrip> &strips) {
+		frame++;
+		for(size_t i = 0; i < strips.size(); i++) {
+			strips[i].active = (frame + i) % strips[i].frameDivisor() == 0;
+		}
+	}
+	// frameMicros is the whole frame, apart from the delay that paces it.
+	void endFrame(std::vector<GenericLightStrip> &strips,
+	              uint32_t renderMicros,
+	              uint32_t showMicros,
+	              uint32_t frameMicros) {
+		lastMicros = frameMicros;
+		windowMax = std::max(windowMax, frameMicros);
+		if(frameMicros > deadline) {
+			auto accounted = renderMicros + showMicros;
+			auto external = frameMicros > accounted ? frameMicros - accounted : 0;
+			auto cause = OverrunCause::External;
+			if(renderMicros >= showMicros && renderMicros >= external) {
+				cause = OverrunCause::Render;
+			} else if(showMicros >= external) {
+				cause = OverrunCause::Show;
+			}
+			overruns[(uint8_t)cause]++;
+			Metrics::increment((Metrics::Metric)((uint8_t)Metrics::Metric::FrameOverrunsRender +
+			                                     (uint8_t)cause));
+			auto late = frameMicros - deadline;
+			auto bucket = 0;
+			while(bucket < FRAME_HISTOGRAM_BUCKETS - 1 && late >= (deadline / 4) << bucket) {
+				bucket++;
+			}
+			histogram[bucket]++;
+			// Every strip goes out on every frame whatever its quality, so stepping one down
+			// doesn't help a frame held up by showing.
+			if(cause != OverrunCause::Show) windowOverruns++;
+		}
+		if(++windowFrames < FRAME_WINDOW) return;
+
+		if(windowOverruns >= FRAME_DEGRADE_OVERRUNS) {
+			degrade(strips);
+			headroomWindows = 0;
+		} else if(windowMax <= (uint64_t)deadline * FRAME_HEADROOM / 100) {
+			if(++headroomWindows >= FRAME_RECOVER_WINDOWS) {
+				recover(strips);
+				headroomWindows = 0;
+			}
+		} else {
+			headroomWindows = 0;
+		}
+		updateDegradedMetric(strips);
+		windowFrames = 0;
+		windowOverruns = 0;
+		windowMax = 0;
+	}
+	void toJson(JsonDocument &doc, const std::vector<GenericLightStrip> &strips) const {
+		doc["type"] = "frames";
+		doc["deadline"] = deadline;
+		doc["lastMicros"] = lastMicros;
+		auto causes = doc.createNestedObject("overruns");
+		for(auto i = 0; i < (uint8_t)OverrunCause::Count; i++) {
+			causes[overrunCauseNames[i]] = overruns[i];
+		}
+		doc["histogramBase"] = deadline / 4;
+		auto buckets = doc.createNestedArray("histogram");
+		for(auto count : histogram) {
+			buckets.add(count);
+		}
+		auto list = doc.createNestedArray("strips");
+		for(auto &strip : strips) {
+			auto entry = list.createNestedObject();
+			entry["quality"] = stripQualityNames[(uint8_t)strip.quality];
+			entry["renderMicros"] = strip.renderMicros;
+		}
+	}
+};
@@ -0,0 +1,70 @@
+#include "Heap.h"
+#include <atomic>
+
+namespace Heap {
+namespace {
+struct AtomicTagStats {
+	std::atomic<uint32_t> liveBytes;
+	std::atomic<uint32_t> liveCount;
+	std::atomic<uint32_t> allocations;
+};
+AtomicTagStats tagStats[(uint8_t)HeapTag::Count];
+
+// allocate() puts the size in front of the block, padded to keep malloc's alignment.
+union Header {
+	size_t size;
+	std::max_align_t align;
+};
+} // namespace
+
+__attribute__((weak)) void *backingAllocate(size_t size) {
+	return malloc(size);
+}
+__attribute__((weak)) void *backingReallocate(void *ptr, size_t size) {
+	return realloc(ptr, size);
+}
+__attribute__((weak)) void backingFree(void *ptr) {
+	free(ptr);
+}
+void charge(HeapTag tag, size_t size) {
+	auto &stats = tagStats[(uint8_t)tag];
+	stats.liveBytes.fetch_add(size, std::memory_order_relaxed);
+	stats.liveCount.fetch_add(1, std::memory_order_relaxed);
+	stats.allocations.fetch_add(1, std::memory_order_relaxed);
+}
+void release(HeapTag tag, size_t size) {
+	auto &stats = tagStats[(uint8_t)tag];
+	stats.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+	stats.liveCount.fetch_sub(1, std::memory_order_relaxed);
+}
+void *allocate(HeapTag tag, size_t size) {
+	auto header = (Header *)backingAllocate(sizeof(Header) + size);
+	if(!header) return nullptr;
+	header->size = size;
+	charge(tag, size);
+	return header + 1;
+}
+void *reallocate(HeapTag tag, void *ptr, size_t size) {
+	if(!ptr) return allocate(tag, size);
+	auto header = (Header *)ptr - 1;
+	auto oldSize = header->size;
+	header = (Header *)backingReallocate(header, sizeof(Header) + size);
+	if(!header) return nullptr;
+	header->size = size;
+	auto &stats = tagStats[(uint8_t)tag];
+	stats.liveBytes.fetch_add(size - oldSize, std::memory_order_relaxed);
+	return header + 1;
+}
+void deallocate(HeapTag tag, void *ptr) {
+	if(!ptr) return;
+	auto header = (Header *)ptr - 1;
+	release(tag, header->size);
+	backingFree(header);
+}
+TagStats stats(HeapTag tag) {
+	auto &stats = tagStats[(uint8_t)tag];
+	return TagStats{ stats.liveBytes.load(std::memory_order_relaxed),
+		             stats.liveCount.load(std::memory_order_relaxed),
+		             stats.allocations.load(std::memory_order_relaxed) };
+}
+} // namespace Heap
@@ -0,0 +1,216 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+
+// Samples the watch keeps, one every time loop() calls sample().
+#define HEAP_HISTORY_SIZE 32
+// The watch warns when the largest free block falls below this many bytes, when fragmentation
+// rises above HEAP_FRAGMENTATION_WARN percent, or when the largest block has shrunk by
+// HEAP_TREND_WARN percent over the kept history.
+#define HEAP_LARGEST_BLOCK_WARN 16384
+#define HEAP_FRAGMENTATION_WARN 50
+#define HEAP_TREND_WARN 25
+
+// Subsystems that heap allocations are charged to.
+enum class HeapTag : uint8_t { Json, WebSocket, Effects, Http, Fs, Count };
+constexpr const char *heapTagNames[] = { "json", "webSocket", "effects", "http", "fs" };
+static_assert(sizeof(heapTagNames) / sizeof(*heapTagNames) == (uint8_t)HeapTag::Count,
+              "every tag needs a name");
+
+namespace Heap {
+struct TagStats {
+	uint32_t liveBytes;
+	uint32_t liveCount;
+	uint32_t allocations; // since boot
+};
+
+// Where tagged memory comes from: malloc, realloc and free, unless the host build swaps in its
+// simulated heap.
+void *backingAllocate(size_t size);
+void *backingReallocate(void *ptr, size_t size);
+void backingFree(void *ptr);
+// Like malloc and free, but charged to tag. Only free memory from allocate() with deallocate().
+void *allocate(HeapTag tag, size_t size);
+void *reallocate(HeapTag tag, void *ptr, size_t size);
+void deallocate(HeapTag tag, void *ptr);
+// For memory allocated elsewhere, like inside a library, whose size is known.
+void charge(HeapTag tag, size_t size);
+void release(HeapTag tag, size_t size);
+TagStats stats(HeapTag tag);
+
+// For BasicJsonDocument.
+template <HeapTag Tag> struct JsonAllocator {
+	void *allocate(size_t size) {
+		return Heap::allocate(Tag, size);
+	}
+	void *reallocate(void *ptr, size_t size) {
+		return Heap::reallocate(Tag, ptr, size);
+	}
+	void deallocate(void *ptr) {
+		Heap::deallocate(Tag, ptr);
+	}
+};
+
+// For standard containers. Like the default allocator, running out of memory aborts.
+template <typename T, HeapTag Tag> struct Allocator {
+	using value_type = T;
+	Allocator() = default;
+	template <typename U> Allocator(const Allocator<U, Tag> &) {
+	}
+	T *allocate(size_t n) {
+		auto ptr = (T *)backingAllocate(n * sizeof(T));
+		if(!ptr) abort();
+		charge(Tag, n * sizeof(T));
+		return ptr;
+	}
+	void deallocate(T *ptr, size_t n) {
+		backingFree(ptr);
+		release(Tag, n * sizeof(T));
+	}
+	template <typename U> struct rebind { using other = Allocator<U, Tag>; };
+};
+template <typename T, typename U, HeapTag Tag>
+bool operator==(const Allocator<T, Tag> &, const Allocator<U, Tag> &) {
+	return true;
+}
+template <typename T, typename U, HeapTag Tag>
+bool operator!=(const Allocator<T, Tag> &, const Allocator<U, Tag> &) {
+	return false;
+}
+
+// For node-based containers that are filled and emptied over and over. Single nodes that are
+// freed go on a free list kept per node type and are handed out again before the heap is asked
+// for more, so the churn stays off the heap. The list only grows, to the most nodes ever in use
+// at once, and its nodes stay charged to Tag.
+template <typename T, HeapTag Tag> struct RecyclingAllocator {
+	using value_type = T;
+	RecyclingAllocator() = default;
+	template <typename U> RecyclingAllocator(const RecyclingAllocator<U, Tag> &) {
+	}
+	T *allocate(size_t n) {
+		if(n == 1 && recycles) {
+			std::lock_guard<std::mutex> guard(lock());
+			if(auto node = freeList()) {
+				freeList() = node->next;
+				return (T *)node;
+			}
+		}
+		return Allocator<T, Tag>().allocate(n);
+	}
+	void deallocate(T *ptr, size_t n) {
+		if(n == 1 && recycles) {
+			std::lock_guard<std::mutex> guard(lock());
+			auto node = (FreeNode *)ptr;
+			node->next = freeList();
+			freeList() = node;
+			return;
+		}
+		Allocator<T, Tag>().deallocate(ptr, n);
+	}
+	template <typename U> struct rebind { using other = RecyclingAllocator<U, Tag>; };
+
+private:
+	struct FreeNode {
+		FreeNode *next;
+	};
+	static constexpr bool recycles = sizeof(T) >= sizeof(FreeNode) && alignof(T) >= alignof(FreeNode);
+	static FreeNode *&freeList() {
+		static FreeNode *list = nullptr;
+		return list;
+	}
+	static std::mutex &lock() {
+		static std::mutex lock;
+		return lock;
+	}
+};
+template <typename T, typename U, HeapTag Tag>
+bool operator==(const RecyclingAllocator<T, Tag> &, const RecyclingAllocator<U, Tag> &) {
+	return true;
+}
+template <typename T, typename U, HeapTag Tag>
+bool operator!=(const RecyclingAllocator<T, Tag> &, const RecyclingAllocator<U, Tag> &) {
+	return false;
+}
+
+// Keeps track of how large and fragmented the free heap is, and warns on the serial port when it
+// degrades.
+class Watch {
+	struct Sample {
+		uint32_t free;
+		uint32_t largestBlock;
+	};
+	Sample history[HEAP_HISTORY_SIZE];
+	uint8_t next = 0;
+	uint8_t count = 0;
+	uint32_t minLargestBlock = UINT32_MAX;
+	bool warning = false;
+
+	static uint8_t fragmentation(const Sample &sample) {
+		return sample.free ? 100 - (uint64_t)sample.largestBlock * 100 / sample.free : 0;
+	}
+	const Sample &latest() const {
+		return history[(next + HEAP_HISTORY_SIZE - 1) % HEAP_HISTORY_SIZE];
+	}
+	const Sample &oldest() const {
+		return history[count < HEAP_HISTORY_SIZE ? 0 : next];
+	}
+
+public:
+	void sample() {
+		Sample current{ ESP.getFreeHeap(), ESP.getMaxAllocHeap() };
+		history[next] = current;
+		next = (next + 1) % HEAP_HISTORY_SIZE;
+		if(count < HEAP_HISTORY_SIZE) count++;
+		minLargestBlock = std::min(minLargestBlock, current.largestBlock);
+
+		auto &first = oldest();
+		bool shrinking =
+		current.largestBlock < (uint64_t)first.largestBlock * (100 - HEAP_TREND_WARN) / 100;
+		bool degraded = current.largestBlock < HEAP_LARGEST_BLOCK_WARN ||
+		                fragmentation(current) > HEAP_FRAGMENTATION_WARN || shrinking;
+		if(degraded && !warning) {
+			Serial.printf("heap degraded: %u free, largest block %u (%u at start of window), "
+			              "%u%% fragmented\n",
+			              current.free, current.largestBlock, first.largestBlock,
+			              fragmentation(current));
+		} else if(!degraded && warning) {
+			Serial.println("heap recovered");
+		}
+		warning = degraded;
+	}
+	void toJson(JsonObject heap) const {
+		if(count) {
+			heap["free"] = latest().free;
+			heap["largestBlock"] = latest().largestBlock;
+			heap["fragmentation"] = fragmentation(latest());
+			heap["minLargestBlock"] = minLargestBlock;
+		}
+		heap["minFree"] = ESP.getMinFreeHeap();
+		heap["warning"] = warning;
+		auto largestBlocks = heap.createNestedArray("largestBlockHistory");
+		for(uint8_t i = 0; i < count; i++) {
+			auto &sample = history[(next + HEAP_HISTORY_SIZE - count + i) % HEAP_HISTORY_SIZE];
+			largestBlocks.add(sample.largestBlock);
+		}
+		auto tags = heap.createNestedObject("tags");
+		for(auto i = 0; i < (uint8_t)HeapTag::Count; i++) {
+			auto tagStats = stats((HeapTag)i);
+			auto tag = tags.createNestedObject(heapTagNames[i]);
+			tag["bytes"] = tagStats.liveBytes;
+			tag["count"] = tagStats.liveCount;
+			tag["allocations"] = tagStats.allocations;
+		}
+	}
+};
+} // namespace Heap
+
+// A JSON document whose pool is charged to HeapTag::Json.
+using TaggedJsonDocument = BasicJsonDocument<Heap::JsonAllocator<HeapTag::Json>>;
+// Capacity Heap::Watch::toJson() needs.
+#define HEAP_JSON_SIZE                                                                             \
+	(JSON_OBJECT_SIZE(8) + JSON_ARRAY_SIZE(HEAP_HISTORY_SIZE) +                                     \
+	 JSON_OBJECT_SIZE((uint8_t)HeapTag::Count) + (uint8_t)HeapTag::Count * JSON_OBJECT_SIZE(3))
@@ -1,24 +1,226 @@
 #pragma once
 #include <FastLED.h>
-#include <functional>
+#include <math.h>
+#include <string.h>
+
+#define STRIP_NAME_LENGTH 23
+#define STRIP_MAX 8
+// Gamma applied by the HDR quantize pass.
+#define HDR_GAMMA 2.2
+// Current an LED draws when dark, in milliamps.
+#define LED_IDLE_MILLIAMPS 1
+// Time it takes to send one LED at 800kHz, in microseconds.
+#define LED_WIRE_MICROS 30
+
+// Current each channel of an LED draws at full scale, in milliamps.
+constexpr uint8_t ledChannelMilliamps[3] = { 16, 11, 15 };
+
+enum class StripChipset : uint8_t { WS2812B, WS2811, SK6812, Count };
+constexpr const char *stripChipsetNames[] = { "WS2812B", "WS2811", "SK6812" };
+enum class StripOrder : uint8_t { RGB, GRB, BGR, Count };
+constexpr const char *stripOrderNames[] = { "RGB", "GRB", "BGR" };
+enum StripFlags : uint8_t {
+	// Brightness, color correction and gamma are applied at 16 bits per channel and dithered down.
+	STRIP_HDR = 1 << 0,
+};
+
+// Steps a strip is taken down by when frames miss their deadline; each includes the ones before.
+enum class StripQuality : uint8_t { Full, NoDither, HalfRate, QuarterRate, Count };
+constexpr const char *stripQualityNames[] = { "full", "noDither", "halfRate", "quarterRate" };
+
+// How a strip is wired up. Saved as-is in NVS.
+struct StripSettings {
+	char name[STRIP_NAME_LENGTH + 1];
+	uint16_t length;
+	uint8_t pin;
+	StripChipset chipset;
+	StripOrder order;
+	uint8_t flags;
+	uint16_t maxMilliamps; // 0 for no limit of its own
+};
+
+// 8-bit sRGB-ish values to 16-bit linear ones.
+struct GammaTable {
+	uint16_t values[256];
+	GammaTable() {
+		for(auto i = 0; i < 256; i++) {
+			values[i] = lround(pow(i / 255.0, HDR_GAMMA) * 65535);
+		}
+	}
+};
+
+// Light each 8-bit channel value gives on a 0-255 scale: as-is for strips FastLED scales linearly,
+// along the gamma curve for HDR strips.
+struct LightLevels {
+	uint8_t linear[256];
+	uint8_t gamma[256];
+	LightLevels() {
+		for(auto i = 0; i < 256; i++) {
+			linear[i] = i;
+			gamma[i] = lround(pow(i / 255.0, HDR_GAMMA) * 255);
+		}
+	}
+};
+inline const LightLevels &lightLevels() {
+	static const LightLevels levels;
+	return levels;
+}
+
+// A strip's pixels as effects write them. Every write keeps a running total of the current the
+// pixels draw at full brightness, so the power limiter has the frame's demand without walking the
+// pixels again.
+class PixelSpan {
+	CRGB *pixels;
+	uintptr_t count;
+	// Milliamps times 255.
+	uint32_t *total;
+	const uint8_t *levels;
+
+	uint32_t weigh(const CRGB &pixel) const {
+		return levels[pixel.r] * ledChannelMilliamps[0] + levels[pixel.g] * ledChannelMilliamps[1] +
+		       levels[pixel.b] * ledChannelMilliamps[2];
+	}
+
+public:
+	class Ref {
+		const PixelSpan &span;
+		CRGB &pixel;
+
+	public:
+		Ref(const PixelSpan &span, CRGB &pixel) : span(span), pixel(pixel) {
+		}
+		Ref &operator=(const CRGB &color) {
+			*span.total += span.weigh(color) - span.weigh(pixel);
+			pixel = color;
+			return *this;
+		}
+		Ref &operator=(const Ref &other) {
+			return *this = (CRGB)other;
+		}
+		operator CRGB() const {
+			return pixel;
+		}
+	};
+
+	PixelSpan(CRGB *pixels, uintptr_t count, uint32_t *total, const uint8_t *levels)
+	: pixels(pixels), count(count), total(total), levels(levels) {
+	}
+	uintptr_t size() const {
+		return count;
+	}
+	Ref operator[](uintptr_t i) {
+		return Ref(*this, pixels[i]);
+	}
+	CRGB operator[](uintptr_t i) const {
+		return pixels[i];
+	}
+	void fill(const CRGB &color) {
+		fill_solid(pixels, count, color);
+		*total = weigh(color) * count;
+	}
+};
+
+struct HdrStats {
+	uint32_t lastMicros;
+	uint32_t maxMicros;
+};
+
 struct GenericLightStrip {
-	const char *name;
+	char name[STRIP_NAME_LENGTH + 1];
+	// What effects render into.
 	CRGB *data;
 	uintptr_t len;
+	StripSettings settings;
+	CLEDController *controller = nullptr;
+	// HDR strips only: the quantized pixels that are sent, and each channel's quantization error,
+	// which is carried into the next frame.
+	CRGB *output = nullptr;
+	uint8_t *residual = nullptr;
+	CRGB correction = UncorrectedColor;
+	HdrStats hdrStats = {};
+	// Milliamps the pixels would draw at full brightness, on top of the idle current, times 255.
+	// Kept up to date by writes through pixels().
+	uint32_t demandTotal = 0;
+	// Scales brightness down to keep within the power budget; set by PowerLimiter.
+	uint8_t powerLimit = 255;
+	// Estimated milliamps as last shown.
+	uint32_t draw = 0;
+	StripQuality quality = StripQuality::Full;
+	// Whether the strip is rendered and shown this frame; below full rate it sits some out.
+	bool active = true;
+	// As of the last frame the strip was active.
+	uint32_t renderMicros = 0;
 
-	std::function<void(CRGB *, uintptr_t)> initFunc;
-	void init() const {
-		initFunc(data, len);
+	GenericLightStrip(const StripSettings &settings, CRGB *data)
+	: data(data), len(settings.length), settings(settings) {
+		strncpy(name, settings.name, sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
 	}
-
-	GenericLightStrip(const char *name, uintptr_t len, std::function<void(CRGB *, uintptr_t)> initFunc)
-	: name(name), len(len), initFunc(initFunc) {
+	// Memory the strip needs from the pixel arena, in pixels.
+	static size_t arenaSize(const StripSettings &settings) {
+		return settings.flags & STRIP_HDR ? settings.length * 3 : settings.length;
 	}
-};
-template <unsigned int N> struct LightStrip : GenericLightStrip {
-	CRGB internalData[N];
-	LightStrip(const char *name, std::function<void(CRGB *, uintptr_t)> initFunc)
-	: GenericLightStrip(name, N, initFunc) {
-		data = internalData;
+	uint32_t idleDraw() const {
+		return len * LED_IDLE_MILLIAMPS;
+	}
+	// Frames per render at the current quality.
+	uint8_t frameDivisor() const {
+		return quality >= StripQuality::QuarterRate ? 4 : quality >= StripQuality::HalfRate ? 2 : 1;
+	}
+	bool dithers() const {
+		return quality < StripQuality::NoDither;
+	}
+	void setQuality(StripQuality level) {
+		quality = level;
+		// HDR strips dither in quantize() instead.
+		if(!output) controller->setDither(dithers() ? BINARY_DITHER : DISABLE_DITHER);
+	}
+	// What effects render into. Anything that writes data has to go through here.
+	PixelSpan pixels() {
+		auto &levels = lightLevels();
+		return PixelSpan(data, len, &demandTotal,
+		                 settings.flags & STRIP_HDR ? levels.gamma : levels.linear);
+	}
+	uint32_t demand() const {
+		return demandTotal / 255;
+	}
+	// Scales, gamma-corrects and dithers data into output in one pass. Each channel goes through
+	// 16-bit linear light; the bits below the 8 that are sent are kept in residual and added to
+	// the next frame, so over time the average output matches the 16-bit value. Without dithering
+	// the value is rounded instead.
+	void quantize(uint8_t brightness) {
+		static const GammaTable gamma;
+		uint32_t scale[3];
+		for(auto c = 0; c < 3; c++) {
+			scale[c] = brightness ? (brightness + 1) * (correction.raw[c] + 1) : 0;
+		}
+		auto in = data->raw;
+		auto out = output->raw;
+		bool dither = dithers();
+		for(uintptr_t i = 0; i < len * 3; i += 3) {
+			for(auto c = 0; c < 3; c++) {
+				auto linear = gamma.values[in[i + c]];
+				uint32_t carry = dither ? residual[i + c] : 0x80;
+				uint32_t value = ((linear * scale[c]) >> 16) + carry;
+				if(value > 0xFFFF) value = 0xFFFF;
+				out[i + c] = value >> 8;
+				if(dither) residual[i + c] = value & 0xFF;
+			}
+		}
+	}
+	// Applies the power limit and quantizes HDR strips, getting the strip ready for
+	// FastLED.show(). That takes one brightness for every strip, so the others get theirs through
+	// their controller's color temperature, which FastLED multiplies in the same way.
+	void composite(uint8_t brightness) {
+		brightness = (brightness * (powerLimit + 1)) >> 8;
+		if(!output) {
+			controller->setTemperature(CRGB(brightness, brightness, brightness));
+		} else {
+			auto start = micros();
+			quantize(brightness);
+			hdrStats.lastMicros = micros() - start;
+			if(hdrStats.lastMicros > hdrStats.maxMicros) hdrStats.maxMicros = hdrStats.lastMicros;
+		}
+		draw = idleDraw() + demand() * brightness / 255;
 	}
 };
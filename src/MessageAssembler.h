@@ -0,0 +1,80 @@
+#pragma once
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+
+// Fragmented messages are reassembled into one of a few preallocated slots. A message that
+// doesn't fit in a slot, or arrives while every slot is busy, is discarded.
+#define MESSAGE_POOL_SLOTS 4
+#define MESSAGE_POOL_SLOT_SIZE 4096
+
+class MessageAssembler {
+	struct Assembly {
+		uint32_t clientId;
+		size_t length;
+		bool active;
+		bool discard;
+	};
+	uint8_t storage[MESSAGE_POOL_SLOTS][MESSAGE_POOL_SLOT_SIZE];
+	Assembly assemblies[MESSAGE_POOL_SLOTS] = {};
+
+	Assembly *find(uint32_t clientId) {
+		for(auto &assembly : assemblies) {
+			if(assembly.active && assembly.clientId == clientId) return &assembly;
+		}
+		return nullptr;
+	}
+
+public:
+	enum class Result { Pending, Complete, TooLarge, NoBuffer };
+	// Appends one fragment from a WS_EVT_DATA event. On Complete, message and length point to the
+	// whole message inside the pool; it stays valid until release() is called for the client.
+	Result append(uint32_t clientId,
+	              const AwsFrameInfo *info,
+	              const uint8_t *data,
+	              size_t len,
+	              uint8_t *&message,
+	              size_t &length) {
+		bool start = info->num == 0 && info->index == 0;
+		bool end = info->final && info->index + len == info->len;
+		Assembly *assembly = find(clientId);
+		if(start) {
+			if(assembly) {
+				// The previous message never finished; start over.
+				assembly->length = 0;
+				assembly->discard = false;
+			} else {
+				for(auto &candidate : assemblies) {
+					if(candidate.active) continue;
+					candidate = Assembly{ clientId, 0, true, false };
+					assembly = &candidate;
+					break;
+				}
+			}
+		}
+		if(!assembly) {
+			// Report the missing buffer once, on the first fragment; the rest are ignored.
+			return start ? Result::NoBuffer : Result::Pending;
+		}
+		if(!assembly->discard) {
+			if(assembly->length + len > MESSAGE_POOL_SLOT_SIZE) {
+				assembly->discard = true;
+			} else {
+				memcpy(storage[assembly - assemblies] + assembly->length, data, len);
+				assembly->length += len;
+			}
+		}
+		if(!end) return Result::Pending;
+		if(assembly->discard) {
+			assembly->active = false;
+			return Result::TooLarge;
+		}
+		message = storage[assembly - assemblies];
+		length = assembly->length;
+		return Result::Complete;
+	}
+	void release(uint32_t clientId) {
+		Assembly *assembly = find(clientId);
+		if(assembly) assembly->active = false;
+	}
+};
@@ -0,0 +1,89 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <memory>
+
+namespace Metrics {
+std::atomic<uint32_t> values[(uint8_t)Metric::Count];
+
+namespace {
+struct MetricInfo {
+	const char *name;
+	const char *labels; // empty, or the {...} part
+	const char *type;
+	const char *help;
+};
+// Indexed by Metric. Entries sharing a name are kept together, so HELP and TYPE go out once.
+const MetricInfo metricInfo[] = {
+	{ "lighting_frames_rendered_total", "", "counter", "Frames rendered and shown." },
+	{ "lighting_frame_overruns_total", "{cause=\"render\"}", "counter",
+	  "Frames that missed their deadline, by what took longest." },
+	{ "lighting_frame_overruns_total", "{cause=\"show\"}", "counter", "" },
+	{ "lighting_frame_overruns_total", "{cause=\"external\"}", "counter", "" },
+	{ "lighting_degraded_strips", "", "gauge", "Strips running below full quality to keep up." },
+	{ "lighting_show_microseconds", "", "gauge",
+	  "Time the last frame took to send to the strips." },
+	{ "lighting_heap_free_bytes", "", "gauge", "Free heap." },
+	{ "lighting_heap_min_free_bytes", "", "gauge", "Lowest free heap since boot." },
+	{ "lighting_heap_largest_free_block_bytes", "", "gauge",
+	  "Largest block that can be allocated." },
+	{ "lighting_ws_clients", "", "gauge", "Connected WebSocket clients." },
+	{ "lighting_ws_messages_in_total", "", "counter", "WebSocket messages received and decoded." },
+	{ "lighting_ws_messages_out_total", "", "counter", "WebSocket messages handed to clients." },
+	{ "lighting_ws_messages_dropped_total", "", "counter",
+	  "Snapshots replaced before they were sent, and received messages that were rejected." },
+	{ "lighting_config_saves_total", "", "counter", "Effect configs written to flash." },
+	{ "lighting_static_hits_total", "", "counter",
+	  "Static files served, including 304 responses." },
+	{ "lighting_static_misses_total", "", "counter", "Requests that found no static file." },
+};
+static_assert(sizeof(metricInfo) / sizeof(*metricInfo) == (uint8_t)Metric::Count,
+              "every metric needs a name");
+
+// Formats one metric at a time as the response asks for more.
+struct Writer {
+	uint8_t metric = 0;
+	char text[256];
+	size_t length = 0;
+	size_t offset = 0;
+
+	bool next() {
+		if(metric == (uint8_t)Metric::Count) return false;
+		auto &info = metricInfo[metric];
+		auto value = values[metric].load(std::memory_order_relaxed);
+		int written;
+		if(metric && strcmp(metricInfo[metric - 1].name, info.name) == 0) {
+			written = snprintf(text, sizeof(text), "%s%s %u\n", info.name, info.labels, value);
+		} else {
+			written = snprintf(text, sizeof(text), "# HELP %s %s\n# TYPE %s %s\n%s%s %u\n",
+			                   info.name, info.help, info.name, info.type, info.name, info.labels,
+			                   value);
+		}
+		length = std::min((size_t)std::max(written, 0), sizeof(text) - 1);
+		offset = 0;
+		metric++;
+		return true;
+	}
+	size_t fill(uint8_t *buffer, size_t maxLen) {
+		size_t len = 0;
+		while(len < maxLen) {
+			if(offset == length && !next()) break;
+			auto chunk = std::min(maxLen - len, length - offset);
+			memcpy(buffer + len, text + offset, chunk);
+			len += chunk;
+			offset += chunk;
+		}
+		return len;
+	}
+};
+} // namespace
+
+void handleRequest(AsyncWebServerRequest *request) {
+	set(Metric::FreeHeap, ESP.getFreeHeap());
+	set(Metric::MinFreeHeap, ESP.getMinFreeHeap());
+	set(Metric::LargestFreeBlock, ESP.getMaxAllocHeap());
+	auto writer = std::make_shared<Writer>();
+	request->send(request->beginChunkedResponse(
+	"text/plain; version=0.0.4",
+	[writer](uint8_t *buffer, size_t maxLen, size_t) { return writer->fill(buffer, maxLen); }));
+}
+} // namespace Metrics
@@ -0,0 +1,40 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+
+// Counters and gauges served in the Prometheus text format. Every value is a relaxed atomic, so
+// bumping one is a single instruction sequence and safe from any task.
+namespace Metrics {
+enum class Metric : uint8_t {
+	FramesRendered,
+	// In the order of OverrunCause.
+	FrameOverrunsRender,
+	FrameOverrunsShow,
+	FrameOverrunsExternal,
+	DegradedStrips,
+	ShowMicros,
+	FreeHeap,
+	MinFreeHeap,
+	LargestFreeBlock,
+	WsClients,
+	MessagesIn,
+	MessagesOut,
+	MessagesDropped,
+	ConfigSaves,
+	StaticHits,
+	StaticMisses,
+	Count
+};
+
+extern std::atomic<uint32_t> values[(uint8_t)Metric::Count];
+
+inline void increment(Metric metric) {
+	values[(uint8_t)metric].fetch_add(1, std::memory_order_relaxed);
+}
+inline void set(Metric metric, uint32_t value) {
+	values[(uint8_t)metric].store(value, std::memory_order_relaxed);
+}
+// Streams every metric, refreshing the heap gauges first.
+void handleRequest(AsyncWebServerRequest *request);
+} // namespace Metrics
@@ -0,0 +1,22 @@
+#include "Perf.h"
+
+#if PERF_STATS
+Perf perf;
+
+void Perf::toJson(JsonDocument &doc, size_t stripCount) const {
+	doc["type"] = "perfStats";
+	auto stageStats = doc.createNestedObject("stages");
+	for(auto i = 0; i < (uint8_t)PerfStage::Count; i++) {
+		stages[i].toJson(stageStats.createNestedObject(perfStageNames[i]));
+	}
+	auto stripStats = doc.createNestedArray("strips");
+	for(size_t i = 0; i < stripCount && i < STRIP_MAX; i++) {
+		strips[i].toJson(stripStats.createNestedObject());
+	}
+	doc["histogramBase"] = PERF_HISTOGRAM_BASE;
+	auto buckets = doc.createNestedArray("histogram");
+	for(auto count : histogram) {
+		buckets.add(count);
+	}
+}
+#endif
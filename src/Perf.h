@@ -0,0 +1,120 @@
+#pragma once
+#include "Lighting.h"
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <algorithm>
+
+// Build with -D PERF_STATS=0 to leave out all of the instrumentation below.
+#ifndef PERF_STATS
+#define PERF_STATS 1
+#endif
+// Samples kept per stage; min, avg and p99 are over these.
+#define PERF_RING_SIZE 64
+// Frame time buckets: bucket i counts frames shorter than PERF_HISTOGRAM_BASE << i microseconds,
+// and the last one everything longer.
+#define PERF_HISTOGRAM_BUCKETS 11
+#define PERF_HISTOGRAM_BASE 1024
+
+enum class PerfStage : uint8_t { Ota, Sun, Updates, Render, Composite, Show, Cleanup, Frame, Count };
+constexpr const char *perfStageNames[] = { "ota",       "sun",  "updates", "render",
+	                                       "composite", "show", "cleanup", "frame" };
+static_assert(sizeof(perfStageNames) / sizeof(*perfStageNames) == (uint8_t)PerfStage::Count,
+              "every stage needs a name");
+
+#if PERF_STATS
+// The last PERF_RING_SIZE durations of one stage, in CPU cycles.
+class PerfRing {
+	uint32_t samples[PERF_RING_SIZE];
+	uint16_t next = 0;
+	uint16_t count = 0;
+
+public:
+	void add(uint32_t cycles) {
+		samples[next] = cycles;
+		next = (next + 1) % PERF_RING_SIZE;
+		if(count < PERF_RING_SIZE) count++;
+	}
+	// Adds min, avg and p99 in microseconds to stats.
+	void toJson(JsonObject stats) const {
+		if(!count) return;
+		uint32_t sorted[PERF_RING_SIZE];
+		std::copy(samples, samples + count, sorted);
+		std::sort(sorted, sorted + count);
+		uint64_t sum = 0;
+		for(auto i = 0; i < count; i++) {
+			sum += sorted[i];
+		}
+		uint32_t mhz = ESP.getCpuFreqMHz();
+		stats["min"] = sorted[0] / mhz;
+		stats["avg"] = (uint32_t)(sum / count / mhz);
+		stats["p99"] = sorted[(count * 99 - 1) / 100] / mhz;
+	}
+};
+
+// Stage timings for loop(), all taken on the loop task.
+class Perf {
+	PerfRing stages[(uint8_t)PerfStage::Count];
+	PerfRing strips[STRIP_MAX];
+	uint32_t histogram[PERF_HISTOGRAM_BUCKETS] = {};
+	uint32_t lastFrame = 0;
+
+public:
+	void record(PerfStage stage, uint32_t cycles) {
+		stages[(uint8_t)stage].add(cycles);
+	}
+	void recordStrip(uintptr_t strip, uint32_t cycles) {
+		if(strip < STRIP_MAX) strips[strip].add(cycles);
+	}
+	// Called once at the start of every frame; records the time since the last one.
+	void frame() {
+		uint32_t now = ESP.getCycleCount();
+		if(lastFrame) {
+			uint32_t cycles = now - lastFrame;
+			record(PerfStage::Frame, cycles);
+			uint32_t micros = cycles / ESP.getCpuFreqMHz();
+			auto bucket = 0;
+			while(bucket < PERF_HISTOGRAM_BUCKETS - 1 &&
+			      micros >= (uint32_t)PERF_HISTOGRAM_BASE << bucket) {
+				bucket++;
+			}
+			histogram[bucket]++;
+		}
+		lastFrame = now;
+	}
+	void toJson(JsonDocument &doc, size_t stripCount) const;
+};
+extern Perf perf;
+
+class PerfScope {
+	PerfStage stage;
+	uint32_t start;
+
+public:
+	PerfScope(PerfStage stage) : stage(stage), start(ESP.getCycleCount()) {
+	}
+	~PerfScope() {
+		perf.record(stage, ESP.getCycleCount() - start);
+	}
+};
+class PerfStripScope {
+	uintptr_t strip;
+	uint32_t start;
+
+public:
+	PerfStripScope(uintptr_t strip) : strip(strip), start(ESP.getCycleCount()) {
+	}
+	~PerfStripScope() {
+		perf.recordStrip(strip, ESP.getCycleCount() - start);
+	}
+};
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+// Times the rest of the enclosing block as the given stage.
+#define PERF_SCOPE(stage) PerfScope PERF_CONCAT(perfScope, __LINE__)(PerfStage::stage)
+#define PERF_STRIP_SCOPE(strip) PerfStripScope PERF_CONCAT(perfScope, __LINE__)(strip)
+#define PERF_FRAME() perf.frame()
+#else
+#define PERF_SCOPE(stage)
+#define PERF_STRIP_SCOPE(strip)
+#define PERF_FRAME()
+#endif
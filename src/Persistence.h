@@ -0,0 +1,161 @@
+#pragma once
+#include <Arduino.h>
+#include "Heap.h"
+#include "Trace.h"
+#include <FS.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+// How long a save request waits for a newer one before it is written.
+#define PERSIST_DEBOUNCE 500
+
+struct PersistenceStats {
+	uint32_t writes;
+	uint32_t skipped;
+	uint32_t failures;
+	uint32_t bytesWritten;
+	uint32_t lastLatency; // microseconds
+	uint32_t maxLatency;  // microseconds
+};
+
+// A file that is replaced as a whole: new content goes to a temporary file that then takes the
+// place of the real one, so a power cut leaves either the old or the new content on flash.
+//
+// SPIFFS can't rename over an existing file, so the old file is removed first. A temporary file
+// without a real one next to it is therefore complete, and takes its place before the file is
+// read or written again. The real file exists, if empty, before the first temporary one is
+// written, so a half-written first version never looks complete. An empty file reads as missing.
+class AtomicFile {
+	fs::FS &fs;
+	const char *path;
+	const char *tempPath;
+
+	void recover() {
+		if(!fs.exists(path) && fs.exists(tempPath)) {
+			fs.rename(tempPath, path);
+		}
+	}
+
+public:
+	AtomicFile(fs::FS &fs, const char *path, const char *tempPath)
+	: fs(fs), path(path), tempPath(tempPath) {
+	}
+	const char *name() const {
+		return path;
+	}
+	File open() {
+		recover();
+		File file = fs.open(path);
+		if(file && (file.isDirectory() || !file.size())) return File();
+		return file;
+	}
+	bool write(const uint8_t *data, size_t len) {
+		recover();
+		if(!fs.exists(path) && !fs.open(path, FILE_WRITE)) return false;
+		File file = fs.open(tempPath, FILE_WRITE);
+		if(!file) return false;
+		size_t written = file.write(data, len);
+		file.close();
+		if(written != len) return false;
+		fs.remove(path);
+		return fs.rename(tempPath, path);
+	}
+};
+
+// Writes data in the background. Saves are debounced and skipped when the content hasn't changed
+// since the last write. All services share one low-priority task on core 0, away from the
+// render loop.
+class PersistenceService {
+public:
+	using Writer = std::function<bool(const uint8_t *data, size_t len)>;
+
+private:
+	using Buffer = std::vector<uint8_t, Heap::Allocator<uint8_t, HeapTag::Fs>>;
+	Writer writer;
+	// Guards the pending content and stats, which the persist task and loop() both use.
+	mutable std::mutex lock;
+	Buffer pending;
+	bool hasPending = false;
+	uint32_t requestedAt = 0;
+	uint32_t savedHash = 0;
+	PersistenceStats stats = {};
+
+	static std::vector<PersistenceService *> &services() {
+		static std::vector<PersistenceService *> services;
+		return services;
+	}
+	static std::mutex &servicesLock() {
+		static std::mutex lock;
+		return lock;
+	}
+	static void taskFunction(void *) {
+		for(;;) {
+			vTaskDelay(pdMS_TO_TICKS(100));
+			std::lock_guard<std::mutex> guard(servicesLock());
+			for(auto service : services()) {
+				service->flush(false);
+			}
+		}
+	}
+
+public:
+	PersistenceService(Writer writer) : writer(writer) {
+	}
+	static uint32_t hash(const uint8_t *data, size_t len, uint32_t hash = 2166136261) {
+		// FNV-1a
+		for(size_t i = 0; i < len; i++) {
+			hash = (hash ^ data[i]) * 16777619;
+		}
+		return hash;
+	}
+	// current is what is already stored, so that saving it again is skipped.
+	void begin(const uint8_t *current, size_t len) {
+		savedHash = hash(current, len);
+		std::lock_guard<std::mutex> guard(servicesLock());
+		if(services().empty()) {
+			xTaskCreatePinnedToCore(taskFunction, "persist", 4096, nullptr, 1, nullptr, 0);
+		}
+		services().push_back(this);
+	}
+	void save(const uint8_t *data, size_t len) {
+		std::lock_guard<std::mutex> guard(lock);
+		pending.assign(data, data + len);
+		hasPending = true;
+		requestedAt = millis();
+	}
+	// Writes the pending content if it's due, or right away if force is set.
+	void flush(bool force) {
+		Buffer data;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if(!hasPending || (!force && millis() - requestedAt < PERSIST_DEBOUNCE)) return;
+			data.swap(pending);
+			hasPending = false;
+		}
+		uint32_t dataHash = hash(data.data(), data.size());
+		if(dataHash == savedHash) {
+			std::lock_guard<std::mutex> guard(lock);
+			stats.skipped++;
+			return;
+		}
+		TRACE_SCOPE("persist write");
+		auto start = micros();
+		bool ok = writer(data.data(), data.size());
+		auto latency = micros() - start;
+		std::lock_guard<std::mutex> guard(lock);
+		if(ok) {
+			savedHash = dataHash;
+			stats.writes++;
+			stats.bytesWritten += data.size();
+			stats.lastLatency = latency;
+			if(latency > stats.maxLatency) stats.maxLatency = latency;
+		} else {
+			stats.failures++;
+		}
+	}
+	PersistenceStats getStats() const {
+		std::lock_guard<std::mutex> guard(lock);
+		return stats;
+	}
+};
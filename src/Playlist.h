@@ -0,0 +1,193 @@
+#pragma once
+#include "EffectManager.h"
+#include "Heap.h"
+#include "Persistence.h"
+#include "SceneLibrary.h"
+#include <ArduinoJson.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define PLAYLIST_MAX 32
+// Shortest time an entry is shown in timer mode, in milliseconds.
+#define PLAYLIST_MIN_INTERVAL 100
+#define PLAYLIST_JSON_SIZE                                                                         \
+	(JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(PLAYLIST_MAX) + PLAYLIST_MAX * (SCENE_NAME_LENGTH + 1))
+
+// Cycles through scenes, either every interval milliseconds or every beatsPerEntry beats.
+//
+// The next entry's effects are built ahead of time on a low-priority task, so when an entry is
+// due loop() only hands the finished set to EffectManager, which swaps it in at the frame
+// boundary. An entry whose scene has since been deleted is skipped.
+class Playlist {
+	SceneLibrary &scenes;
+	EffectManager &effectManager;
+	AtomicFile file;
+	PersistenceService store;
+	TaskHandle_t task = nullptr;
+
+	std::mutex lock;
+	std::vector<std::string> entries;
+	uint32_t interval = 60000;
+	uint16_t beatsPerEntry = 0; // 0 switches on the timer instead
+	bool enabled = false;
+	size_t position = 0;
+	uint32_t switchedAt = 0;
+	// Bumped whenever the entries change, so a set preloaded for the old list is thrown away.
+	uint32_t generation = 0;
+	std::unique_ptr<EffectManager::EffectSet> next;
+	size_t nextPosition = 0;
+	bool preloading = false;
+	std::atomic<uint16_t> beats{ 0 };
+
+	static void taskFunction(void *arg) {
+		auto playlist = (Playlist *)arg;
+		for(;;) {
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			playlist->preload();
+		}
+	}
+	void preload() {
+		for(;;) {
+			size_t first, count;
+			uint32_t startGeneration;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if(entries.empty()) {
+					preloading = false;
+					return;
+				}
+				first = (position + 1) % entries.size();
+				count = entries.size();
+				startGeneration = generation;
+			}
+			// Tries every entry once, starting with the next one, until a scene builds.
+			std::unique_ptr<EffectManager::EffectSet> set;
+			size_t candidate = first;
+			for(size_t tries = 0; tries < count && !set; tries++) {
+				candidate = (first + tries) % count;
+				std::string name;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					if(generation != startGeneration) break;
+					name = entries[candidate];
+				}
+				std::vector<uint8_t> config;
+				if(scenes.get(name, config)) {
+					set = EffectManager::buildEffectSet(config.data(), config.size());
+				}
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			// The list changed while building; start over with the new one.
+			if(generation != startGeneration) continue;
+			preloading = false;
+			next = std::move(set);
+			nextPosition = candidate;
+			return;
+		}
+	}
+	// Called with lock held.
+	void requestPreload() {
+		next.reset();
+		if(!task || !enabled || entries.empty() || preloading) return;
+		preloading = true;
+		xTaskNotifyGive(task);
+	}
+	// Called with lock held.
+	void load(JsonObjectConst doc) {
+		auto list = doc["scenes"];
+		if(list.is<JsonArray>()) {
+			entries.clear();
+			for(JsonVariantConst entry : list.as<JsonArrayConst>()) {
+				auto name = entry.as<const char *>();
+				if(SceneLibrary::validName(name) && entries.size() < PLAYLIST_MAX) {
+					entries.push_back(name);
+				}
+			}
+		}
+		interval = std::max(doc["interval"] | interval, (uint32_t)PLAYLIST_MIN_INTERVAL);
+		beatsPerEntry = doc["beats"] | beatsPerEntry;
+		enabled = doc["enabled"] | enabled;
+		position = entries.size() - 1;
+		generation++;
+	}
+	// Called with lock held.
+	void toJsonLocked(JsonDocument &doc) const {
+		auto list = doc.createNestedArray("scenes");
+		for(auto &entry : entries) {
+			list.add(entry);
+		}
+		doc["interval"] = interval;
+		doc["beats"] = beatsPerEntry;
+		doc["enabled"] = enabled;
+	}
+	// Called with lock held.
+	void persist() {
+		TaggedJsonDocument doc(PLAYLIST_JSON_SIZE);
+		toJsonLocked(doc);
+		std::vector<uint8_t> data(measureMsgPack(doc) + 1);
+		data.resize(serializeMsgPack(doc, (char *)data.data(), data.size()));
+		store.save(data.data(), data.size());
+	}
+
+public:
+	Playlist(fs::FS &fs, SceneLibrary &scenes, EffectManager &effectManager)
+	: scenes(scenes), effectManager(effectManager),
+	  file(fs, "/playlist.msgpack", "/playlist.msgpack.tmp"),
+	  store([this](const uint8_t *data, size_t len) { return file.write(data, len); }) {
+	}
+	// SPIFFS has to be mounted. arena is only used while begin() runs.
+	void begin(DecodeArena &arena) {
+		std::vector<uint8_t> data;
+		File f = file.open();
+		if(f) {
+			data.resize(f.size());
+			if(f.read(data.data(), data.size()) == data.size() &&
+			   arena.decode((char *)data.data(), data.size()) == DeserializationError::Ok) {
+				std::lock_guard<std::mutex> guard(lock);
+				load(arena.root());
+			} else {
+				Serial.println("Couldn't load /playlist.msgpack");
+			}
+		}
+		store.begin(data.data(), data.size());
+		xTaskCreatePinnedToCore(taskFunction, "playlist", 4096, this, 1, &task, 0);
+		std::lock_guard<std::mutex> guard(lock);
+		switchedAt = millis();
+		requestPreload();
+	}
+	// Replaces the playlist; fields left out of doc keep their value. Playback restarts from the
+	// first entry.
+	void set(JsonObjectConst doc) {
+		std::lock_guard<std::mutex> guard(lock);
+		load(doc);
+		switchedAt = millis() - interval;
+		beats = beatsPerEntry;
+		persist();
+		requestPreload();
+	}
+	void beat() {
+		beats++;
+	}
+	// Called from loop() before the pending updates are applied. Returns whether it switched.
+	bool update(uint32_t now) {
+		std::lock_guard<std::mutex> guard(lock);
+		if(!enabled || entries.empty()) return false;
+		bool due = beatsPerEntry ? beats >= beatsPerEntry : now - switchedAt >= interval;
+		if(!due || !next) return false;
+		effectManager.stageEffectSet(std::move(next));
+		position = nextPosition;
+		switchedAt = now;
+		beats = 0;
+		requestPreload();
+		return true;
+	}
+	void toJson(JsonDocument &doc) {
+		std::lock_guard<std::mutex> guard(lock);
+		doc["type"] = "playlist";
+		toJsonLocked(doc);
+	}
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include "Configuration.h"
+#include "Lighting.h"
+#include <ArduinoJson.h>
+#include <algorithm>
+#include <vector>
+
+// A strip's limit only rises once its target is this far above it or unconstrained, and then by
+// POWER_RECOVERY_STEP per frame; it drops to a lower target right away.
+#define POWER_HYSTERESIS 8
+#define POWER_RECOVERY_STEP 1
+
+// Keeps the estimated current within each strip's own budget and a budget for all strips
+// together by scaling their brightness. Current is estimated from the pixel values as effects
+// write them (see PixelSpan), so it's the frame about to be shown that's limited.
+class PowerLimiter {
+	uint32_t budget; // milliamps for all strips, 0 for no limit
+
+public:
+	PowerLimiter(uint32_t budget) : budget(budget) {
+	}
+	uint32_t getBudget() const {
+		return budget;
+	}
+	void setBudget(uint32_t milliamps) {
+		budget = milliamps;
+	}
+	// Sets each strip's powerLimit for the frame about to be shown.
+	void update(std::vector<GenericLightStrip> &strips, uint8_t brightness) {
+		uint32_t targets[STRIP_MAX];
+		uint32_t idle = 0, scaled = 0;
+		for(size_t i = 0; i < strips.size(); i++) {
+			auto &strip = strips[i];
+			uint32_t requested = strip.demand() * brightness / 255;
+			uint32_t maxMilliamps = strip.settings.maxMilliamps;
+			targets[i] = 255;
+			if(maxMilliamps && requested && strip.idleDraw() + requested > maxMilliamps) {
+				auto available = maxMilliamps > strip.idleDraw() ? maxMilliamps - strip.idleDraw() : 0;
+				targets[i] = available * 255 / requested;
+			}
+			idle += strip.idleDraw();
+			scaled += requested * targets[i] / 255;
+		}
+		if(budget && idle + scaled > budget) {
+			uint32_t available = budget > idle ? budget - idle : 0;
+			for(size_t i = 0; i < strips.size(); i++) {
+				targets[i] = scaled ? (uint64_t)targets[i] * available / scaled : 0;
+			}
+		}
+		for(size_t i = 0; i < strips.size(); i++) {
+			auto &limit = strips[i].powerLimit;
+			if(targets[i] < limit) {
+				limit = targets[i];
+			} else if(targets[i] >= limit + POWER_HYSTERESIS || targets[i] == 255) {
+				limit = std::min(targets[i], (uint32_t)limit + POWER_RECOVERY_STEP);
+			}
+		}
+	}
+	void toJson(JsonDocument &doc,
+	            const std::vector<GenericLightStrip> &strips,
+	            uint8_t brightness) const {
+		doc["type"] = "power";
+		doc["budget"] = budget;
+		uint32_t total = 0;
+		auto list = doc.createNestedArray("strips");
+		for(auto &strip : strips) {
+			auto entry = list.createNestedObject();
+			entry["draw"] = strip.draw;
+			entry["requested"] = strip.idleDraw() + strip.demand() * brightness / 255;
+			entry["limit"] = strip.powerLimit;
+			total += strip.draw;
+		}
+		doc["draw"] = total;
+	}
+};
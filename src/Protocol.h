@@ -0,0 +1,67 @@
+#pragma once
+#include <ArduinoJson.h>
+#include <limits>
+#include <string.h>
+#include <vector>
+
+// Incoming message types. Clients may send either the name or the numeric ID; the IDs are
+// advertised in the effectConfig schema message, as are strip, effect and field IDs.
+enum class MessageType : uint8_t {
+	RemoveEffect,
+	UpdateEffect,
+	UpdateGlobal,
+	SaveScene,
+	RecallScene,
+	DeleteScene,
+	SetPlaylist,
+	Beat,
+	SetStrips,
+	Count
+};
+constexpr const char *messageTypeNames[] = { "removeEffect", "updateEffect", "updateGlobal",
+	                                         "saveScene",    "recallScene",  "deleteScene",
+	                                         "setPlaylist",  "beat",         "setStrips" };
+static_assert(sizeof(messageTypeNames) / sizeof(*messageTypeNames) == (uint8_t)MessageType::Count,
+              "every message type needs a name");
+
+inline const char *protocolName(const char *name) {
+	return name;
+}
+template <typename T> const char *protocolName(const T &entry) {
+	return entry.name;
+}
+// Resolves a numeric ID in O(1), falling back to matching by name. Returns count if neither
+// matches.
+template <typename T> uintptr_t resolveId(JsonVariantConst value, const T *table, size_t count) {
+	if(value.is<unsigned int>()) {
+		auto id = value.as<unsigned int>();
+		return id < count ? id : count;
+	}
+	auto name = value.as<const char *>();
+	if(!name) return count;
+	for(uintptr_t i = 0; i < count; i++) {
+		if(strcmp(protocolName(table[i]), name) == 0) return i;
+	}
+	return count;
+}
+template <typename T, size_t N> uintptr_t resolveId(JsonVariantConst value, const T (&table)[N]) {
+	return resolveId(value, table, N);
+}
+template <typename T> uintptr_t resolveId(JsonVariantConst value, const std::vector<T> &table) {
+	return resolveId(value, table.data(), table.size());
+}
+// Reads an optional whole number into field, which is left 0 if the value is missing. Fails if
+// it's anything else or doesn't fit, rather than letting it wrap around.
+template <typename T> bool readInteger(JsonVariantConst value, T &field) {
+	if(value.isNull()) {
+		field = 0;
+		return true;
+	}
+	if(!value.is<long>()) return false;
+	auto number = value.as<long>();
+	if(number < (long)std::numeric_limits<T>::min() || number > (long)std::numeric_limits<T>::max()) {
+		return false;
+	}
+	field = number;
+	return true;
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include "ConfigFormat.h"
+#include "Persistence.h"
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define SCENE_MAX 64
+#define SCENE_NAME_LENGTH 32
+// Largest config a scene may hold, which bounds the buffer a recall reads it into.
+#define SCENE_CONFIG_MAX 4096
+
+// Named snapshots of the whole effect config. Each scene is stored as a ConfigFormat blob taken
+// from the running config, whose values have already been validated, so recalling one doesn't
+// have to validate it again.
+//
+// The library is written to one file in the background:
+//
+//   LibraryHeader
+//   for each scene:  name length (1 byte), name, config length (4 bytes), config
+//
+// with the name and the config each padded to 4 bytes. Only an index of where each config sits in
+// the file is kept in RAM, sorted by name; a recall reads the config from the file. A scene that
+// was just saved keeps its config in RAM until the file holds it.
+class SceneLibrary {
+	static constexpr uint32_t magic = 0x4E43534C; // "LSCN"
+	static constexpr uint16_t version = 1;
+	struct LibraryHeader {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t sceneCount;
+	};
+	struct Scene {
+		std::string name;
+		uint32_t offset; // of the config in the file
+		uint32_t length;
+		std::vector<uint8_t> config; // until the file holds it
+	};
+
+	AtomicFile file;
+	PersistenceService store;
+	// Also held while the file is replaced, so that the index always matches the file.
+	std::mutex lock;
+	std::vector<Scene> scenes; // sorted by name
+	std::string queuedSave;
+
+	std::vector<Scene>::iterator find(const std::string &name) {
+		return std::lower_bound(
+		scenes.begin(), scenes.end(), name,
+		[](const Scene &scene, const std::string &name) { return scene.name < name; });
+	}
+	// Calls callback(name, offset, length) for every scene in a library file, offset being that of
+	// the scene's config. Returns false if the file is malformed.
+	template <typename F> static bool forEachScene(const uint8_t *data, size_t len, F callback) {
+		LibraryHeader header;
+		if(len < sizeof(header)) return false;
+		memcpy(&header, data, sizeof(header));
+		if(header.magic != magic || header.version != version) return false;
+		auto pos = data + sizeof(header);
+		auto end = data + len;
+		for(auto i = 0; i < header.sceneCount; i++) {
+			if(end - pos < 1) return false;
+			size_t nameLength = *pos;
+			if(end - pos < (ptrdiff_t)ConfigFormat::padded(1 + nameLength) + 4) return false;
+			std::string name((const char *)pos + 1, nameLength);
+			pos += ConfigFormat::padded(1 + nameLength);
+			uint32_t configLength;
+			memcpy(&configLength, pos, sizeof(configLength));
+			pos += sizeof(configLength);
+			if(end - pos < (ptrdiff_t)ConfigFormat::padded(configLength)) return false;
+			callback(name, (uint32_t)(pos - data), configLength);
+			pos += ConfigFormat::padded(configLength);
+		}
+		return true;
+	}
+	bool parse(const uint8_t *data, size_t len) {
+		auto add = [this, data](std::string &name, uint32_t offset, uint32_t length) {
+			if(length <= SCENE_CONFIG_MAX && ConfigFormat::Reader(data + offset, length).valid()) {
+				auto scene = find(name);
+				scenes.insert(scene, Scene{ std::move(name), offset, length, {} });
+			}
+		};
+		return forEachScene(data, len, add);
+	}
+	// Called with lock held.
+	bool readConfig(File &f, const Scene &scene, uint8_t *out) {
+		return f.seek(scene.offset) && f.read(out, scene.length) == scene.length;
+	}
+	// Called with lock held. Scenes whose config can't be read back are left out.
+	void serialize(std::vector<uint8_t> &out) {
+		LibraryHeader header{ magic, version, 0 };
+		out.assign((const uint8_t *)&header, (const uint8_t *)(&header + 1));
+		File f = file.open();
+		for(auto &scene : scenes) {
+			auto start = out.size();
+			out.push_back(scene.name.size());
+			out.insert(out.end(), scene.name.begin(), scene.name.end());
+			out.resize(ConfigFormat::padded(out.size()));
+			uint32_t configLength = scene.config.empty() ? scene.length : scene.config.size();
+			auto lengthBytes = (const uint8_t *)&configLength;
+			out.insert(out.end(), lengthBytes, lengthBytes + sizeof(configLength));
+			if(!scene.config.empty()) {
+				out.insert(out.end(), scene.config.begin(), scene.config.end());
+			} else {
+				out.resize(out.size() + configLength);
+				if(!f || !readConfig(f, scene, out.data() + out.size() - configLength)) {
+					out.resize(start);
+					continue;
+				}
+			}
+			out.resize(ConfigFormat::padded(out.size()));
+			header.sceneCount++;
+		}
+		memcpy(out.data(), &header, sizeof(header));
+	}
+	void persist() {
+		std::vector<uint8_t> data;
+		serialize(data);
+		store.save(data.data(), data.size());
+	}
+	// Runs on the persist task. Points the index at the configs in the new file, and drops the
+	// copies in RAM that it now holds. A newer save's file may still be pending, so scenes it
+	// doesn't hold yet keep their copy; those without one are gone from the file and the index.
+	bool write(const uint8_t *data, size_t len) {
+		std::lock_guard<std::mutex> guard(lock);
+		if(!file.write(data, len)) return false;
+		std::vector<bool> stored(scenes.size());
+		auto update = [this, data, &stored](std::string &name, uint32_t offset, uint32_t length) {
+			auto scene = find(name);
+			if(scene == scenes.end() || scene->name != name) return;
+			if(!scene->config.empty()) {
+				if(scene->config.size() != length) return;
+				if(memcmp(scene->config.data(), data + offset, length)) return;
+				std::vector<uint8_t>().swap(scene->config);
+			}
+			scene->offset = offset;
+			scene->length = length;
+			stored[scene - scenes.begin()] = true;
+		};
+		forEachScene(data, len, update);
+		for(size_t i = scenes.size(); i-- > 0;) {
+			if(!stored[i] && scenes[i].config.empty()) scenes.erase(scenes.begin() + i);
+		}
+		return true;
+	}
+
+public:
+	SceneLibrary(fs::FS &fs)
+	: file(fs, "/scenes.bin", "/scenes.bin.tmp"),
+	  store([this](const uint8_t *data, size_t len) { return write(data, len); }) {
+	}
+	// SPIFFS has to be mounted.
+	void begin() {
+		std::vector<uint8_t> data;
+		File f = file.open();
+		if(f) {
+			data.resize(f.size());
+			if(f.read(data.data(), data.size()) != data.size() || !parse(data.data(), data.size())) {
+				Serial.println("Couldn't load /scenes.bin");
+			}
+		}
+		store.begin(data.data(), data.size());
+	}
+	static bool validName(const char *name) {
+		return name && *name && strlen(name) <= SCENE_NAME_LENGTH;
+	}
+	// Saving needs the running config, which belongs to loop(): the WebSocket handler only queues
+	// the name and loop() takes it with takeQueuedSave().
+	void queueSave(const char *name) {
+		std::lock_guard<std::mutex> guard(lock);
+		queuedSave = name;
+	}
+	bool takeQueuedSave(std::string &name) {
+		std::lock_guard<std::mutex> guard(lock);
+		if(queuedSave.empty()) return false;
+		name.swap(queuedSave);
+		queuedSave.clear();
+		return true;
+	}
+	bool save(const std::string &name, const std::vector<uint8_t> &config) {
+		if(config.empty() || config.size() > SCENE_CONFIG_MAX) return false;
+		std::lock_guard<std::mutex> guard(lock);
+		auto scene = find(name);
+		if(scene != scenes.end() && scene->name == name) {
+			// Unchanged content is never written, which would leave the copy in RAM for good.
+			if(scene->config.empty() && scene->length == config.size()) {
+				std::vector<uint8_t> stored(scene->length);
+				File f = file.open();
+				if(f && readConfig(f, *scene, stored.data()) && stored == config) return true;
+			}
+			scene->config = config;
+		} else if(scenes.size() < SCENE_MAX) {
+			scenes.insert(scene, Scene{ name, 0, 0, config });
+		} else {
+			return false;
+		}
+		persist();
+		return true;
+	}
+	bool remove(const std::string &name) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto scene = find(name);
+		if(scene == scenes.end() || scene->name != name) return false;
+		scenes.erase(scene);
+		persist();
+		return true;
+	}
+	// Copies the scene's config, as saved by save(), into config.
+	bool get(const std::string &name, std::vector<uint8_t> &config) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto scene = find(name);
+		if(scene == scenes.end() || scene->name != name) return false;
+		if(!scene->config.empty()) {
+			config = scene->config;
+			return true;
+		}
+		File f = file.open();
+		config.resize(scene->length);
+		return f && readConfig(f, *scene, config.data());
+	}
+	PersistenceStats getPersistenceStats() const {
+		return store.getStats();
+	}
+	void toJson(JsonDocument &doc) {
+		std::lock_guard<std::mutex> guard(lock);
+		doc["type"] = "scenes";
+		auto names = doc.createNestedArray("scenes");
+		for(auto &scene : scenes) {
+			names.add(scene.name);
+		}
+	}
+};
@@ -0,0 +1,103 @@
+#include "ServeEmbedded.h"
+#include "Metrics.h"
+#include "ServeStatic.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#if EMBEDDED_FRONTEND
+ServeEmbedded::ServeEmbedded(const char *uri, const char *path) : _uri(uri), _path(path), _default_file("index.html")
+{
+	// The same normalization as ServeStatic: a leading '/' and no trailing one.
+	if (_uri.length() == 0 || _uri[0] != '/')
+		_uri = "/" + _uri;
+	if (_path.length() == 0 || _path[0] != '/')
+		_path = "/" + _path;
+	if (_uri[_uri.length() - 1] == '/')
+		_uri = _uri.substring(0, _uri.length() - 1);
+	if (_path[_path.length() - 1] == '/')
+		_path = _path.substring(0, _path.length() - 1);
+}
+
+ServeEmbedded &ServeEmbedded::setDefaultFile(const char *filename)
+{
+	_default_file = String(filename);
+	return *this;
+}
+
+ServeEmbedded &ServeEmbedded::setCacheControl(const char *cache_control)
+{
+	_cache_control = String(cache_control);
+	return *this;
+}
+
+const EmbeddedFile *ServeEmbedded::find(const char *url)
+{
+	auto end = embeddedFiles + embeddedFileCount;
+	auto file = std::lower_bound(embeddedFiles, end, url, [](const EmbeddedFile &f, const char *url) { return strcmp(f.url, url) < 0; });
+	if (file == end || strcmp(file->url, url) != 0)
+		return nullptr;
+	return file;
+}
+
+const EmbeddedFile *ServeEmbedded::_getFile(AsyncWebServerRequest *request) const
+{
+	String path = _path + (request->url().c_str() + _uri.length());
+	if (path.length() && !path.endsWith("/"))
+	{
+		if (auto file = find(path.c_str()))
+			return file;
+	}
+	if (_default_file.length() == 0)
+		return nullptr;
+	if (!path.endsWith("/"))
+		path += "/";
+	return find((path + _default_file).c_str());
+}
+
+bool ServeEmbedded::canHandle(AsyncWebServerRequest *request)
+{
+	if (request->method() != HTTP_GET || !request->url().startsWith(_uri) || !request->isExpectedRequestedConnType(RCT_DEFAULT, RCT_HTTP))
+		return false;
+	if (!_getFile(request))
+		return false;
+	request->addInterestingHeader("Accept-Encoding");
+	request->addInterestingHeader("If-None-Match");
+	return true;
+}
+
+void ServeEmbedded::handleRequest(AsyncWebServerRequest *request)
+{
+	TRACE_SCOPE("ServeEmbedded::handleRequest");
+	const EmbeddedFile *file = _getFile(request);
+	if (!file)
+	{
+		Metrics::increment(Metrics::Metric::StaticMisses);
+		return request->send(404);
+	}
+	int quality[(uint8_t)ServeStatic::Encoding::Count];
+	ServeStatic::encodingQualities(request->header("Accept-Encoding"), quality);
+	if (file->gzip && quality[(uint8_t)ServeStatic::Encoding::Gzip] <= 0)
+	{
+		// Only the compressed copy is embedded.
+		Metrics::increment(Metrics::Metric::StaticMisses);
+		return request->send(406);
+	}
+	Metrics::increment(Metrics::Metric::StaticHits);
+	String ifNoneMatch = request->header("If-None-Match");
+	AsyncWebServerResponse *response;
+	if (ifNoneMatch == "*" || (ifNoneMatch.length() && ifNoneMatch.indexOf(file->etag) != -1))
+	{
+		response = new AsyncBasicResponse(304); // Not modified
+	}
+	else
+	{
+		response = request->beginResponse_P(200, file->contentType, file->data, file->size);
+		if (file->gzip)
+			response->addHeader("Content-Encoding", "gzip");
+	}
+	if (_cache_control.length())
+		response->addHeader("Cache-Control", _cache_control);
+	response->addHeader("ETag", file->etag);
+	request->send(response);
+}
+#endif
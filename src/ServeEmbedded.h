@@ -0,0 +1,43 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Builds with the frontend compiled into the firmware image by scripts/embed_frontend.py, served by
+// ServeEmbedded instead of ServeStatic. A firmware update then updates the UI along with it.
+#ifndef EMBEDDED_FRONTEND
+#define EMBEDDED_FRONTEND 0
+#endif
+
+struct EmbeddedFile
+{
+	const char *url; // relative to www, starting with '/'
+	const char *contentType;
+	const char *etag; // quoted content hash, like the asset manifest's
+	const uint8_t *data;
+	uint32_t size;
+	bool gzip; // whether data is gzip-compressed
+};
+
+// Generated, sorted by url.
+extern const EmbeddedFile embeddedFiles[];
+extern const size_t embeddedFileCount;
+
+// Like ServeStatic, but for the files in embeddedFiles. They are sent straight from memory-mapped
+// flash, and everything a response needs besides the body is in the table already.
+class ServeEmbedded : public AsyncWebHandler
+{
+	String _uri;
+	String _path;
+	String _default_file;
+	String _cache_control;
+
+	const EmbeddedFile *_getFile(AsyncWebServerRequest *request) const;
+
+public:
+	ServeEmbedded(const char *uri, const char *path);
+	virtual bool canHandle(AsyncWebServerRequest *request) override final;
+	virtual void handleRequest(AsyncWebServerRequest *request) override final;
+	ServeEmbedded &setDefaultFile(const char *filename);
+	ServeEmbedded &setCacheControl(const char *cache_control);
+	static const EmbeddedFile *find(const char *url);
+};
@@ -1,6 +1,16 @@
 #include "ServeStatic.h"
-ServeStatic::ServeStatic(const char *uri, FS &fs, const char *path)
-	: _fs(fs), _uri(uri), _path(path), _default_file("index.htm"), _cache_control(""), _last_modified(""), _callback(nullptr)
+#include "Metrics.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+// Indexed by ServeStatic::Encoding.
+static const char *const encodingNames[] = {"identity", "gzip", "br"};
+static const char *const encodingSuffixes[] = {"", ".gz", ".br"};
+
+ServeStatic::ServeStatic(const char *uri, FS &fs, const char *path, const char *exclude)
+	: _fs(fs), _uri(uri), _path(path), _default_file("index.htm"), _cache_control(""), _callback(nullptr)
 {
 	// Ensure leading '/'
 	if (_uri.length() == 0 || _uri[0] != '/')
@@ -18,10 +28,14 @@ ServeStatic::ServeStatic(const char *uri, FS &fs, const char *path)
 		_uri = _uri.substring(0, _uri.length() - 1);
 	if (_path[_path.length() - 1] == '/')
 		_path = _path.substring(0, _path.length() - 1);
+	// Index urls keep the leading '/'
+	if (exclude && *exclude)
+		_exclude = std::string(*exclude == '/' ? "" : "/") + exclude;
 
-	// Reset stats
-	_gzipFirst = false;
-	_gzipStats = 0xF8;
+	File root = _fs.open(_path.length() ? _path : "/");
+	if (root && root.isDirectory())
+		_addToIndex(root);
+	_index.shrink_to_fit();
 }
 
 ServeStatic &ServeStatic::setIsDir(bool isDir)
@@ -42,116 +56,12 @@ ServeStatic &ServeStatic::setCacheControl(const char *cache_control)
 	return *this;
 }
 
-ServeStatic &ServeStatic::setLastModified(const char *last_modified)
-{
-	_last_modified = String(last_modified);
-	return *this;
-}
-
-bool ServeStatic::canHandle(AsyncWebServerRequest *request)
-{
-	if (request->method() != HTTP_GET || !request->url().startsWith(_uri) || !request->isExpectedRequestedConnType(RCT_DEFAULT, RCT_HTTP))
-	{
-		return false;
-	}
-	if (_getFile(request))
-	{
-		// We interested in "If-Modified-Since" header to check if file was modified
-		if (_last_modified.length())
-			request->addInterestingHeader("If-Modified-Since");
-
-		if (_cache_control.length())
-			request->addInterestingHeader("If-None-Match");
-
-		DEBUGF("[ServeStatic::canHandle] TRUE\n");
-		return true;
-	}
-
-	return false;
-}
-
-bool ServeStatic::_getFile(AsyncWebServerRequest *request)
-{
-	// Remove the found uri
-	String path = request->url().substring(_uri.length());
-
-	// We can skip the file check and look for default if request is to the root of a directory or that request path ends with '/'
-	bool canSkipFileCheck = (_isDir && path.length() == 0) || (path.length() && path[path.length() - 1] == '/');
-
-	path = _path + path;
-
-	// Do we have a file or .gz file
-	if (!canSkipFileCheck && _fileExists(request, path))
-		return true;
-
-	// Can't handle if not default file
-	if (_default_file.length() == 0)
-		return false;
-
-	// Try to add default file, ensure there is a trailing '/' ot the path.
-	if (path.length() == 0 || path[path.length() - 1] != '/')
-		path += "/";
-	path += _default_file;
-
-	return _fileExists(request, path);
-}
-
 #ifdef ESP32
 #define FILE_IS_REAL(f) (f == true && !f.isDirectory())
 #else
 #define FILE_IS_REAL(f) (f == true)
 #endif
 
-bool ServeStatic::_fileExists(AsyncWebServerRequest *request, const String &path)
-{
-	bool fileFound = false;
-	bool gzipFound = false;
-	bool acceptsGzip = false;
-
-	String gzip = path + ".gz";
-	const String *selected = &path;
-	if (request->hasHeader("Accept-Encoding"))
-	{
-		AsyncWebHeader *h = request->getHeader("Accept-Encoding");
-		acceptsGzip = h->value().indexOf("gzip") != -1;
-	}
-	if (acceptsGzip)
-	{
-		request->_tempFile = _fs.open(gzip, "r");
-		gzipFound = FILE_IS_REAL(request->_tempFile);
-	}
-	if (!gzipFound)
-	{
-		request->_tempFile = _fs.open(path, "r");
-		fileFound = FILE_IS_REAL(request->_tempFile);
-	}
-	else
-	{
-		selected = &gzip;
-	}
-
-	bool found = fileFound || gzipFound;
-
-	if (found)
-	{
-		// Extract the file name from the path and keep it in _tempObject
-		size_t pathLen = selected->length();
-		char *_tempPath = (char *)malloc(pathLen + 1);
-		snprintf(_tempPath, pathLen + 1, "%s", selected->c_str());
-		request->_tempObject = (void *)_tempPath;
-	}
-
-	return found;
-}
-
-uint8_t ServeStatic::_countBits(const uint8_t value) const
-{
-	uint8_t w = value;
-	uint8_t n;
-	for (n = 0; w != 0; n++)
-		w &= w - 1;
-	return n;
-}
 const char *getFileType(String path)
 {
 	if (path.endsWith(".gz") && path.indexOf('.') < path.length() - 3)
@@ -196,46 +106,259 @@ const char *getFileType(String path)
 		return "application/x-gzip";
 	return "text/plain";
 }
-void ServeStatic::handleRequest(AsyncWebServerRequest *request)
+
+// Adds every file below dir outside the excluded subtree, keeping the index sorted. Filesystems
+// without real directories, like SPIFFS, list everything below dir in one go.
+void ServeStatic::_addToIndex(File dir)
 {
-	// Get the filename from request->_tempObject and free it
-	String filename = String((char *)request->_tempObject);
-	free(request->_tempObject);
-	request->_tempObject = NULL;
-	if ((_username != "" && _password != "") && !request->authenticate(_username.c_str(), _password.c_str()))
-		return request->requestAuthentication();
+	for (File file = dir.openNextFile(); file; file = dir.openNextFile())
+	{
+		if (file.isDirectory())
+		{
+			_addToIndex(file);
+			continue;
+		}
+		String name = file.name();
+		if (!name.startsWith(_path + "/"))
+			continue;
+		std::string url = name.c_str() + _path.length();
+		if (_exclude.length() && url.compare(0, _exclude.length(), _exclude) == 0)
+			continue;
+		uint8_t encoding = (uint8_t)Encoding::Count - 1;
+		for (; encoding > 0; encoding--)
+		{
+			if (name.endsWith(encodingSuffixes[encoding]))
+				break;
+		}
+		url.resize(url.size() - strlen(encodingSuffixes[encoding]));
+		auto entry = std::lower_bound(_index.begin(), _index.end(), url, [](const Entry &e, const std::string &url) { return e.url < url; });
+		if (entry == _index.end() || entry->url != url)
+			entry = _index.insert(entry, Entry{url, getFileType(url.c_str()), {}});
+		entry->variants[encoding].exists = true;
+		entry->variants[encoding].size = file.size();
+	}
+}
 
-	if (request->_tempFile == true)
+// The manifest is written by frontend/modules/asset-manifest.ts, and its URLs are relative to the
+// directory it is in. A line whose size doesn't match the indexed file is stale and skipped, so
+// the file goes without an ETag.
+ServeStatic &ServeStatic::setManifest(const char *manifest)
+{
+	String root = manifest;
+	root = root.substring(0, root.lastIndexOf('/'));
+	File file = _fs.open(manifest, "r");
+	if (!FILE_IS_REAL(file))
+		return *this;
+	while (file.available())
 	{
-		String etag = String(request->_tempFile.size());
-		if (_last_modified.length() && _last_modified == request->header("If-Modified-Since"))
+		// url, encoding, size, hash, content type
+		String line = file.readStringUntil('\n');
+		String fields[5];
+		int start = 0;
+		for (auto &field : fields)
 		{
-			request->_tempFile.close();
-			request->send(304); // Not modified
+			int end = line.indexOf('\t', start);
+			if (end == -1)
+				end = line.length();
+			field = line.substring(start, end);
+			start = end + 1;
 		}
-		else if (_cache_control.length() && request->hasHeader("If-None-Match") && request->header("If-None-Match").equals(etag))
+		String path = root + fields[0];
+		if (!path.startsWith(_path + "/"))
+			continue;
+		std::string url = path.c_str() + _path.length();
+		auto entry = std::lower_bound(_index.begin(), _index.end(), url, [](const Entry &e, const std::string &url) { return e.url < url; });
+		if (entry == _index.end() || entry->url != url)
+			continue;
+		for (uint8_t encoding = 0; encoding < (uint8_t)Encoding::Count; encoding++)
 		{
-			request->_tempFile.close();
-			AsyncWebServerResponse *response = new AsyncBasicResponse(304); // Not modified
-			response->addHeader("Cache-Control", _cache_control);
-			response->addHeader("ETag", etag);
-			request->send(response);
+			Variant &variant = entry->variants[encoding];
+			if (fields[1] != encodingNames[encoding] || !variant.exists || variant.size != (uint32_t)fields[2].toInt())
+				continue;
+			variant.etag = std::string("\"") + fields[3].c_str();
+			// Like Apache, the encoding is part of the ETag of a compressed copy.
+			if (encoding != (uint8_t)Encoding::Identity)
+				variant.etag = variant.etag + "-" + encodingNames[encoding];
+			variant.etag += "\"";
+		}
+	}
+	return *this;
+}
+
+const ServeStatic::Entry *ServeStatic::_findEntry(const std::string &url) const
+{
+	auto entry = std::lower_bound(_index.begin(), _index.end(), url, [](const Entry &e, const std::string &url) { return e.url < url; });
+	if (entry == _index.end() || entry->url != url)
+		return nullptr;
+	return &*entry;
+}
+
+const ServeStatic::Entry *ServeStatic::_getFile(AsyncWebServerRequest *request) const
+{
+	// Remove the found uri
+	std::string path = request->url().c_str() + _uri.length();
+
+	// We can skip the file check and look for default if request is to the root of a directory or that request path ends with '/'
+	bool canSkipFileCheck = (_isDir && path.empty()) || (!path.empty() && path.back() == '/');
+
+	if (!canSkipFileCheck)
+	{
+		if (auto entry = _findEntry(path))
+			return entry;
+	}
+
+	// Can't handle if not default file
+	if (_default_file.length() == 0)
+		return nullptr;
+
+	// Try to add default file, ensure there is a trailing '/' ot the path.
+	if (path.empty() || path.back() != '/')
+		path += "/";
+	path += _default_file.c_str();
+
+	return _findEntry(path);
+}
+
+// Without the header only the identity encoding is acceptable; with it, identity is acceptable
+// unless it or "*" is given q=0.
+void ServeStatic::encodingQualities(const String &acceptEncoding, int (&quality)[(uint8_t)Encoding::Count])
+{
+	// -1 until listed
+	std::fill(std::begin(quality), std::end(quality), -1);
+	int wildcard = -1;
+	int start = 0;
+	while (start < (int)acceptEncoding.length())
+	{
+		int end = acceptEncoding.indexOf(',', start);
+		if (end == -1)
+			end = acceptEncoding.length();
+		String coding = acceptEncoding.substring(start, end);
+		start = end + 1;
+		int q = 1000;
+		int params = coding.indexOf(';');
+		if (params != -1)
+		{
+			int value = coding.indexOf("q=", params);
+			if (value != -1)
+				q = (int)(coding.substring(value + 2).toFloat() * 1000 + 0.5f);
+			coding = coding.substring(0, params);
 		}
-		else
+		coding.trim();
+		coding.toLowerCase();
+		if (coding == "*")
+			wildcard = q;
+		for (uint8_t i = 0; i < (uint8_t)Encoding::Count; i++)
 		{
-			AsyncWebServerResponse *response = new AsyncFileResponse(request->_tempFile, "", getFileType(filename), false, _callback);
-			if (_last_modified.length())
-				response->addHeader("Last-Modified", _last_modified);
-			if (_cache_control.length())
-			{
-				response->addHeader("Cache-Control", _cache_control);
-				response->addHeader("ETag", etag);
-			}
-			request->send(response);
+			if (coding == encodingNames[i])
+				quality[i] = q;
 		}
 	}
+	for (uint8_t i = 0; i < (uint8_t)Encoding::Count; i++)
+	{
+		if (quality[i] == -1)
+			quality[i] = i == (uint8_t)Encoding::Identity && wildcard == -1 ? 1 : std::max(wildcard, 0);
+	}
+}
+
+// Picks the smallest copy of the file among the encodings Accept-Encoding gives the highest
+// q-value.
+bool ServeStatic::_chooseEncoding(const Entry &entry, const String &acceptEncoding, Encoding &encoding)
+{
+	int quality[(uint8_t)Encoding::Count];
+	encodingQualities(acceptEncoding, quality);
+	int best = -1;
+	for (uint8_t i = 0; i < (uint8_t)Encoding::Count; i++)
+	{
+		const Variant &variant = entry.variants[i];
+		if (!variant.exists || quality[i] <= 0)
+			continue;
+		if (best == -1 || quality[i] > quality[best] || (quality[i] == quality[best] && variant.size < entry.variants[best].size))
+			best = i;
+	}
+	if (best == -1)
+		return false;
+	encoding = (Encoding)best;
+	return true;
+}
+
+bool ServeStatic::canHandle(AsyncWebServerRequest *request)
+{
+	if (request->method() != HTTP_GET || !request->url().startsWith(_uri) || !request->isExpectedRequestedConnType(RCT_DEFAULT, RCT_HTTP))
+	{
+		return false;
+	}
+	if (_getFile(request))
+	{
+		request->addInterestingHeader("Accept-Encoding");
+		request->addInterestingHeader("If-None-Match");
+
+		DEBUGF("[ServeStatic::canHandle] TRUE\n");
+		return true;
+	}
+
+	return false;
+}
+
+void ServeStatic::handleRequest(AsyncWebServerRequest *request)
+{
+	TRACE_SCOPE("ServeStatic::handleRequest");
+	if ((_username != "" && _password != "") && !request->authenticate(_username.c_str(), _password.c_str()))
+		return request->requestAuthentication();
+
+	// Looked up again rather than passed along from canHandle(): the index doesn't change, so it
+	// can't miss now.
+	const Entry *entry = _getFile(request);
+	if (!entry)
+	{
+		Metrics::increment(Metrics::Metric::StaticMisses);
+		return request->send(404);
+	}
+	Encoding encoding;
+	if (!_chooseEncoding(*entry, request->header("Accept-Encoding"), encoding))
+	{
+		// None of the copies is in an encoding the client takes.
+		Metrics::increment(Metrics::Metric::StaticMisses);
+		return request->send(406);
+	}
+	Metrics::increment(Metrics::Metric::StaticHits);
+	const Variant &variant = entry->variants[(uint8_t)encoding];
+	// Files the manifest doesn't cover get no ETag: one made up from the size alone could match a
+	// different build's file and keep a stale copy in use.
+	const std::string &etag = variant.etag;
+	// Caches have to key on Accept-Encoding when there is more than one copy to pick from.
+	bool vary = std::count_if(std::begin(entry->variants), std::end(entry->variants), [](const Variant &v) { return v.exists; }) > 1;
+	// Compared weakly, as If-None-Match calls for.
+	String ifNoneMatch = request->header("If-None-Match");
+	if (ifNoneMatch == "*" || (etag.length() && ifNoneMatch.length() && ifNoneMatch.indexOf(etag.c_str()) != -1))
+	{
+		AsyncWebServerResponse *response = new AsyncBasicResponse(304); // Not modified
+		if (_cache_control.length())
+			response->addHeader("Cache-Control", _cache_control);
+		if (etag.length())
+			response->addHeader("ETag", etag.c_str());
+		if (vary)
+			response->addHeader("Vary", "Accept-Encoding");
+		request->send(response);
+	}
 	else
 	{
-		request->send(404);
+		String path = _path + entry->url.c_str() + encodingSuffixes[(uint8_t)encoding];
+		File file = _fs.open(path, "r");
+		if (!FILE_IS_REAL(file))
+		{
+			Metrics::increment(Metrics::Metric::StaticMisses);
+			return request->send(404);
+		}
+		// AsyncFileResponse sets Content-Encoding itself for .gz files.
+		AsyncWebServerResponse *response = new AsyncFileResponse(file, "", entry->contentType, false, _callback);
+		if (encoding == Encoding::Brotli)
+			response->addHeader("Content-Encoding", "br");
+		if (_cache_control.length())
+			response->addHeader("Cache-Control", _cache_control);
+		if (etag.length())
+			response->addHeader("ETag", etag.c_str());
+		if (vary)
+			response->addHeader("Vary", "Accept-Encoding");
+		request->send(response);
 	}
 }
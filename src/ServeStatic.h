@@ -1,16 +1,49 @@
+#include "Heap.h"
 #include <Arduino.h>
 #include <ESPAsyncWebServer.h>
 #include <FS.h>
+#include <string>
+#include <vector>
 
+// Serves the files under a directory. The directory is walked once when the handler is created
+// and every request is matched against that index, so looking a URL up never touches the
+// filesystem; files are only opened to send them. Files listed in a manifest from the frontend
+// build get strong ETags from their content hashes, and the rest none.
 class ServeStatic : public AsyncWebHandler
 {
 	using File = fs::File;
 	using FS = fs::FS;
 
+public:
+	// Precompressed copies of a file are stored next to it, named with the encoding's suffix.
+	enum class Encoding : uint8_t
+	{
+		Identity,
+		Gzip,
+		Brotli,
+		Count
+	};
+	struct Variant
+	{
+		bool exists;
+		uint32_t size;
+		std::string etag; // from the manifest
+	};
+	struct Entry
+	{
+		std::string url; // relative to the handler's path, starting with '/'
+		const char *contentType;
+		Variant variants[(uint8_t)Encoding::Count];
+	};
+
 private:
-	bool _getFile(AsyncWebServerRequest *request);
-	bool _fileExists(AsyncWebServerRequest *request, const String &path);
-	uint8_t _countBits(const uint8_t value) const;
+	std::vector<Entry, Heap::Allocator<Entry, HeapTag::Http>> _index;
+	std::string _exclude;
+
+	void _addToIndex(File dir);
+	const Entry *_findEntry(const std::string &url) const;
+	const Entry *_getFile(AsyncWebServerRequest *request) const;
+	static bool _chooseEncoding(const Entry &entry, const String &acceptEncoding, Encoding &encoding);
 
 protected:
 	FS _fs;
@@ -18,23 +51,29 @@ protected:
 	String _path;
 	String _default_file;
 	String _cache_control;
-	String _last_modified;
 	AwsTemplateProcessor _callback;
 	bool _isDir;
-	bool _gzipFirst;
-	uint8_t _gzipStats;
 
 public:
-	ServeStatic(const char *uri, FS &fs, const char *path);
+	// Files under exclude, relative to path, are left out of the index, for a subtree that another
+	// handler serves.
+	ServeStatic(const char *uri, FS &fs, const char *path, const char *exclude = nullptr);
 	virtual bool canHandle(AsyncWebServerRequest *request) override final;
 	virtual void handleRequest(AsyncWebServerRequest *request) override final;
 	ServeStatic &setIsDir(bool isDir);
 	ServeStatic &setDefaultFile(const char *filename);
 	ServeStatic &setCacheControl(const char *cache_control);
-	ServeStatic &setLastModified(const char *last_modified);
+	ServeStatic &setManifest(const char *manifest);
 	ServeStatic &setTemplateProcessor(AwsTemplateProcessor newCallback)
 	{
 		_callback = newCallback;
 		return *this;
 	}
-};
\ No newline at end of file
+	size_t indexSize() const
+	{
+		return _index.size();
+	}
+	// How much the client wants each encoding, from its Accept-Encoding header: in thousandths,
+	// 0 for those it refuses.
+	static void encodingQualities(const String &acceptEncoding, int (&quality)[(uint8_t)Encoding::Count]);
+};
@@ -0,0 +1,129 @@
+#include "Trace.h"
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <string>
+
+namespace {
+struct Event {
+	uint32_t time; // microseconds
+	const char *name;
+	char phase; // 'B' or 'E'
+	uint8_t core;
+	uint8_t task; // index into tasks, TRACE_TASK_MAX for any other task
+};
+struct Task {
+	TaskHandle_t handle;
+	char name[configMAX_TASK_NAME_LEN];
+};
+
+// Events are written from both cores, so the ring is guarded by a spinlock rather than a mutex.
+portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+Event events[TRACE_RING_SIZE];
+uint32_t recorded = 0; // since boot; the next event goes to recorded % TRACE_RING_SIZE
+Task tasks[TRACE_TASK_MAX];
+uint8_t taskCount = 0;
+
+// Called with mux held, from the task itself.
+uint8_t taskIndex(TaskHandle_t handle) {
+	for(uint8_t i = 0; i < taskCount; i++) {
+		if(tasks[i].handle == handle) return i;
+	}
+	if(taskCount == TRACE_TASK_MAX) return TRACE_TASK_MAX;
+	tasks[taskCount].handle = handle;
+	strlcpy(tasks[taskCount].name, pcTaskGetTaskName(handle), sizeof(tasks[taskCount].name));
+	return taskCount++;
+}
+
+void record(const char *name, char phase) {
+	auto task = xTaskGetCurrentTaskHandle();
+	portENTER_CRITICAL(&mux);
+	auto &event = events[recorded++ % TRACE_RING_SIZE];
+	event.time = micros();
+	event.name = name;
+	event.phase = phase;
+	event.core = xPortGetCoreID();
+	event.task = taskIndex(task);
+	portEXIT_CRITICAL(&mux);
+}
+
+// A copy of the ring, written out a line at a time as the response asks for more.
+struct Dump {
+	std::unique_ptr<Event[]> events;
+	size_t count = 0;
+	Task tasks[TRACE_TASK_MAX];
+	uint8_t taskCount = 0;
+	// Header, a name for every task plus the shared track, the events, then the footer.
+	size_t item = 0;
+	std::string line;
+	size_t offset = 0;
+
+	bool nextLine() {
+		char buffer[160];
+		size_t names = taskCount + 1;
+		if(item == 0) {
+			strcpy(buffer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		} else if(item <= names) {
+			auto task = item - 1;
+			snprintf(buffer, sizeof(buffer),
+			         "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+			         "\"args\":{\"name\":\"%s\"}}",
+			         task ? ",\n" : "", task, task < taskCount ? tasks[task].name : "other");
+		} else if(item <= names + count) {
+			auto &event = events[item - names - 1];
+			snprintf(buffer, sizeof(buffer),
+			         ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":0,\"tid\":%u,"
+			         "\"args\":{\"core\":%u}}",
+			         event.name, event.phase, event.time,
+			         event.task < taskCount ? event.task : taskCount, event.core);
+		} else if(item == names + count + 1) {
+			strcpy(buffer, "\n]}\n");
+		} else {
+			return false;
+		}
+		item++;
+		line = buffer;
+		offset = 0;
+		return true;
+	}
+	size_t fill(uint8_t *buffer, size_t maxLen) {
+		size_t len = 0;
+		while(len < maxLen) {
+			if(offset == line.size() && !nextLine()) break;
+			auto chunk = std::min(maxLen - len, line.size() - offset);
+			memcpy(buffer + len, line.data() + offset, chunk);
+			len += chunk;
+			offset += chunk;
+		}
+		return len;
+	}
+};
+} // namespace
+
+namespace Trace {
+void begin(const char *name) {
+	record(name, 'B');
+}
+void end(const char *name) {
+	record(name, 'E');
+}
+void handleRequest(AsyncWebServerRequest *request) {
+	auto dump = std::make_shared<Dump>();
+	dump->events.reset(new(std::nothrow) Event[TRACE_RING_SIZE]);
+	if(!dump->events) return request->send(503);
+	portENTER_CRITICAL(&mux);
+	dump->count = std::min(recorded, (uint32_t)TRACE_RING_SIZE);
+	// Oldest first: once the ring has wrapped, that's the slot written next.
+	auto first = recorded > TRACE_RING_SIZE ? recorded % TRACE_RING_SIZE : 0;
+	std::copy(events + first, events + dump->count, dump->events.get());
+	std::copy(events, events + first, dump->events.get() + dump->count - first);
+	std::copy(tasks, tasks + taskCount, dump->tasks);
+	dump->taskCount = taskCount;
+	portEXIT_CRITICAL(&mux);
+	auto response = request->beginChunkedResponse(
+	"application/json",
+	[dump](uint8_t *buffer, size_t maxLen, size_t) { return dump->fill(buffer, maxLen); });
+	response->addHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+	request->send(response);
+}
+} // namespace Trace
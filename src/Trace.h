@@ -0,0 +1,44 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+// Build with -D TRACE_EVENTS=0 to leave out every trace point.
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 1
+#endif
+// Events kept, 12 bytes each; the oldest are overwritten.
+#define TRACE_RING_SIZE 1024
+// Tasks that get a track of their own; any beyond these share one.
+#define TRACE_TASK_MAX 8
+
+// A timeline of begin/end events from every task on both cores, served as Chrome trace_event JSON
+// that chrome://tracing and Perfetto open as is. Events are tagged with the task and core they
+// were recorded on.
+namespace Trace {
+// Only the pointer is kept, so name has to live forever, like a string literal.
+void begin(const char *name);
+void end(const char *name);
+// Sends the events recorded so far, oldest first.
+void handleRequest(AsyncWebServerRequest *request);
+
+class Scope {
+	const char *name;
+
+public:
+	Scope(const char *name) : name(name) {
+		begin(name);
+	}
+	~Scope() {
+		end(name);
+	}
+};
+} // namespace Trace
+
+#if TRACE_EVENTS
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Traces the rest of the enclosing block.
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
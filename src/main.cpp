@@ -30,87 +30,284 @@ FASTLED_USING_NAMESPACE
 #include <FS.h>
 #include <SPIFFS.h>
 #include <WiFi.h>
+#include "ServeEmbedded.h"
 #include "ServeStatic.h"
 #include "ArduinoJson.h"
 
+#include "Broadcast.h"
+#include "Coalescer.h"
 #include "Configuration.h"
+#include "DecodeArena.h"
 #include "EffectManager.h"
+#include "FrameWatch.h"
+#include "Heap.h"
+#include "MessageAssembler.h"
+#include "Metrics.h"
+#include "Perf.h"
+#include "Playlist.h"
+#include "Power.h"
+#include "Protocol.h"
+#include "SceneLibrary.h"
+#include "Trace.h"
 
 Dusk2Dawn sunTimes(41.481454, -81.566639, 0);
 
 AsyncWebServer server(80);
 AsyncWebSocket ws("/ws");
 #define MILLI_AMPS 80000
-#define FRAMES_PER_SECOND 240
 
 
-AsyncWebSocketMessageBuffer wifiList;
-AsyncWebSocketMessageBuffer effectsList;
-AsyncWebSocketMessageBuffer globalStats;
+Broadcaster broadcaster(ws);
+AsyncWebSocketMessageBuffer effectSchema;
+MessageAssembler messageAssembler;
 
 
-EffectManager effectManager;
+DecodeArena decodeArena;
+EffectManager effectManager(decodeArena);
+SceneLibrary sceneLibrary(SPIFFS);
+Playlist playlist(SPIFFS, sceneLibrary, effectManager);
+PowerLimiter powerLimiter(MILLI_AMPS);
+Heap::Watch heapWatch;
+FrameWatch frameWatch;
 Preferences prefs;
 
 uint8_t brightness = 30;
 enum class LightStat { OFF, ON, ON_INIT };
 LightStat lightStat = LightStat::ON_INIT;
 bool followSun = true;
-void updateGlobalStats() {
+
+// Changes take effect on the next frame; broadcasting them is capped to BROADCAST_INTERVAL and
+// writing them to flash waits until they have settled for SETTLE_DELAY.
+#define BROADCAST_INTERVAL 100
+#define SETTLE_DELAY 2000
+Throttle globalStatsBroadcast(BROADCAST_INTERVAL);
+Debounce globalStatsSave(SETTLE_DELAY);
+Throttle configBroadcast(BROADCAST_INTERVAL);
+Debounce configSave(SETTLE_DELAY);
+
+void publishGlobalStats() {
 	StaticJsonDocument<256> doc;
 	doc["type"] = "globalStats";
 	doc["brightness"] = brightness;
 	doc["on"] = lightStat != LightStat::OFF;
 	doc["followSun"] = followSun;
+	doc["powerBudget"] = powerLimiter.getBudget();
+	broadcaster.publish(BroadcastChannel::GlobalStats, doc);
+}
+void saveGlobalStats() {
 	prefs.putUChar("brightness", brightness);
 	prefs.putBool("followSun", followSun);
-	size_t len = measureMsgPack(doc);
-	if(globalStats.reserve(len)) {
-		serializeMsgPack(doc, (char *)globalStats.get(), len + 1);
-		ws.binaryAll(&globalStats);
+	prefs.putUInt("powerBudget", powerLimiter.getBudget());
+}
+void updateGlobalStats() {
+	globalStatsBroadcast.touch();
+	globalStatsSave.touch(millis());
+}
+void publishScenes() {
+	TaggedJsonDocument doc(JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(SCENE_MAX) +
+	                       SCENE_MAX * (SCENE_NAME_LENGTH + 1));
+	sceneLibrary.toJson(doc);
+	broadcaster.publish(BroadcastChannel::Scenes, doc);
+}
+void publishPlaylist() {
+	TaggedJsonDocument doc(PLAYLIST_JSON_SIZE);
+	playlist.toJson(doc);
+	broadcaster.publish(BroadcastChannel::Playlist, doc);
+}
+void publishPower() {
+	TaggedJsonDocument doc(JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(STRIP_MAX) +
+	                       STRIP_MAX * JSON_OBJECT_SIZE(3));
+	powerLimiter.toJson(doc, Configuration::strips, brightness);
+	broadcaster.publish(BroadcastChannel::Power, doc);
+}
+void publishFrames() {
+	TaggedJsonDocument doc(JSON_OBJECT_SIZE(6) + JSON_OBJECT_SIZE((uint8_t)OverrunCause::Count) +
+	                       JSON_ARRAY_SIZE(FRAME_HISTOGRAM_BUCKETS) + JSON_ARRAY_SIZE(STRIP_MAX) +
+	                       STRIP_MAX * JSON_OBJECT_SIZE(3));
+	frameWatch.toJson(doc, Configuration::strips);
+	broadcaster.publish(BroadcastChannel::Frames, doc);
+}
+#if PERF_STATS
+void publishPerfStats() {
+	TaggedJsonDocument doc(JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE((uint8_t)PerfStage::Count) +
+	                       ((uint8_t)PerfStage::Count + STRIP_MAX) * JSON_OBJECT_SIZE(3) +
+	                       JSON_ARRAY_SIZE(STRIP_MAX) + JSON_ARRAY_SIZE(PERF_HISTOGRAM_BUCKETS) +
+	                       HEAP_JSON_SIZE);
+	perf.toJson(doc, Configuration::strips.size());
+	heapWatch.toJson(doc.createNestedObject("heap"));
+	broadcaster.publish(BroadcastChannel::PerfStats, doc);
+}
+#endif
+void publishConfig() {
+	auto buf = effectManager.getSerializedConfig();
+	if(buf->length()) {
+		broadcaster.publish(BroadcastChannel::Config, buf->get(), buf->length());
 	}
 }
-void handleMessage(JsonObjectConst doc) {
-	auto type = doc["type"].as<const char *>();
-	if(!type) return;
-	if(strcmp(type, "removeEffect") == 0) {
-		auto stripName = doc["strip"].as<const char *>();
-		auto effectName = doc["effect"].as<const char *>();
-		if(!stripName || !effectName) return;
-		for(auto &strip : Configuration::strips) {
-			if(strcmp(strip.name, stripName) != 0) continue;
-			for(auto &effect : Configuration::effects) {
-				if(strcmp(effect.name, effectName) != 0) continue;
-				effectManager.removeEffectConfig(&strip - &Configuration::strips[0],
-				                                 &effect - &Configuration::effects[0]);
-				effectManager.serializeConfig();
-				effectManager.saveConfig();
-				break;
-			}
-			break;
+template <uint8_t... Pins> void addPins(JsonArray pins, Configuration::PinList<Pins...>) {
+	for(uint8_t pin : { Pins... }) {
+		pins.add(pin);
+	}
+}
+// The effect schema only depends on Configuration, so it is built once at boot and the same
+// buffer is handed to every connecting client. It also advertises the numeric IDs that clients
+// can use in place of names.
+void buildEffectSchema() {
+	TaggedJsonDocument doc(6144);
+	doc["type"] = "effectConfig";
+	auto types = doc.createNestedObject("messageTypes");
+	for(auto i = 0; i < (uint8_t)MessageType::Count; i++) {
+		types[messageTypeNames[i]] = i;
+	}
+	JsonArray strips = doc.createNestedArray("strips");
+	for(auto &strip : Configuration::strips) {
+		auto stripInfo = strips.createNestedObject();
+		stripInfo["id"] = &strip - &Configuration::strips[0];
+		stripInfo["name"] = strip.name;
+		stripInfo["length"] = strip.settings.length;
+		stripInfo["pin"] = strip.settings.pin;
+		stripInfo["chipset"] = stripChipsetNames[(uint8_t)strip.settings.chipset];
+		stripInfo["order"] = stripOrderNames[(uint8_t)strip.settings.order];
+		stripInfo["hdr"] = (bool)(strip.settings.flags & STRIP_HDR);
+		stripInfo["maxMilliamps"] = strip.settings.maxMilliamps;
+	}
+	auto stripOptions = doc.createNestedObject("stripOptions");
+	stripOptions["pixels"] = PIXEL_ARENA_SIZE;
+	stripOptions["maxStrips"] = STRIP_MAX;
+	addPins(stripOptions.createNestedArray("pins"), Configuration::StripPins());
+	auto chipsets = stripOptions.createNestedArray("chipsets");
+	for(auto name : stripChipsetNames) {
+		chipsets.add(name);
+	}
+	auto orders = stripOptions.createNestedArray("orders");
+	for(auto name : stripOrderNames) {
+		orders.add(name);
+	}
+	JsonArray data = doc.createNestedArray("effects");
+	for(auto &effect : Configuration::effects) {
+		auto network = data.createNestedObject();
+		network["id"] = &effect - &Configuration::effects[0];
+		network["name"] = effect.name;
+		auto config = network.createNestedArray("config");
+		for(auto i = 0; i < effect.configLength; i++) {
+			auto configuration = config.createNestedObject();
+			configuration["id"] = i;
+			effect.config[i].toJson(configuration);
 		}
-	} else if(strcmp(type, "updateEffect") == 0) {
-		if(!doc["config"].is<JsonObject>()) return;
-		auto stripName = doc["strip"].as<const char *>();
-		auto effectName = doc["effect"].as<const char *>();
-		if(!stripName || !effectName) return;
-		for(auto &strip : Configuration::strips) {
-			if(strcmp(strip.name, stripName) != 0) continue;
-			for(auto &effect : Configuration::effects) {
-				if(strcmp(effect.name, effectName) != 0) continue;
-				effectManager.updateEffectConfig(&strip - &Configuration::strips[0],
-				                                 &effect - &Configuration::effects[0],
-				                                 doc["config"].as<JsonObjectConst>());
-				effectManager.serializeConfig();
-				effectManager.saveConfig();
-				return;
-			}
+	}
+	size_t len = measureMsgPack(doc);
+	if(effectSchema.reserve(len)) {
+		serializeMsgPack(doc, (char *)effectSchema.get(), len + 1);
+	}
+}
+void handleRemoveEffect(JsonObjectConst doc) {
+	auto stripIndex = resolveId(doc["strip"], Configuration::strips);
+	auto effectIndex = resolveId(doc["effect"], Configuration::effects);
+	if(stripIndex >= Configuration::strips.size() || effectIndex >= Configuration::effectCount) return;
+	effectManager.queueRemoveEffect(stripIndex, effectIndex);
+}
+void handleUpdateEffect(JsonObjectConst doc) {
+	auto config = doc["config"];
+	if(!config.is<JsonObject>() && !config.is<JsonArray>()) return;
+	auto stripIndex = resolveId(doc["strip"], Configuration::strips);
+	auto effectIndex = resolveId(doc["effect"], Configuration::effects);
+	if(stripIndex >= Configuration::strips.size() || effectIndex >= Configuration::effectCount) return;
+	effectManager.queueEffectConfig(stripIndex, effectIndex, config);
+}
+void handleSaveScene(JsonObjectConst doc) {
+	auto name = doc["name"].as<const char *>();
+	if(!SceneLibrary::validName(name)) return;
+	sceneLibrary.queueSave(name);
+}
+// The scene's effects are built here, on the AsyncTCP task, so the render loop only swaps them in.
+void handleRecallScene(JsonObjectConst doc) {
+	auto name = doc["name"].as<const char *>();
+	if(!SceneLibrary::validName(name)) return;
+	auto start = micros();
+	std::vector<uint8_t> config;
+	if(sceneLibrary.get(name, config) && effectManager.queueEffectSet(config.data(), config.size())) {
+		Serial.printf("Scene %s staged in %uus\n", name, micros() - start);
+	}
+}
+void handleDeleteScene(JsonObjectConst doc) {
+	auto name = doc["name"].as<const char *>();
+	if(!SceneLibrary::validName(name)) return;
+	if(sceneLibrary.remove(name)) {
+		publishScenes();
+	}
+}
+void handleSetPlaylist(JsonObjectConst doc) {
+	playlist.set(doc);
+	publishPlaylist();
+}
+void handleBeat(JsonObjectConst doc) {
+	playlist.beat();
+}
+// FastLED can't drop a controller once it's added, so new strip settings are saved and applied
+// by restarting.
+uint32_t restartRequestedAt = 0;
+void handleSetStrips(JsonObjectConst doc) {
+	StripSettings settings[STRIP_MAX] = {};
+	size_t count = 0;
+	for(JsonObjectConst strip : doc["strips"].as<JsonArrayConst>()) {
+		if(count == STRIP_MAX) return;
+		auto &entry = settings[count++];
+		strlcpy(entry.name, strip["name"] | "", sizeof(entry.name));
+		if(!readInteger(strip["length"], entry.length) || !readInteger(strip["pin"], entry.pin) ||
+		   !readInteger(strip["maxMilliamps"], entry.maxMilliamps)) {
+			return;
 		}
-	} else if(strcmp(type, "updateGlobal") == 0) {
-		brightness = doc["brightness"] | brightness;
-		lightStat = (doc["on"] | (lightStat != LightStat::OFF)) ? LightStat::ON : LightStat::OFF;
-		followSun = doc["followSun"] | followSun;
-		updateGlobalStats();
+		entry.chipset = (StripChipset)resolveId(strip["chipset"], stripChipsetNames);
+		entry.order = (StripOrder)resolveId(strip["order"], stripOrderNames);
+		entry.flags = strip["hdr"] ? STRIP_HDR : 0;
+	}
+	if(!Configuration::validStrips(settings, count)) return;
+	auto len = count * sizeof(*settings);
+	if(prefs.putBytes("strips", settings, len) == len) {
+		restartRequestedAt = millis();
+	}
+}
+void handleUpdateGlobal(JsonObjectConst doc) {
+	brightness = doc["brightness"] | brightness;
+	lightStat = (doc["on"] | (lightStat != LightStat::OFF)) ? LightStat::ON : LightStat::OFF;
+	followSun = doc["followSun"] | followSun;
+	powerLimiter.setBudget(doc["powerBudget"] | powerLimiter.getBudget());
+	updateGlobalStats();
+}
+using MessageHandler = void (*)(JsonObjectConst doc);
+// Indexed by MessageType.
+const MessageHandler messageHandlers[] = { handleRemoveEffect, handleUpdateEffect, handleUpdateGlobal,
+	                                       handleSaveScene,    handleRecallScene,  handleDeleteScene,
+	                                       handleSetPlaylist,  handleBeat,         handleSetStrips };
+static_assert(sizeof(messageHandlers) / sizeof(*messageHandlers) == (uint8_t)MessageType::Count,
+              "every message type needs a handler");
+void handleMessage(JsonObjectConst doc) {
+	TRACE_SCOPE("handleMessage");
+	auto type = resolveId(doc["type"], messageTypeNames);
+	if(type < (uint8_t)MessageType::Count) {
+		messageHandlers[type](doc);
+	}
+}
+
+void sendError(AsyncWebSocketClient *client, const char *error) {
+	StaticJsonDocument<JSON_OBJECT_SIZE(2)> doc;
+	doc["type"] = "error";
+	doc["error"] = error;
+	char buffer[64];
+	size_t len = serializeMsgPack(doc, buffer, sizeof(buffer));
+	client->binary(buffer, len);
+	Metrics::increment(Metrics::Metric::MessagesOut);
+}
+// Decodes in place: data must stay valid until handleMessage() returns.
+void decodeMessage(AsyncWebSocketClient *client, uint8_t *data, size_t len) {
+	DeserializationError err = decodeArena.decode((char *)data, len);
+	if(err == DeserializationError::Ok) {
+		Metrics::increment(Metrics::Metric::MessagesIn);
+		handleMessage(decodeArena.root());
+	} else if(err == DeserializationError::NoMemory) {
+		sendError(client, "messageTooComplex");
+	} else {
+		sendError(client, err.c_str());
 	}
 }
 
@@ -118,38 +315,16 @@ void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventTyp
 	if(type == WS_EVT_CONNECT) {
 		Serial.printf("ws[%s][%u] connect\n", server->url(), client->id());
 		client->printf("Hello Client %u :)", client->id());
-		if(wifiList.length()) {
-			client->binary(&wifiList);
-		}
-		if(globalStats.length()) {
-			client->binary(&globalStats);
-		}
-		auto buf = effectManager.getSerializedConfig();
-		if(buf->length()) {
-			client->binary(buf);
-		}
-		// TODO
-		DynamicJsonDocument doc(2048);
-		doc["type"] = "effectConfig";
-		JsonArray data = doc.createNestedArray("effects");
-		for(auto effect : Configuration::effects) {
-			auto network = data.createNestedObject();
-			network["name"] = effect.name;
-			auto config = network.createNestedArray("config");
-			for(auto i = 0; i < effect.configLength; i++) {
-				auto configuration = config.createNestedObject();
-				effect.config[i].toJson(configuration);
-			}
-		}
-		size_t len = measureMsgPack(doc);
-		AsyncWebSocketMessageBuffer *buffer = ws.makeBuffer(len);
-		if(buffer) {
-			serializeMsgPack(doc, (char *)buffer->get(), len + 1);
-			client->binary(buffer);
+		broadcaster.addClient(client->id());
+		if(effectSchema.length()) {
+			client->binary(&effectSchema);
+			Metrics::increment(Metrics::Metric::MessagesOut);
 		}
 		client->ping();
 	} else if(type == WS_EVT_DISCONNECT) {
 		Serial.printf("ws[%s][%u] disconnect\n", server->url(), client->id());
+		broadcaster.removeClient(client->id());
+		messageAssembler.release(client->id());
 	} else if(type == WS_EVT_ERROR) {
 		Serial.printf("ws[%s][%u] error(%u): %s\n", server->url(), client->id(), *((uint16_t *)arg),
 		              (char *)data);
@@ -157,81 +332,45 @@ void onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventTyp
 		Serial.printf("ws[%s][%u] pong[%u]: %s\n", server->url(), client->id(), len, (len) ? (char *)data : "");
 	} else if(type == WS_EVT_DATA) {
 		AwsFrameInfo *info = (AwsFrameInfo *)arg;
-		String msg = "";
-		if(info->final && info->index == 0 && info->len == len) {
+		if(info->final && info->num == 0 && info->index == 0 && info->len == len) {
 			// the whole message is in a single frame and we got all of it's data
-			Serial.printf("ws[%s][%u] %s-message[%llu]: ", server->url(), client->id(),
+			Serial.printf("ws[%s][%u] %s-message[%llu]\n", server->url(), client->id(),
 			              (info->opcode == WS_TEXT) ? "text" : "binary", info->len);
-
-			if(info->opcode == WS_TEXT) {
-				for(size_t i = 0; i < info->len; i++) {
-					Serial.print((char)data[i]);
-				}
-			} else {
-				for(size_t i = 0; i < info->len; i++) {
-					Serial.printf("%02x ", (uint8_t)data[i]);
-				}
-				auto storageSize = 2048;
-				DynamicJsonDocument doc(storageSize);
-				DeserializationError err = DeserializationError::InvalidInput;
-				do {
-					err = deserializeMsgPack(doc, data, info->len);
-					if(err == DeserializationError::NoMemory) {
-						storageSize *= 2;
-						if(storageSize > 1048576) {
-							break;
-						}
-						doc = DynamicJsonDocument(storageSize);
-						if(!doc.size()) {
-							break;
-						}
-					}
-				} while(err == DeserializationError::NoMemory);
-				if(err == DeserializationError::Ok) {
-					handleMessage(doc.as<JsonObjectConst>());
-				}
+			if(info->opcode == WS_BINARY) {
+				decodeMessage(client, data, len);
 			}
-			Serial.println();
-		} else {
+		} else if(info->message_opcode == WS_BINARY) {
 			// message is comprised of multiple frames or the frame is split into multiple packets
-			if(info->index == 0) {
-				if(info->num == 0)
-					Serial.printf("ws[%s][%u] %s-message start\n", server->url(), client->id(),
-					              (info->message_opcode == WS_TEXT) ? "text" : "binary");
-				Serial.printf("ws[%s][%u] frame[%u] start[%llu]\n", server->url(), client->id(),
-				              info->num, info->len);
-			}
-
-			Serial.printf("ws[%s][%u] frame[%u] %s[%llu - %llu]: ", server->url(), client->id(),
-			              info->num, (info->message_opcode == WS_TEXT) ? "text" : "binary",
-			              info->index, info->index + len);
-
-			if(info->opcode == WS_TEXT) {
-				for(size_t i = 0; i < len; i++) {
-					msg += (char)data[i];
-				}
-			} else {
-				char buff[3];
-				for(size_t i = 0; i < len; i++) {
-					sprintf(buff, "%02x ", (uint8_t)data[i]);
-					msg += buff;
-				}
-			}
-			Serial.printf("%s\n", msg.c_str());
-
-			if((info->index + len) == info->len) {
-				Serial.printf("ws[%s][%u] frame[%u] end[%llu]\n", server->url(), client->id(),
-				              info->num, info->len);
-				if(info->final) {
-					Serial.printf("ws[%s][%u] %s-message end\n", server->url(), client->id(),
-					              (info->message_opcode == WS_TEXT) ? "text" : "binary");
-					if(info->message_opcode == WS_TEXT) client->text("I got your text message");
-				}
+			uint8_t *message;
+			size_t messageLen;
+			auto result = messageAssembler.append(client->id(), info, data, len, message, messageLen);
+			if(result == MessageAssembler::Result::Complete) {
+				Serial.printf("ws[%s][%u] binary-message[%u] reassembled\n", server->url(), client->id(),
+				              messageLen);
+				decodeMessage(client, message, messageLen);
+				messageAssembler.release(client->id());
+			} else if(result == MessageAssembler::Result::TooLarge) {
+				Serial.printf("ws[%s][%u] message larger than %u bytes dropped\n", server->url(),
+				              client->id(), MESSAGE_POOL_SLOT_SIZE);
+				Metrics::increment(Metrics::Metric::MessagesDropped);
+				sendError(client, "messageTooLarge");
+			} else if(result == MessageAssembler::Result::NoBuffer) {
+				Serial.printf("ws[%s][%u] no reassembly buffer free, message dropped\n", server->url(),
+				              client->id());
+				Metrics::increment(Metrics::Metric::MessagesDropped);
+				sendError(client, "busy");
 			}
 		}
 	}
 }
 
+// Only what's needed to light the strips runs in setup(); everything else is brought up one
+// stage per frame from loop() so the first frame isn't held up by SPIFFS or networking.
+enum class BootStage { Config, Network, Server, Services, Done };
+BootStage bootStage = BootStage::Config;
+uint32_t firstFrameTime = 0; // microseconds since reset
+uint32_t savedBootRecordHash = 0;
+
 void setup() {
 	pinMode(14, OUTPUT);
 	digitalWrite(14, HIGH);
@@ -240,40 +379,55 @@ void setup() {
 	prefs.begin("esp32_lighting");
 	brightness = prefs.getUChar("brightness", 30);
 	followSun = prefs.getBool("followSun", true);
-	updateGlobalStats();
+	powerLimiter.setBudget(prefs.getUInt("powerBudget", MILLI_AMPS));
 	delay(100);
 
-	for(const auto strip : Configuration::strips) {
-		strip.init();
+	{
+		StripSettings settings[STRIP_MAX];
+		size_t len = prefs.getBytes("strips", settings, sizeof(settings));
+		size_t count = len / sizeof(*settings);
+		if(len % sizeof(*settings) || !Configuration::validStrips(settings, count)) {
+			Configuration::beginStrips(Configuration::defaultStrips, Configuration::defaultStripCount);
+		} else {
+			Configuration::beginStrips(settings, count);
+		}
 	}
 	FastLED.setDither(true);
-	FastLED.setCorrection(Typical8mmPixel);
-	FastLED.setBrightness(brightness);
-	// FastLED.setMaxPowerInVoltsAndMilliamps(5, MILLI_AMPS);
-	for(const auto strip : Configuration::strips) {
-		fill_solid(strip.data, strip.len, CRGB::Black);
-	}
-	FastLED.show();
-	effectManager.begin();
-	effectManager.saveConfig();
-	Serial.println();
-	Serial.println();
-
-	SPIFFS.begin();
-	String lastModifiedTime;
+	Configuration::setCorrection(Typical8mmPixel);
+	frameWatch.begin(Configuration::strips);
 	{
-		auto file = SPIFFS.open("/www/_nuxt/last-modified.txt");
-		if(file && !file.isDirectory()) {
-			lastModifiedTime = file.readString();
-		}
+		uint8_t bootRecord[BOOT_RECORD_SIZE];
+		size_t len = prefs.getBytes("bootRecord", bootRecord, sizeof(bootRecord));
+		savedBootRecordHash = PersistenceService::hash(bootRecord, len);
+		effectManager.beginFast(bootRecord, len);
 	}
+	effectManager.run();
+	powerLimiter.update(Configuration::strips, brightness);
+	Configuration::composite(brightness);
+	Configuration::show();
+	firstFrameTime = micros();
+	Serial.printf("First frame after %uus\n", firstFrameTime);
+}
+
+void saveBootRecord() {
+	auto &record = effectManager.getBootRecord();
+	auto hash = PersistenceService::hash(record.data(), record.size());
+	if(hash == savedBootRecordHash) return;
+	// An empty record is one the config outgrew; putBytes() can't store that, so drop the old one.
+	bool saved = record.empty() ?
+	             prefs.remove("bootRecord") :
+	             prefs.putBytes("bootRecord", record.data(), record.size()) == record.size();
+	if(saved) savedBootRecordHash = hash;
+}
+
+void startNetwork() {
 	WiFi.onEvent(
 	[](WiFiEvent_t event, WiFiEventInfo_t info) {
 		const auto networkCount = WiFi.scanComplete();
 		Serial.println(networkCount);
 		if(networkCount < 0) return;
-		DynamicJsonDocument doc(JSON_ARRAY_SIZE(networkCount) + JSON_OBJECT_SIZE(2) +
-		                        networkCount * JSON_OBJECT_SIZE(3) + networkCount * 47);
+		TaggedJsonDocument doc(JSON_ARRAY_SIZE(networkCount) + JSON_OBJECT_SIZE(2) +
+		                       networkCount * JSON_OBJECT_SIZE(3) + networkCount * 47);
 		doc["type"] = "scan";
 		JsonArray data = doc.createNestedArray("networks");
 		for(auto i = 0; i < networkCount; i++) {
@@ -283,11 +437,7 @@ void setup() {
 			network["rssi"] = WiFi.RSSI(i);
 			network["enc"] = WiFi.encryptionType(i) != WIFI_AUTH_OPEN;
 		}
-		size_t len = measureMsgPack(doc);
-		if(wifiList.reserve(len)) {
-			serializeMsgPack(doc, (char *)wifiList.get(), len + 1);
-			ws.binaryAll(&wifiList);
-		}
+		broadcaster.publish(BroadcastChannel::WifiList, doc);
 	},
 	WiFiEvent_t::SYSTEM_EVENT_SCAN_DONE);
 	WiFi.onEvent(
@@ -298,25 +448,62 @@ void setup() {
 	},
 	WiFiEvent_t::SYSTEM_EVENT_STA_GOT_IP);
 	WiFi.begin("Budapest", "2167529621");
+}
+
+void startServer() {
+	SPIFFS.begin();
 	ws.onEvent(onWsEvent);
 	server.addHandler(&ws);
+	server.on("/metrics", HTTP_GET, Metrics::handleRequest);
+#if TRACE_EVENTS
+	server.on("/trace.json", HTTP_GET, Trace::handleRequest);
+#endif
+#if EMBEDDED_FRONTEND
 	{
-		auto handler = new ServeStatic("/_nuxt/", SPIFFS, "/www/_nuxt/");
+		auto handler = new ServeEmbedded("/_nuxt/", "/_nuxt/");
 		handler->setCacheControl("public, max-age=31536000");
 		server.addHandler(handler);
 	}
 	{
-		auto handler = new ServeStatic("/", SPIFFS, "/www/");
+		auto handler = new ServeEmbedded("/", "/");
+		handler->setCacheControl("no-cache");
+		server.addHandler(handler);
+	}
+	Serial.printf("%u files embedded\n", embeddedFileCount);
+	server.onNotFound([](AsyncWebServerRequest *request) {
+		Metrics::increment(Metrics::Metric::StaticMisses);
+		auto page = ServeEmbedded::find("/404.html");
+		if(!page) return request->send(404);
+		auto response = request->beginResponse_P(404, page->contentType, page->data, page->size);
+		if(page->gzip) response->addHeader("Content-Encoding", "gzip");
+		request->send(response);
+	});
+#else
+	{
+		auto handler = new ServeStatic("/_nuxt/", SPIFFS, "/www/_nuxt/");
+		handler->setCacheControl("public, max-age=31536000").setManifest("/www/assets.txt");
+		server.addHandler(handler);
+		Serial.printf("/_nuxt/: %u files indexed\n", handler->indexSize());
+	}
+	{
+		auto handler = new ServeStatic("/", SPIFFS, "/www/", "_nuxt/");
 		handler->setDefaultFile("index.html");
-		handler->setLastModified(lastModifiedTime.c_str());
+		// Revalidated on every load, which the ETags make cheap.
+		handler->setCacheControl("no-cache").setManifest("/www/assets.txt");
 		server.addHandler(handler);
+		Serial.printf("/: %u files indexed\n", handler->indexSize());
 	}
 	server.onNotFound([](AsyncWebServerRequest *request) {
+		Metrics::increment(Metrics::Metric::StaticMisses);
 		auto response = request->beginResponse(SPIFFS, "/www/404.html");
 		response->setCode(404);
 		request->send(response);
 	});
+#endif
 	server.begin();
+}
+
+void startServices() {
 	WiFi.scanNetworks(true);
 	configTime(0, 0, "pool.ntp.org");
 	ArduinoOTA
@@ -351,6 +538,38 @@ void setup() {
 	ArduinoOTA.begin();
 }
 
+void advanceBoot() {
+	switch(bootStage) {
+	case BootStage::Config:
+		effectManager.begin();
+		sceneLibrary.begin();
+		playlist.begin(decodeArena);
+		saveBootRecord();
+		publishConfig();
+		publishScenes();
+		publishPlaylist();
+		publishGlobalStats();
+		buildEffectSchema();
+		bootStage = BootStage::Network;
+		break;
+	case BootStage::Network:
+		startNetwork();
+		bootStage = BootStage::Server;
+		break;
+	case BootStage::Server:
+		startServer();
+		bootStage = BootStage::Services;
+		break;
+	case BootStage::Services:
+		startServices();
+		bootStage = BootStage::Done;
+		Serial.printf("Boot finished after %ums, first frame after %uus\n", millis(), firstFrameTime);
+		break;
+	case BootStage::Done:
+		break;
+	}
+}
+
 int getSunrise(tm &timeinfo) {
 	return sunTimes.sunrise(timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday, false);
 }
@@ -364,13 +583,44 @@ time_t minutesPastMidnight(int minutes, tm timeinfo) {
 	return mktime(&timeinfo);
 }
 void loop() {
-	ArduinoOTA.handle();
+	auto frameStart = micros();
+	PERF_FRAME();
+	frameWatch.beginFrame(Configuration::strips);
+	if(bootStage != BootStage::Done) {
+		advanceBoot();
+	} else {
+		PERF_SCOPE(Ota);
+		ArduinoOTA.handle();
+	}
+	if(restartRequestedAt && millis() - restartRequestedAt > 1000) {
+		ESP.restart();
+	}
 	random16_add_entropy(random(65535));
 
 	EVERY_N_SECONDS(10) {
-		Serial.println(ESP.getFreeHeap());
+		Serial.printf("heap: %u free, largest block %u\n", ESP.getFreeHeap(), ESP.getMaxAllocHeap());
+		heapWatch.sample();
+		for(auto i = 0; i < (uint8_t)HeapTag::Count; i++) {
+			auto stats = Heap::stats((HeapTag)i);
+			Serial.printf("heap %s: %u bytes in %u blocks, %u allocations\n", heapTagNames[i],
+			              stats.liveBytes, stats.liveCount, stats.allocations);
+		}
+		auto persistence = effectManager.getPersistenceStats();
+		Serial.printf("config saves: %u written (%u bytes), %u unchanged, %u failed, last %uus, max %uus\n",
+		              persistence.writes, persistence.bytesWritten, persistence.skipped, persistence.failures,
+		              persistence.lastLatency, persistence.maxLatency);
+		for(auto &strip : Configuration::strips) {
+			if(!strip.output) continue;
+			Serial.printf("strip %s: HDR pass %uus, max %uus\n", strip.name, strip.hdrStats.lastMicros,
+			              strip.hdrStats.maxMicros);
+		}
+		broadcaster.forEachClient([](const BroadcastStats &stats) {
+			Serial.printf("ws client %u: queued %u, in flight %u, sent %u, dropped %u\n", stats.clientId,
+			              stats.queued, stats.inFlight, stats.sent, stats.dropped);
+		});
 	}
 	EVERY_N_SECONDS(5) {
+		PERF_SCOPE(Sun);
 		time_t now;
 		tm timeinfo;
 		static time_t sunrise = 0;
@@ -418,17 +668,87 @@ void loop() {
 			Serial.println(sunrise);
 		}
 	}
-	FastLED.setBrightness(brightness);
-	if(lightStat != LightStat::OFF) {
-		effectManager.run();
-	} else {
-		for(const auto strip : Configuration::strips) {
-			fill_solid(strip.data, strip.len, CRGB::Black);
+	{
+		PERF_SCOPE(Updates);
+		auto now = millis();
+		// A playlist step swaps in a stored scene rather than editing the config, so it's
+		// broadcast but not written to flash.
+		bool advanced = playlist.update(now);
+		if(effectManager.applyPendingUpdates()) {
+			configBroadcast.touch();
+			if(!advanced) configSave.touch(now);
+		}
+		if(configBroadcast.due(now)) {
+			effectManager.serializeConfig();
+			publishConfig();
+		}
+		std::string sceneName;
+		if(sceneLibrary.takeQueuedSave(sceneName)) {
+			effectManager.serializeConfig();
+			if(sceneLibrary.save(sceneName, effectManager.getBinaryConfig())) {
+				publishScenes();
+			}
+		}
+		if(configSave.due(now)) {
+			// The serialized config is already current: the broadcast throttle is far shorter than
+			// the settle delay, so it has run since the last change.
+			effectManager.saveConfig();
+			saveBootRecord();
+		}
+		if(globalStatsBroadcast.due(now)) {
+			publishGlobalStats();
+		}
+		if(globalStatsSave.due(now)) {
+			saveGlobalStats();
 		}
 	}
-	FastLED.show();
 
-	// insert a delay to keep the framerate modest
-	FastLED.delay(1000 / FRAMES_PER_SECOND);
-	ws.cleanupClients();
+	auto renderStart = micros();
+	{
+		PERF_SCOPE(Render);
+		if(lightStat != LightStat::OFF) {
+			effectManager.run();
+		} else {
+			for(auto &strip : Configuration::strips) {
+				strip.pixels().fill(CRGB::Black);
+			}
+		}
+	}
+	{
+		PERF_SCOPE(Composite);
+		powerLimiter.update(Configuration::strips, brightness);
+		Configuration::composite(brightness);
+	}
+	auto showStart = micros();
+	auto renderMicros = showStart - renderStart;
+	{
+		PERF_SCOPE(Show);
+		Configuration::show();
+	}
+	auto showMicros = micros() - showStart;
+	Metrics::set(Metrics::Metric::ShowMicros, showMicros);
+	Metrics::increment(Metrics::Metric::FramesRendered);
+	EVERY_N_SECONDS(1) {
+		publishPower();
+		publishFrames();
+		Metrics::set(Metrics::Metric::WsClients, ws.count());
+	}
+#if PERF_STATS
+	EVERY_N_SECONDS(2) {
+		publishPerfStats();
+	}
+#endif
+
+	// insert a delay to keep the framerate modest. FastLED.delay() would show every strip again.
+	delay(1000 / FRAMES_PER_SECOND);
+	broadcaster.pump();
+	{
+		PERF_SCOPE(Cleanup);
+		ws.cleanupClients();
+	}
+	// Only the delay asked for is left out: if it ran long, the loop task was held up.
+	auto elapsed = micros() - frameStart;
+	auto paced = (uint32_t)(1000 / FRAMES_PER_SECOND) * 1000;
+	frameWatch.endFrame(Configuration::strips, renderMicros, showMicros,
+	                    elapsed > paced ? elapsed - paced : 0);
 }
@@ -0,0 +1,113 @@
+#include "Persistence.h"
+#include <FS.h>
+#include <string>
+#include <unity.h>
+
+namespace {
+fs::FS flash;
+
+std::string read(AtomicFile &file) {
+	File f = file.open();
+	if(!f) return "";
+	std::string content(f.size(), 0);
+	f.read((uint8_t *)&content[0], content.size());
+	return content;
+}
+bool write(AtomicFile &file, const std::string &content) {
+	return file.write((const uint8_t *)content.data(), content.size());
+}
+// Power comes back: what's on flash is all a rebooted device has to go on.
+std::string reboot() {
+	flash.cutPowerAfter(-1);
+	AtomicFile file(flash, "/data.bin", "/data.tmp");
+	return read(file);
+}
+
+// Cuts the power at every write the file system sees in turn, from the first to the one after the
+// last, and checks what a reboot finds each time. prepare() sets up the file beforehand.
+template <typename F>
+void checkEveryCut(F prepare, const std::string &before, const std::string &after) {
+	for(int cut = 1;; cut++) {
+		flash.format();
+		prepare();
+		AtomicFile file(flash, "/data.bin", "/data.tmp");
+		flash.cutPowerAfter(cut);
+		bool ok = write(file, after);
+		auto content = reboot();
+		if(ok) {
+			TEST_ASSERT_EQUAL_STRING(after.c_str(), content.c_str());
+			return;
+		}
+		TEST_ASSERT_TRUE_MESSAGE(content == before || content == after, content.c_str());
+	}
+}
+} // namespace
+
+void setUp() {
+	char directory[] = "/tmp/atomic-file-XXXXXX";
+	TEST_ASSERT_NOT_NULL(mkdtemp(directory));
+	flash.setRoot(directory);
+	flash.cutPowerAfter(-1);
+}
+
+void tearDown() {
+	flash.cutPowerAfter(-1);
+	flash.format();
+	flash.rmdir("/");
+}
+
+void test_first_write_survives_every_cut() {
+	checkEveryCut([] {}, "", "the first version");
+}
+
+void test_overwrite_survives_every_cut() {
+	checkEveryCut(
+	[] {
+		AtomicFile file(flash, "/data.bin", "/data.tmp");
+		TEST_ASSERT_TRUE(write(file, "old"));
+	},
+	"old", "a longer new version");
+}
+
+// Cut between removing the old file and renaming the new one into place: only the temporary file
+// is left. Writing again without reading first still keeps one complete version.
+void test_write_after_an_interrupted_rename_survives_every_cut() {
+	checkEveryCut(
+	[] {
+		AtomicFile file(flash, "/data.bin", "/data.tmp");
+		TEST_ASSERT_TRUE(write(file, "first"));
+		// Open, write and remove go through; the rename doesn't.
+		flash.cutPowerAfter(4);
+		TEST_ASSERT_FALSE(write(file, "second"));
+		TEST_ASSERT_FALSE(flash.exists("/data.bin"));
+		flash.cutPowerAfter(-1);
+	},
+	"second", "third");
+}
+
+void test_service_skips_unchanged_content() {
+	AtomicFile file(flash, "/data.bin", "/data.tmp");
+	PersistenceService service(
+	[&file](const uint8_t *data, size_t len) { return file.write(data, len); });
+	const uint8_t content[] = "content";
+	service.save(content, sizeof(content));
+	service.flush(false);
+	TEST_ASSERT_EQUAL_UINT32(0, service.getStats().writes);
+	service.flush(true);
+	service.save(content, sizeof(content));
+	service.flush(true);
+	auto stats = service.getStats();
+	TEST_ASSERT_EQUAL_UINT32(1, stats.writes);
+	TEST_ASSERT_EQUAL_UINT32(1, stats.skipped);
+	TEST_ASSERT_EQUAL_UINT32(sizeof(content), stats.bytesWritten);
+	TEST_ASSERT_EQUAL_UINT32(sizeof(content), read(file).size());
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_first_write_survives_every_cut);
+	RUN_TEST(test_overwrite_survives_every_cut);
+	RUN_TEST(test_write_after_an_interrupted_rename_survives_every_cut);
+	RUN_TEST(test_service_skips_unchanged_content);
+	return UNITY_END();
+}
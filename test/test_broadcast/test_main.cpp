@@ -0,0 +1,178 @@
+#include "Broadcast.h"
+#include <unity.h>
+#include <vector>
+
+// Twenty clients on one broadcaster. Every round publishes a snapshot on each channel, then runs
+// a few frames of loop(): fast clients drain their sockets every frame, slow ones send a message
+// every few frames, and the first client not at all.
+#define CLIENT_COUNT 20
+#define ROUNDS 400
+#define FRAMES_PER_ROUND 4
+#define SLOW_EVERY 5
+
+namespace {
+const BroadcastChannel channels[] = { BroadcastChannel::GlobalStats, BroadcastChannel::Config,
+	                                  BroadcastChannel::Frames };
+const size_t payloadSizes[] = { 16, 1024, 200 };
+#define CHANNEL_COUNT (sizeof(channels) / sizeof(*channels))
+
+struct Remote {
+	AsyncWebSocketClient *socket;
+	uint32_t lastSequence[CHANNEL_COUNT];
+	uint32_t received = 0;
+};
+
+AsyncWebSocket ws("/ws");
+Broadcaster broadcaster(ws);
+std::vector<Remote> remotes;
+
+// Every payload starts with the channel's index and a sequence number, padded to its size.
+void publish(size_t channel, uint32_t sequence) {
+	std::vector<uint8_t> payload(payloadSizes[channel]);
+	payload[0] = channel;
+	memcpy(&payload[1], &sequence, sizeof(sequence));
+	TEST_ASSERT_TRUE(broadcaster.publish(channels[channel], payload.data(), payload.size()));
+}
+
+void onEvent(AsyncWebSocket *, AsyncWebSocketClient *client, AwsEventType type, void *, uint8_t *, size_t) {
+	if(type == WS_EVT_CONNECT) broadcaster.addClient(client->id());
+	if(type == WS_EVT_DISCONNECT) broadcaster.removeClient(client->id());
+}
+
+void connect(Remote &remote) {
+	remote.socket = ws.connect();
+	std::fill(std::begin(remote.lastSequence), std::end(remote.lastSequence), UINT32_MAX);
+	remote.socket->onSend([&remote](uint8_t, const uint8_t *data, size_t) {
+		uint32_t sequence;
+		memcpy(&sequence, data + 1, sizeof(sequence));
+		remote.lastSequence[data[0]] = sequence;
+		remote.received++;
+	});
+}
+
+void checkClients() {
+	broadcaster.forEachClient([](BroadcastStats stats) {
+		TEST_ASSERT_LESS_OR_EQUAL(CHANNEL_COUNT, stats.queued);
+		TEST_ASSERT_LESS_OR_EQUAL(BROADCAST_MAX_IN_FLIGHT, stats.inFlight);
+	});
+	for(auto &remote : remotes) {
+		TEST_ASSERT_LESS_OR_EQUAL(BROADCAST_MAX_IN_FLIGHT, remote.socket->queueLength());
+	}
+}
+} // namespace
+
+void setUp() {
+	ws.onEvent(onEvent);
+	remotes.resize(CLIENT_COUNT);
+	for(auto &remote : remotes) {
+		connect(remote);
+	}
+}
+
+void tearDown() {
+	for(auto &remote : remotes) {
+		ws.disconnect(remote.socket);
+	}
+	remotes.clear();
+}
+
+void test_memory_stays_bounded_with_slow_clients() {
+	auto baseline = Heap::stats(HeapTag::WebSocket).liveBytes;
+	uint32_t peak[2] = {};
+	for(uint32_t round = 0; round < ROUNDS; round++) {
+		for(size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+			publish(channel, round);
+		}
+		for(uint32_t frame = 0; frame < FRAMES_PER_ROUND; frame++) {
+			broadcaster.pump();
+			for(size_t i = 1; i < remotes.size(); i++) {
+				bool slow = i % 2;
+				bool due = (round * FRAMES_PER_ROUND + frame) % SLOW_EVERY == 0;
+				remotes[i].socket->deliver(slow ? due : SIZE_MAX);
+			}
+			checkClients();
+			auto &half = peak[round >= ROUNDS / 2];
+			half = std::max(half, Heap::stats(HeapTag::WebSocket).liveBytes - baseline);
+		}
+	}
+
+	// At most the latest snapshot of every channel, plus what each client has in flight, which may
+	// be older ones.
+	size_t largestBuffer = sizeof(AsyncWebSocketMessageBuffer) + payloadSizes[1] + 1;
+	size_t bound = (CHANNEL_COUNT + CLIENT_COUNT * BROADCAST_MAX_IN_FLIGHT) * largestBuffer +
+	               CLIENT_COUNT * BROADCAST_MAX_IN_FLIGHT * sizeof(BroadcastDetail::TrackedMessage);
+	TEST_ASSERT_LESS_OR_EQUAL(bound, peak[0]);
+	// Flat: running longer doesn't need more.
+	TEST_ASSERT_LESS_OR_EQUAL(peak[0], peak[1]);
+
+	// Clients that keep up get every snapshot; the others skip to the latest.
+	broadcaster.forEachClient([](BroadcastStats stats) {
+		auto index = stats.clientId - remotes[0].socket->id();
+		bool fast = index && index % 2 == 0;
+		if(fast) TEST_ASSERT_EQUAL_UINT32(0, stats.dropped);
+		if(!fast) TEST_ASSERT_GREATER_THAN_UINT32(0, stats.dropped);
+	});
+}
+
+void test_latest_snapshot_wins() {
+	for(uint32_t round = 0; round < ROUNDS; round++) {
+		for(size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+			publish(channel, round);
+		}
+		broadcaster.pump();
+		// Odd clients take one message a round, even ones none.
+		for(size_t i = 1; i < remotes.size(); i += 2) {
+			remotes[i].socket->deliver(1);
+		}
+	}
+	// Once publishing stops, draining every client ends with the last snapshot of each channel.
+	bool busy = true;
+	while(busy) {
+		broadcaster.pump();
+		busy = false;
+		for(auto &remote : remotes) {
+			busy |= remote.socket->deliver() > 0;
+		}
+	}
+	for(size_t i = 0; i < remotes.size(); i++) {
+		for(size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+			TEST_ASSERT_EQUAL_UINT32(ROUNDS - 1, remotes[i].lastSequence[channel]);
+		}
+		bool stalled = i % 2 == 0;
+		if(stalled) {
+			// What it had in flight when it stalled, then the latest of each channel.
+			TEST_ASSERT_LESS_OR_EQUAL(BROADCAST_MAX_IN_FLIGHT + CHANNEL_COUNT, remotes[i].received);
+		} else {
+			TEST_ASSERT_LESS_THAN(ROUNDS * CHANNEL_COUNT, remotes[i].received);
+		}
+	}
+}
+
+void test_disconnecting_frees_everything_but_the_latest() {
+	for(uint32_t round = 0; round < 10; round++) {
+		for(size_t channel = 0; channel < CHANNEL_COUNT; channel++) {
+			publish(channel, round);
+		}
+		broadcaster.pump();
+	}
+	for(auto &remote : remotes) {
+		ws.disconnect(remote.socket);
+	}
+	remotes.clear();
+	// Only the latest snapshots, kept for clients that connect later.
+	auto stats = Heap::stats(HeapTag::WebSocket);
+	size_t latest = 0;
+	for(auto size : payloadSizes) {
+		latest += sizeof(AsyncWebSocketMessageBuffer) + size + 1;
+	}
+	TEST_ASSERT_EQUAL_UINT32(CHANNEL_COUNT, stats.liveCount);
+	TEST_ASSERT_EQUAL_UINT32(latest, stats.liveBytes);
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_memory_stays_bounded_with_slow_clients);
+	RUN_TEST(test_latest_snapshot_wins);
+	RUN_TEST(test_disconnecting_frees_everything_but_the_latest);
+	return UNITY_END();
+}
@@ -0,0 +1,45 @@
+#include "Coalescer.h"
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_throttle_picks_up_the_last_change() {
+	Throttle throttle(100);
+	TEST_ASSERT_FALSE(throttle.due(1000));
+	throttle.touch();
+	TEST_ASSERT_TRUE(throttle.due(1000));
+	throttle.touch();
+	TEST_ASSERT_FALSE(throttle.due(1050));
+	TEST_ASSERT_TRUE(throttle.due(1100));
+	TEST_ASSERT_FALSE(throttle.due(1200));
+}
+
+void test_debounce_waits_for_quiet() {
+	Debounce debounce(2000);
+	debounce.touch(1000);
+	TEST_ASSERT_FALSE(debounce.due(2000));
+	debounce.touch(2500);
+	TEST_ASSERT_FALSE(debounce.due(3500));
+	TEST_ASSERT_TRUE(debounce.due(4500));
+	TEST_ASSERT_FALSE(debounce.due(9000));
+}
+
+void test_debounce_ignores_touches_stamped_after_now() {
+	// loop() read the clock, then a touch() from another task stamped a later time.
+	Debounce debounce(2000);
+	debounce.touch(5001);
+	TEST_ASSERT_FALSE(debounce.due(5000));
+	TEST_ASSERT_TRUE(debounce.due(7001));
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_throttle_picks_up_the_last_change);
+	RUN_TEST(test_debounce_waits_for_quiet);
+	RUN_TEST(test_debounce_ignores_touches_stamped_after_now);
+	return UNITY_END();
+}
@@ -0,0 +1,301 @@
+#include "ConfigPartition.h"
+#include "EffectManager.h"
+#include <FS.h>
+#include <Host.h>
+#include <SPIFFS.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unity.h>
+
+namespace {
+// As in partitions.csv.
+constexpr uint32_t partitionSize = 0x8000;
+constexpr uint8_t partitionSubtype = 0x40;
+constexpr int benchmarkRounds = 200;
+
+const StripSettings strips[] = {
+	{ "desk", 120, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 60, 13, StripChipset::WS2812B, StripOrder::GRB },
+	{ "window", 150, 25, StripChipset::WS2811, StripOrder::RGB },
+};
+constexpr size_t stripCount = sizeof(strips) / sizeof(*strips);
+
+std::string directory;
+DecodeArena arena;
+
+std::string partitionPath() {
+	return directory + "/config.bin";
+}
+// Attaches the config partition, as the partition table would. The file keeps its content from
+// one call to the next, like flash across a reboot.
+void attachPartition() {
+	Host::removePartitions();
+	Host::addPartition(CONFIG_PARTITION_LABEL, partitionSubtype, partitionSize, partitionPath().c_str());
+}
+// Managers register with the persistence task for good, as they do on the device, so every
+// "boot" gets a fresh one that's never freed.
+EffectManager &boot() {
+	auto manager = new EffectManager(arena);
+	manager->begin();
+	return *manager;
+}
+EffectManager &empty() {
+	auto manager = new EffectManager(arena);
+	manager->beginFast(nullptr, 0);
+	return *manager;
+}
+// Every strip runs every effect, with each effect's fields set to something other than the
+// default, so that nothing in the comparisons below passes by accident.
+void configureAll(EffectManager &manager) {
+	for(size_t strip = 0; strip < stripCount; strip++) {
+		for(uintptr_t effect = 0; effect < Configuration::effectCount; effect++) {
+			EffectConfigData config;
+			auto &creator = Configuration::effects[effect];
+			for(uintptr_t field = 0; field < creator.configLength; field++) {
+				if(creator.config[field].type == EffectConfig::DataType::Number) {
+					config[field] = (double)(strip + effect + 2);
+				} else if(creator.config[field].type == EffectConfig::DataType::Color) {
+					config[field] = (uint32_t)(0x102030 * (strip + 1) + effect);
+				}
+			}
+			manager.applyEffectConfig(strip, effect, config);
+		}
+	}
+	manager.serializeConfig();
+}
+std::vector<uint8_t> currentConfig(EffectManager &manager) {
+	manager.serializeConfig();
+	return manager.getBinaryConfig();
+}
+bool waitForSave(EffectManager &manager, uint32_t writes) {
+	for(auto i = 0; i < 300 && manager.getPersistenceStats().writes < writes; i++) {
+		delay(10);
+	}
+	return manager.getPersistenceStats().writes >= writes;
+}
+void writeFile(const char *path, const uint8_t *data, size_t len) {
+	File file = SPIFFS.open(path, FILE_WRITE);
+	TEST_ASSERT_TRUE(file);
+	TEST_ASSERT_EQUAL_UINT32(len, file.write(data, len));
+}
+// The newest valid copy in the partition file, found through a mapping of our own rather than
+// the partition API.
+std::vector<uint8_t> readPartitionFile() {
+	int fd = open(partitionPath().c_str(), O_RDONLY);
+	TEST_ASSERT_TRUE(fd >= 0);
+	auto flash = (const uint8_t *)mmap(nullptr, partitionSize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	TEST_ASSERT_TRUE(flash != MAP_FAILED);
+	std::vector<uint8_t> newest;
+	uint32_t sequence = 0;
+	for(auto slot = 0; slot < 2; slot++) {
+		ConfigFormat::Reader reader(flash + slot * partitionSize / 2, partitionSize / 2);
+		if(reader.valid() && (newest.empty() || reader.sequence() > sequence)) {
+			auto data = flash + slot * partitionSize / 2;
+			newest.assign(data, data + reader.length());
+			sequence = reader.sequence();
+		}
+	}
+	munmap((void *)flash, partitionSize);
+	return newest;
+}
+// The binary config without its header, whose sequence number depends on where it was written.
+std::vector<uint8_t> payload(const std::vector<uint8_t> &config) {
+	TEST_ASSERT_TRUE(config.size() >= sizeof(ConfigFormat::ConfigHeader));
+	return std::vector<uint8_t>(config.begin() + sizeof(ConfigFormat::ConfigHeader), config.end());
+}
+} // namespace
+
+void setUp() {
+	char path[] = "/tmp/config-format-XXXXXX";
+	TEST_ASSERT_NOT_NULL(mkdtemp(path));
+	directory = path;
+	SPIFFS.setRoot(directory + "/spiffs");
+	SPIFFS.mkdir("/");
+	Host::removePartitions();
+}
+
+void tearDown() {
+	Host::removePartitions();
+	SPIFFS.format();
+	unlink(partitionPath().c_str());
+	SPIFFS.rmdir("/");
+	rmdir(directory.c_str());
+}
+
+void test_partition_is_read_in_place() {
+	attachPartition();
+	auto &source = empty();
+	configureAll(source);
+	auto expected = source.getBinaryConfig();
+
+	ConfigPartition partition;
+	TEST_ASSERT_TRUE(partition.begin());
+	TEST_ASSERT_TRUE(partition.write(expected.data(), expected.size()));
+
+	// A reader mapping the file sees what was written, and so does the next boot.
+	TEST_ASSERT_TRUE(payload(expected) == payload(readPartitionFile()));
+	attachPartition();
+	ConfigPartition rebooted;
+	TEST_ASSERT_TRUE(rebooted.begin());
+	size_t len;
+	auto data = rebooted.data(len);
+	TEST_ASSERT_NOT_NULL(data);
+	auto &loaded = empty();
+	TEST_ASSERT_TRUE(loaded.loadBinaryConfig(data, len));
+	TEST_ASSERT_TRUE(payload(expected) == payload(currentConfig(loaded)));
+}
+
+void test_corrupt_newer_slot_falls_back() {
+	attachPartition();
+	auto &manager = empty();
+	configureAll(manager);
+	auto older = manager.getBinaryConfig();
+	EffectConfigData changed;
+	changed[0] = (double)42;
+	manager.applyEffectConfig(0, 0, changed);
+	auto newer = currentConfig(manager);
+
+	ConfigPartition partition;
+	TEST_ASSERT_TRUE(partition.begin());
+	TEST_ASSERT_TRUE(partition.write(older.data(), older.size()));
+	TEST_ASSERT_TRUE(partition.write(newer.data(), newer.size()));
+	// Flash can only clear bits, like a write cut short would leave them.
+	auto partitionInfo = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+	                                              CONFIG_PARTITION_LABEL);
+	uint8_t zero = 0;
+	TEST_ASSERT_EQUAL(ESP_OK, esp_partition_write(partitionInfo, partitionSize / 2 + newer.size() - 1, &zero, 1));
+
+	ConfigPartition rebooted;
+	TEST_ASSERT_TRUE(rebooted.begin());
+	size_t len;
+	auto data = rebooted.data(len);
+	TEST_ASSERT_NOT_NULL(data);
+	TEST_ASSERT_TRUE(payload(older) == payload(std::vector<uint8_t>(data, data + older.size())));
+}
+
+void test_file_config_moves_into_partition() {
+	auto &source = empty();
+	configureAll(source);
+	auto expected = source.getBinaryConfig();
+	// Saved by a unit whose partition table had no config partition yet.
+	writeFile("/effects.bin", expected.data(), expected.size());
+
+	attachPartition();
+	auto &manager = boot();
+	TEST_ASSERT_TRUE(payload(expected) == payload(currentConfig(manager)));
+	TEST_ASSERT_TRUE(waitForSave(manager, 1));
+	TEST_ASSERT_TRUE(payload(expected) == payload(readPartitionFile()));
+
+	// From then on the partition is what's read, and nothing is saved again.
+	SPIFFS.remove("/effects.bin");
+	auto &rebooted = boot();
+	TEST_ASSERT_TRUE(payload(expected) == payload(currentConfig(rebooted)));
+	delay(PERSIST_DEBOUNCE + 200);
+	TEST_ASSERT_EQUAL_UINT32(0, rebooted.getPersistenceStats().writes);
+}
+
+void test_msgpack_config_moves_into_partition() {
+	auto &source = empty();
+	configureAll(source);
+	auto msgpack = source.getSerializedConfig();
+	writeFile("/effects.msgpack", msgpack->get(), msgpack->length());
+
+	attachPartition();
+	auto &manager = boot();
+	TEST_ASSERT_TRUE(payload(source.getBinaryConfig()) == payload(currentConfig(manager)));
+	TEST_ASSERT_TRUE(waitForSave(manager, 1));
+	TEST_ASSERT_TRUE(payload(source.getBinaryConfig()) == payload(readPartitionFile()));
+}
+
+// A record whose number is out of its field's range is dropped with the rest of its record, as
+// a schema mismatch, instead of reaching an effect that divides by it.
+void test_out_of_range_number_is_dropped() {
+	std::vector<uint8_t> binary;
+	ConfigFormat::Writer writer(binary);
+	for(auto speed : { 0.0, 5.0, 51.0, (double)NAN }) {
+		EffectConfigData config;
+		config[0] = speed;
+		writer.addRecord(0, 0, config);
+	}
+	writer.finish();
+
+	std::vector<double> loaded;
+	ConfigFormat::Reader(binary.data(), binary.size())
+	.forEach([&loaded](uintptr_t, uintptr_t, EffectConfigData &config) {
+		loaded.push_back(*strict_variant::get<double>(&config[0]));
+	});
+	TEST_ASSERT_EQUAL(1, loaded.size());
+	TEST_ASSERT_EQUAL_DOUBLE(5.0, loaded[0]);
+}
+
+// No effect has a select field yet, so the range check is tried against one made up here.
+void test_out_of_range_select_is_dropped() {
+	static const char *const options[] = { "one", "two", "three" };
+	auto field = EffectConfig::create("Mode", "", EffectConfig::Select(options, 3, 0));
+	TEST_ASSERT_TRUE(ConfigFormat::inRange(field, EffectConfigValue((uintptr_t)2)));
+	TEST_ASSERT_FALSE(ConfigFormat::inRange(field, EffectConfigValue((uintptr_t)3)));
+	TEST_ASSERT_FALSE(ConfigFormat::inRange(field, EffectConfigValue((uintptr_t)UINT32_MAX)));
+}
+
+// Loading the same config from the mapped partition and from MsgPack the way effects.msgpack was
+// read, with load time per config and the memory each path needs besides the effects' own.
+void test_binary_load_against_msgpack() {
+	attachPartition();
+	auto &source = empty();
+	configureAll(source);
+	auto binary = source.getBinaryConfig();
+	auto msgpackBuffer = source.getSerializedConfig();
+	std::vector<uint8_t> msgpack(msgpackBuffer->get(), msgpackBuffer->get() + msgpackBuffer->length());
+	ConfigPartition partition;
+	TEST_ASSERT_TRUE(partition.begin());
+	TEST_ASSERT_TRUE(partition.write(binary.data(), binary.size()));
+	size_t len;
+	auto mapped = partition.data(len);
+
+	auto &fromBinary = empty();
+	auto jsonBefore = Heap::stats(HeapTag::Json).liveBytes;
+	auto start = micros();
+	for(auto i = 0; i < benchmarkRounds; i++) {
+		TEST_ASSERT_TRUE(fromBinary.loadBinaryConfig(mapped, len));
+	}
+	auto binaryMicros = micros() - start;
+	TEST_ASSERT_EQUAL_UINT32(jsonBefore, Heap::stats(HeapTag::Json).liveBytes);
+
+	auto &fromMsgpack = empty();
+	size_t documentBytes = 0;
+	start = micros();
+	for(auto i = 0; i < benchmarkRounds; i++) {
+		// effects.msgpack was read from SPIFFS into the arena, so a copy stands in for the file.
+		std::vector<uint8_t> file(msgpack);
+		TEST_ASSERT_EQUAL(DeserializationError::Ok, arena.decode(file.data(), file.size()).code());
+		documentBytes = arena.memoryUsage();
+		fromMsgpack.loadConfig(arena.root());
+	}
+	auto msgpackMicros = micros() - start;
+
+	TEST_ASSERT_TRUE(payload(currentConfig(fromBinary)) == payload(currentConfig(fromMsgpack)));
+	TEST_ASSERT_TRUE(binary.size() < msgpack.size());
+	printf("binary:  %u bytes, %.1f us per load, no memory besides the mapping\n",
+	       (unsigned)binary.size(), (double)binaryMicros / benchmarkRounds);
+	printf("msgpack: %u bytes, %.1f us per load, %u byte document in a %u byte arena plus the file\n",
+	       (unsigned)msgpack.size(), (double)msgpackMicros / benchmarkRounds, (unsigned)documentBytes,
+	       DECODE_ARENA_SIZE);
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	Configuration::beginStrips(strips, stripCount);
+	UNITY_BEGIN();
+	RUN_TEST(test_partition_is_read_in_place);
+	RUN_TEST(test_corrupt_newer_slot_falls_back);
+	RUN_TEST(test_file_config_moves_into_partition);
+	RUN_TEST(test_msgpack_config_moves_into_partition);
+	RUN_TEST(test_out_of_range_number_is_dropped);
+	RUN_TEST(test_out_of_range_select_is_dropped);
+	RUN_TEST(test_binary_load_against_msgpack);
+	return UNITY_END();
+}
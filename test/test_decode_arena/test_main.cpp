@@ -0,0 +1,181 @@
+#include "EffectManager.h"
+#include "Playlist.h"
+#include <Host.h>
+#include <string>
+#include <unity.h>
+#include <vector>
+
+namespace {
+constexpr int benchmarkRounds = 200;
+
+const StripSettings strips[] = {
+	{ "desk", 120, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 60, 13, StripChipset::WS2812B, StripOrder::GRB },
+	{ "window", 150, 25, StripChipset::WS2811, StripOrder::RGB },
+};
+constexpr size_t stripCount = sizeof(strips) / sizeof(*strips);
+
+DecodeArena arena;
+
+// Counts what the retry loop's documents take from the heap, and the most they held at once.
+size_t liveBytes = 0;
+size_t peakBytes = 0;
+struct PeakAllocator {
+	void *allocate(size_t size) {
+		auto ptr = (size_t *)Heap::backingAllocate(size + sizeof(size_t));
+		if(!ptr) return nullptr;
+		*ptr = size;
+		liveBytes += size;
+		peakBytes = std::max(peakBytes, liveBytes);
+		return ptr + 1;
+	}
+	void *reallocate(void *ptr, size_t size) {
+		deallocate(ptr);
+		return allocate(size);
+	}
+	void deallocate(void *ptr) {
+		if(!ptr) return;
+		auto block = (size_t *)ptr - 1;
+		liveBytes -= *block;
+		Heap::backingFree(block);
+	}
+};
+using RetryDocument = BasicJsonDocument<PeakAllocator>;
+
+// How incoming messages and /effects.msgpack were decoded before the arena: a fresh document that
+// doubles from 2048 bytes up to 1 MB, parsing the whole payload again after every NoMemory. The
+// payload is copied each time, as the in-place parse of the one before leaves it modified.
+DeserializationError retryDecode(const std::vector<uint8_t> &payload, size_t &documentBytes) {
+	auto storageSize = 2048;
+	RetryDocument doc(storageSize);
+	DeserializationError err = DeserializationError::InvalidInput;
+	do {
+		std::vector<uint8_t> data(payload);
+		err = deserializeMsgPack(doc, (char *)data.data(), data.size());
+		if(err == DeserializationError::NoMemory) {
+			storageSize *= 2;
+			if(storageSize > 1048576) {
+				break;
+			}
+			doc = RetryDocument(storageSize);
+			if(!doc.capacity()) {
+				break;
+			}
+		}
+	} while(err == DeserializationError::NoMemory);
+	documentBytes = doc.capacity();
+	return err;
+}
+std::vector<uint8_t> toMsgPack(const JsonDocument &doc) {
+	std::vector<uint8_t> data(measureMsgPack(doc));
+	serializeMsgPack(doc, data.data(), data.size());
+	return data;
+}
+// A slider drag: the smallest message and by far the most frequent.
+std::vector<uint8_t> updateEffect() {
+	DynamicJsonDocument doc(1024);
+	doc["type"] = "updateEffect";
+	doc["strip"] = "desk";
+	doc["effect"] = "Rainbow";
+	doc["config"]["Speed"] = 12;
+	return toMsgPack(doc);
+}
+// Every effect on every strip, as /effects.msgpack held it.
+std::vector<uint8_t> effectsFile() {
+	auto manager = new EffectManager(arena);
+	manager->beginFast(nullptr, 0);
+	for(size_t strip = 0; strip < stripCount; strip++) {
+		for(uintptr_t effect = 0; effect < Configuration::effectCount; effect++) {
+			EffectConfigData config;
+			auto &creator = Configuration::effects[effect];
+			for(uintptr_t field = 0; field < creator.configLength; field++) {
+				if(creator.config[field].type == EffectConfig::DataType::Number) {
+					config[field] = (double)(strip + effect + 2);
+				} else if(creator.config[field].type == EffectConfig::DataType::Color) {
+					config[field] = (uint32_t)(0x102030 * (strip + 1) + effect);
+				}
+			}
+			manager->applyEffectConfig(strip, effect, config);
+		}
+	}
+	manager->serializeConfig();
+	auto buffer = manager->getSerializedConfig();
+	return std::vector<uint8_t>(buffer->get(), buffer->get() + buffer->length());
+}
+// The largest message there is: a full playlist of long scene names.
+std::vector<uint8_t> setPlaylist() {
+	DynamicJsonDocument doc(16384);
+	doc["type"] = "setPlaylist";
+	auto scenes = doc.createNestedArray("scenes");
+	for(auto i = 0; i < PLAYLIST_MAX; i++) {
+		auto name = std::string(SCENE_NAME_LENGTH - 3, 'x') + std::to_string(100 + i);
+		scenes.add(name);
+	}
+	doc["interval"] = 60000;
+	doc["enabled"] = true;
+	return toMsgPack(doc);
+}
+
+void compare(const char *name, const std::vector<uint8_t> &payload) {
+	auto jsonBefore = Heap::stats(HeapTag::Json).liveBytes;
+	auto start = micros();
+	for(auto i = 0; i < benchmarkRounds; i++) {
+		std::vector<uint8_t> data(payload);
+		auto err = arena.decode((char *)data.data(), data.size());
+		TEST_ASSERT_EQUAL(DeserializationError::Ok, err.code());
+	}
+	auto arenaMicros = micros() - start;
+	auto arenaBytes = arena.memoryUsage();
+	// The arena was allocated once, before any of this.
+	TEST_ASSERT_EQUAL_UINT32(jsonBefore, Heap::stats(HeapTag::Json).liveBytes);
+
+	size_t documentBytes = 0;
+	peakBytes = 0;
+	start = micros();
+	for(auto i = 0; i < benchmarkRounds; i++) {
+		TEST_ASSERT_EQUAL(DeserializationError::Ok, retryDecode(payload, documentBytes).code());
+	}
+	auto retryMicros = micros() - start;
+	TEST_ASSERT_EQUAL(0, liveBytes);
+
+	printf("%s (%u bytes): arena %.1f us, %u of %u bytes used, nothing allocated; "
+	       "retry loop %.1f us, %u byte document, %u bytes at peak\n",
+	       name, (unsigned)payload.size(), (double)arenaMicros / benchmarkRounds,
+	       (unsigned)arenaBytes, DECODE_ARENA_SIZE, (double)retryMicros / benchmarkRounds,
+	       (unsigned)documentBytes, (unsigned)peakBytes);
+}
+} // namespace
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// Parse time per message, and the heap each way needs while decoding it.
+void test_arena_against_retry_loop() {
+	compare("updateEffect", updateEffect());
+	compare("effects.msgpack", effectsFile());
+	compare("setPlaylist", setPlaylist());
+}
+
+// A payload too big for the arena is refused in one pass instead of growing the document.
+void test_oversized_payload_is_refused() {
+	DynamicJsonDocument doc(65536);
+	auto list = doc.createNestedArray("scenes");
+	for(auto i = 0; i < DECODE_ARENA_SIZE / 8; i++) {
+		list.add(i);
+	}
+	auto payload = toMsgPack(doc);
+	auto err = arena.decode((char *)payload.data(), payload.size());
+	TEST_ASSERT_EQUAL(DeserializationError::NoMemory, err.code());
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	Configuration::beginStrips(strips, stripCount);
+	UNITY_BEGIN();
+	RUN_TEST(test_arena_against_retry_loop);
+	RUN_TEST(test_oversized_payload_is_refused);
+	return UNITY_END();
+}
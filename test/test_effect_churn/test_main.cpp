@@ -0,0 +1,104 @@
+#include "EffectManager.h"
+#include <Host.h>
+#include <unity.h>
+
+// Effects toggled on and off from the UI, the way the WebSocket handler and loop() do it.
+#define CYCLES 10000
+#define WARMUP_CYCLES 10
+
+namespace {
+const StripSettings strips[] = {
+	{ "desk", 120, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 60, 13, StripChipset::WS2812B, StripOrder::GRB },
+};
+constexpr size_t stripCount = sizeof(strips) / sizeof(*strips);
+
+DecodeArena arena;
+EffectManager *manager;
+TaggedJsonDocument doc(JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(3));
+
+void cycle(int i) {
+	auto strip = i % stripCount;
+	auto effect = i % Configuration::effectCount;
+	doc["Speed"] = 1 + i % 50;
+	doc["Color"]["r"] = i % 256;
+	manager->queueEffectConfig(strip, effect, doc.as<JsonVariantConst>());
+	manager->applyPendingUpdates();
+	manager->run();
+	manager->queueRemoveEffect(strip, effect);
+	manager->applyPendingUpdates();
+}
+uint32_t fragmentation(const Host::HeapStats &stats) {
+	return 100 - (uint64_t)stats.largestFreeBlock * 100 / stats.freeBytes;
+}
+} // namespace
+
+void setUp() {
+	manager = new EffectManager(arena);
+	manager->beginFast(nullptr, 0);
+	auto color = doc.createNestedObject("Color");
+	color["g"] = 0;
+	color["b"] = 255;
+	doc["Speed"] = 1;
+}
+
+void tearDown() {
+	delete manager;
+	doc.clear();
+}
+
+// After the first few cycles every node and effect comes from a free list or a pool slot.
+void test_add_remove_cycles_leave_heap_alone() {
+	for(auto i = 0; i < WARMUP_CYCLES; i++) {
+		cycle(i);
+	}
+	auto before = Host::heapStats();
+	auto effectsBefore = Heap::stats(HeapTag::Effects);
+	for(auto i = 0; i < CYCLES; i++) {
+		cycle(i);
+	}
+	auto after = Host::heapStats();
+	printf("fragmentation after %d cycles: %u%% (%u%% before), largest free block %u of %u bytes\n",
+	       CYCLES, fragmentation(after), fragmentation(before), (unsigned)after.largestFreeBlock,
+	       (unsigned)after.freeBytes);
+	TEST_ASSERT_EQUAL_UINT32(before.allocations, after.allocations);
+	TEST_ASSERT_EQUAL_UINT32(before.freeBytes, after.freeBytes);
+	TEST_ASSERT_EQUAL_UINT32(before.largestFreeBlock, after.largestFreeBlock);
+	TEST_ASSERT_EQUAL_UINT32(effectsBefore.allocations, Heap::stats(HeapTag::Effects).allocations);
+}
+
+// Every strip running every effect at once, then none, over and over: the free lists cover the
+// most that was ever in use.
+void test_full_config_cycles_leave_heap_alone() {
+	auto fill = [] {
+		for(size_t strip = 0; strip < stripCount; strip++) {
+			for(uintptr_t effect = 0; effect < Configuration::effectCount; effect++) {
+				manager->queueEffectConfig(strip, effect, doc.as<JsonVariantConst>());
+			}
+		}
+		manager->applyPendingUpdates();
+		for(size_t strip = 0; strip < stripCount; strip++) {
+			for(uintptr_t effect = 0; effect < Configuration::effectCount; effect++) {
+				manager->queueRemoveEffect(strip, effect);
+			}
+		}
+		manager->applyPendingUpdates();
+	};
+	fill();
+	auto before = Host::heapStats();
+	for(auto i = 0; i < CYCLES / (stripCount * Configuration::effectCount); i++) {
+		fill();
+	}
+	auto after = Host::heapStats();
+	TEST_ASSERT_EQUAL_UINT32(before.allocations, after.allocations);
+	TEST_ASSERT_EQUAL_UINT32(before.largestFreeBlock, after.largestFreeBlock);
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	Configuration::beginStrips(strips, stripCount);
+	UNITY_BEGIN();
+	RUN_TEST(test_add_remove_cycles_leave_heap_alone);
+	RUN_TEST(test_full_config_cycles_leave_heap_alone);
+	return UNITY_END();
+}
@@ -0,0 +1,160 @@
+#include "Broadcast.h"
+#include "EffectManager.h"
+#include "Persistence.h"
+#include <Host.h>
+#include <SPIFFS.h>
+#include <string>
+#include <unity.h>
+#include <vector>
+
+// Each workload runs a few rounds to set up whatever it keeps for good, like the latest snapshot
+// of a broadcast channel, and then many more. Everything a round allocates has to be freed by
+// the end of it, so live memory has to be where it was after the warm-up.
+#define WARMUP_ROUNDS 10
+#define SOAK_ROUNDS 2000
+
+namespace {
+const StripSettings strips[] = {
+	{ "desk", 120, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 60, 13, StripChipset::WS2812B, StripOrder::GRB },
+};
+
+struct Usage {
+	Heap::TagStats tags[(uint8_t)HeapTag::Count];
+	size_t liveBlocks;
+};
+Usage usage() {
+	Usage current;
+	for(auto i = 0; i < (uint8_t)HeapTag::Count; i++) {
+		current.tags[i] = Heap::stats((HeapTag)i);
+	}
+	current.liveBlocks = Host::heapStats().liveBlocks;
+	return current;
+}
+// Names the tags that hold more memory after the soak than before it, and "heap" if there are more
+// blocks in use on the heap as a whole, whether charged to a tag or not. Empty if nothing grew.
+template <typename F> std::string soak(F round) {
+	for(auto i = 0; i < WARMUP_ROUNDS; i++) {
+		round(i);
+	}
+	auto before = usage();
+	for(auto i = 0; i < SOAK_ROUNDS; i++) {
+		round(WARMUP_ROUNDS + i);
+	}
+	auto after = usage();
+	std::string grown;
+	for(auto i = 0; i < (uint8_t)HeapTag::Count; i++) {
+		if(after.tags[i].liveBytes > before.tags[i].liveBytes ||
+		   after.tags[i].liveCount > before.tags[i].liveCount) {
+			grown += grown.empty() ? "" : ", ";
+			grown += heapTagNames[i];
+		}
+	}
+	if(after.liveBlocks > before.liveBlocks) grown += grown.empty() ? "heap" : ", heap";
+	return grown;
+}
+
+AsyncWebSocket ws("/ws");
+Broadcaster broadcaster(ws);
+DecodeArena arena;
+
+void onEvent(AsyncWebSocket *, AsyncWebSocketClient *client, AwsEventType type, void *, uint8_t *, size_t) {
+	if(type == WS_EVT_CONNECT) broadcaster.addClient(client->id());
+	if(type == WS_EVT_DISCONNECT) broadcaster.removeClient(client->id());
+}
+} // namespace
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// Clients come and go while snapshots are published to them, as JSON and as raw frames.
+void test_websocket_traffic_does_not_leak() {
+	ws.onEvent(onEvent);
+	auto steady = ws.connect();
+	std::vector<uint8_t> frame(200);
+	auto grown = soak([&](int round) {
+		auto visitor = ws.connect();
+		TaggedJsonDocument doc(JSON_OBJECT_SIZE(2));
+		doc["type"] = "globalStats";
+		// Kept to one MsgPack byte, so the latest snapshot stays the same size.
+		doc["round"] = round % 100;
+		TEST_ASSERT_TRUE(broadcaster.publish(BroadcastChannel::GlobalStats, doc));
+		frame[0] = round;
+		TEST_ASSERT_TRUE(broadcaster.publish(BroadcastChannel::Frames, frame.data(), frame.size()));
+		broadcaster.pump();
+		steady->deliver(SIZE_MAX);
+		visitor->deliver(1);
+		ws.disconnect(visitor);
+	});
+	ws.disconnect(steady);
+	TEST_ASSERT_EQUAL_STRING("", grown.c_str());
+}
+
+// Effects are added, reconfigured and removed again, from JSON as the WebSocket handler does.
+void test_effect_updates_do_not_leak() {
+	auto manager = new EffectManager(arena);
+	manager->beginFast(nullptr, 0);
+	auto grown = soak([&](int round) {
+		auto effect = round % Configuration::effectCount;
+		TaggedJsonDocument doc(JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(3));
+		doc["Speed"] = 1 + round % 50;
+		auto color = doc.createNestedObject("Color");
+		color["r"] = round % 256;
+		color["g"] = 0;
+		color["b"] = 255;
+		TEST_ASSERT_TRUE(manager->updateEffectConfig(round % 2, effect, doc.as<JsonVariantConst>()));
+		manager->run();
+		manager->serializeConfig();
+		manager->removeEffectConfig(round % 2, effect);
+	});
+	delete manager;
+	TEST_ASSERT_EQUAL_STRING("", grown.c_str());
+}
+
+// Saves that write a file, and saves skipped because nothing changed.
+void test_persistence_does_not_leak() {
+	SPIFFS.begin();
+	AtomicFile file(SPIFFS, "/soak.bin", "/soak.bin.tmp");
+	PersistenceService store([&file](const uint8_t *data, size_t len) { return file.write(data, len); });
+	std::vector<uint8_t> content(300);
+	auto grown = soak([&](int round) {
+		content[0] = round / 2;
+		store.save(content.data(), content.size());
+		store.flush(true);
+	});
+	SPIFFS.format();
+	TEST_ASSERT_EQUAL_STRING("", grown.c_str());
+}
+
+// The check itself: memory kept from every round shows up, under its tag if it has one.
+void test_leaks_are_caught() {
+	std::vector<void *> kept;
+	kept.reserve(WARMUP_ROUNDS + SOAK_ROUNDS);
+	auto grown = soak([&](int) { kept.push_back(Heap::allocate(HeapTag::Http, 24)); });
+	TEST_ASSERT_EQUAL_STRING("http, heap", grown.c_str());
+	for(auto ptr : kept) {
+		Heap::deallocate(HeapTag::Http, ptr);
+	}
+
+	std::vector<std::string *> strings;
+	strings.reserve(WARMUP_ROUNDS + SOAK_ROUNDS);
+	grown = soak([&](int) { strings.push_back(new std::string(64, 'x')); });
+	TEST_ASSERT_EQUAL_STRING("heap", grown.c_str());
+	for(auto str : strings) {
+		delete str;
+	}
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	Configuration::beginStrips(strips, sizeof(strips) / sizeof(*strips));
+	UNITY_BEGIN();
+	RUN_TEST(test_websocket_traffic_does_not_leak);
+	RUN_TEST(test_effect_updates_do_not_leak);
+	RUN_TEST(test_persistence_does_not_leak);
+	RUN_TEST(test_leaks_are_caught);
+	return UNITY_END();
+}
@@ -0,0 +1,471 @@
+// The whole firmware under WebSocket load on the host: main.cpp's setup() and loop() run as they
+// do on the device, while a thread standing in for the AsyncTCP task drives clients the way
+// frontend/scripts/loadgen.ts does against a real controller. Commands go through the real
+// handleMessage(), EffectManager and serialization; what comes back is decoded and counted.
+//
+//   pio test -e loadgen
+//
+// The workload is set with -D flags, named after loadgen.ts's options. At the end it reports
+// throughput, fan-out, latency, the controller's own /metrics, and the heap's low-water mark,
+// which covers everything the firmware allocates plus the stand-ins for the network's buffers.
+#include "Lighting.h"
+#include "MessageAssembler.h"
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include <Host.h>
+#include <Preferences.h>
+#include <SPIFFS.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unity.h>
+
+#ifndef LOADGEN_CLIENTS
+#define LOADGEN_CLIENTS 8
+#endif
+#ifndef LOADGEN_SECONDS
+#define LOADGEN_SECONDS 10
+#endif
+// Commands per second per client.
+#ifndef LOADGEN_RATE
+#define LOADGEN_RATE 20
+#endif
+// Seconds each client stays connected, on average.
+#ifndef LOADGEN_RECONNECT
+#define LOADGEN_RECONNECT 10
+#endif
+// One in every LOADGEN_ABUSE messages is larger than the controller takes, or split into frames.
+#ifndef LOADGEN_ABUSE
+#define LOADGEN_ABUSE 50
+#endif
+// Frames a fragmented message is split into, and the most of a frame each packet carries.
+#define FRAGMENTS 4
+#define FRAGMENT_PACKET_SIZE 256
+// What a TCP segment carries on the device's network, so anything longer arrives in pieces.
+#define TCP_MSS 1436
+#define MAX_LATENCIES 65536
+// updateEffect messages each form is decoded and handled for, in the size and latency comparison.
+#define UPDATE_EFFECT_ROUNDS 200000
+
+// From main.cpp.
+void setup();
+void loop();
+void decodeMessage(AsyncWebSocketClient *client, uint8_t *data, size_t len);
+extern AsyncWebSocket ws;
+extern AsyncWebServer server;
+
+namespace {
+const StripSettings strips[] = {
+	{ "desk", 300, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 150, 13, StripChipset::WS2812B, StripOrder::GRB, STRIP_HDR, 2000 },
+	{ "window", 150, 25, StripChipset::WS2811, StripOrder::RGB },
+};
+// As in partitions.csv; ConfigPartition.h can't be included next to main.cpp, which defines what
+// Configuration.h declares.
+const char *const partitionLabel = "config";
+constexpr uint32_t partitionSize = 0x8000;
+constexpr uint8_t partitionSubtype = 0x40;
+
+// Everything the harness keeps while the load runs is static or on the stack, so the heap's
+// low-water mark is the firmware's. Decoding uses a document of its own for the same reason.
+const char *const broadcastTypes[] = { "effectConfig", "config", "globalStats", "scenes",
+	                                   "playlist",     "power",  "frames",      "perfStats",
+	                                   "scan",         "error" };
+constexpr size_t broadcastTypeCount = sizeof(broadcastTypes) / sizeof(*broadcastTypes);
+const char *const errorNames[] = { "messageTooLarge", "busy", "messageTooComplex" };
+constexpr size_t errorCount = sizeof(errorNames) / sizeof(*errorNames);
+
+struct Stats {
+	uint32_t commands = 0;
+	uint32_t oversized = 0;
+	uint32_t fragmented = 0;
+	uint32_t connects = 0;
+	uint32_t broadcasts[broadcastTypeCount + 1] = {}; // the last for any other type
+	uint32_t errors[errorCount + 1] = {};             // the last for any other error
+	uint64_t bytesIn = 0;
+	uint32_t latencies[MAX_LATENCIES];
+	size_t latencyCount = 0;
+	size_t minLargestBlock = SIZE_MAX;
+} stats;
+
+StaticJsonDocument<32768> schema;
+bool haveSchema = false;
+StaticJsonDocument<32768> received;
+char padding[MESSAGE_POOL_SLOT_SIZE + 1];
+std::minstd_rand rng(1);
+
+uint32_t randomBelow(uint32_t max) {
+	return max ? rng() % max : 0;
+}
+uint8_t messageType(const char *name) {
+	return schema["messageTypes"][name].as<uint8_t>();
+}
+
+struct Client {
+	AsyncWebSocketClient *socket = nullptr;
+	uint32_t sent = 0;
+	uint32_t nextCommandAt = 0;
+	uint32_t reconnectAt = 0;
+	// The last brightness sent and when, until a globalStats broadcast carries it.
+	int pendingBrightness = -1;
+	uint32_t pendingSince = 0;
+} clients[LOADGEN_CLIENTS];
+
+void countIn(const char *list, const char *const *names, size_t count, uint32_t *counters) {
+	size_t i = 0;
+	while(i < count && strcmp(names[i], list) != 0) {
+		i++;
+	}
+	counters[i]++;
+}
+
+void onMessage(Client &client, uint8_t opcode, const uint8_t *data, size_t len) {
+	if(opcode != WS_BINARY) return;
+	stats.bytesIn += len;
+	if(!haveSchema && deserializeMsgPack(schema, data, len) == DeserializationError::Ok &&
+	   strcmp(schema["type"] | "", "effectConfig") == 0) {
+		haveSchema = true;
+	}
+	if(deserializeMsgPack(received, data, len) != DeserializationError::Ok) return;
+	const char *type = received["type"] | "";
+	countIn(type, broadcastTypes, broadcastTypeCount, stats.broadcasts);
+	if(strcmp(type, "globalStats") == 0) {
+		if(received["brightness"].as<int>() == client.pendingBrightness) {
+			if(stats.latencyCount < MAX_LATENCIES) {
+				stats.latencies[stats.latencyCount++] = millis() - client.pendingSince;
+			}
+			client.pendingBrightness = -1;
+		}
+	} else if(strcmp(type, "error") == 0) {
+		countIn(received["error"] | "", errorNames, errorCount, stats.errors);
+	}
+}
+
+void deliver(Client &client) {
+	client.socket->deliver(SIZE_MAX);
+}
+
+void connect(Client &client) {
+	client.socket = ws.connect();
+	client.socket->onSend([&client](uint8_t opcode, const uint8_t *data, size_t len) {
+		onMessage(client, opcode, data, len);
+	});
+	stats.connects++;
+	client.nextCommandAt = millis();
+	// Spread out so that on average each client reconnects every LOADGEN_RECONNECT seconds.
+	client.reconnectAt =
+	LOADGEN_RECONNECT ? millis() + randomBelow(LOADGEN_RECONNECT * 2000) : UINT32_MAX;
+}
+
+void disconnect(Client &client) {
+	deliver(client);
+	ws.disconnect(client.socket);
+	client.socket = nullptr;
+	client.pendingBrightness = -1;
+}
+
+// A value for one of the effect's fields, valid for its type like the UI would send.
+void randomValue(JsonVariantConst setting, JsonArray config) {
+	const char *type = setting["type"] | "";
+	if(strcmp(type, "number") == 0) {
+		auto min = setting["min"].as<double>(), max = setting["max"].as<double>();
+		auto step = setting["stepBy"] | 1.0;
+		auto steps = (uint32_t)((max - min) / step + 1e-9);
+		config.add(min + step * randomBelow(steps + 1));
+	} else if(strcmp(type, "color") == 0) {
+		auto color = config.createNestedObject();
+		color["r"] = randomBelow(256);
+		color["g"] = randomBelow(256);
+		color["b"] = randomBelow(256);
+	} else if(strcmp(type, "select") == 0) {
+		auto options = setting["options"].as<JsonArrayConst>();
+		config.add(options[randomBelow(options.size())].as<const char *>());
+	} else if(strcmp(type, "boolean") == 0) {
+		config.add((bool)randomBelow(2));
+	} else if(strcmp(type, "string") == 0) {
+		// Points into padding, so the document doesn't copy it.
+		auto minLength = setting["minLength"].as<uint32_t>();
+		auto maxLength = setting["maxLength"].as<uint32_t>();
+		auto length = minLength + randomBelow(std::min(maxLength, 32u) - minLength + 1);
+		config.add((const char *)padding + sizeof(padding) - 1 - length);
+	} else {
+		config.add(setting["defaultValue"]);
+	}
+}
+
+// Sends the document as one message, split into as many frames as asked for.
+void send(AsyncWebSocketClient *socket, JsonDocument &doc, size_t frames = 1,
+          size_t packetSize = TCP_MSS) {
+	static uint8_t buffer[2 * MESSAGE_POOL_SLOT_SIZE];
+	auto len = serializeMsgPack(doc, buffer, sizeof(buffer));
+	ws.receive(socket, buffer, len, WS_BINARY, (len + frames - 1) / frames, packetSize);
+}
+
+// Sends the client's next command, as loadgen.ts's tick() does.
+void command(Client &client) {
+	StaticJsonDocument<4096> doc;
+	client.sent++;
+	if(LOADGEN_ABUSE && client.sent % LOADGEN_ABUSE == 0) {
+		doc["type"] = messageType("beat");
+		if(client.sent % (LOADGEN_ABUSE * 2) == 0) {
+			stats.oversized++;
+			doc["padding"] = (const char *)padding;
+			send(client.socket, doc);
+		} else {
+			stats.fragmented++;
+			doc["padding"] = (const char *)padding + MESSAGE_POOL_SLOT_SIZE / 2;
+			send(client.socket, doc, FRAGMENTS, FRAGMENT_PACKET_SIZE);
+		}
+	} else if(client.sent % 2) {
+		auto effects = schema["effects"].as<JsonArrayConst>();
+		auto stripList = schema["strips"].as<JsonArrayConst>();
+		auto effect = effects[randomBelow(effects.size())];
+		doc["type"] = messageType("updateEffect");
+		doc["strip"] = stripList[randomBelow(stripList.size())]["id"];
+		doc["effect"] = effect["id"];
+		auto config = doc.createNestedArray("config");
+		for(JsonVariantConst setting : effect["config"].as<JsonArrayConst>()) {
+			randomValue(setting, config);
+		}
+		send(client.socket, doc);
+	} else {
+		auto brightness = 1 + randomBelow(255);
+		client.pendingBrightness = brightness;
+		client.pendingSince = millis();
+		doc["type"] = messageType("updateGlobal");
+		doc["brightness"] = brightness;
+		send(client.socket, doc);
+	}
+	stats.commands++;
+}
+
+// Stands in for the AsyncTCP task: every client's traffic, both ways, until told to stop.
+void network(std::atomic<bool> &running) {
+	for(auto i = 0; i < LOADGEN_CLIENTS; i++) {
+		connect(clients[i]);
+		deliver(clients[i]);
+	}
+	while(running) {
+		auto now = millis();
+		for(auto &client : clients) {
+			if(client.socket && client.socket->status() != WS_CONNECTED) disconnect(client);
+			if(!client.socket) connect(client);
+			deliver(client);
+			if(haveSchema && (int32_t)(now - client.nextCommandAt) >= 0) {
+				command(client);
+				client.nextCommandAt += 1000 / LOADGEN_RATE;
+			}
+			if((int32_t)(now - client.reconnectAt) >= 0) {
+				disconnect(client);
+				connect(client);
+			}
+		}
+		stats.minLargestBlock = std::min(stats.minLargestBlock, Host::heapStats().largestFreeBlock);
+		usleep(1000);
+	}
+	for(auto &client : clients) {
+		if(client.socket) disconnect(client);
+	}
+}
+
+// The sum of every label set of a metric in a /metrics response.
+uint32_t metric(const String &body, const char *name) {
+	uint32_t total = 0;
+	int start = 0;
+	while(start < (int)body.length()) {
+		int end = body.indexOf('\n', start);
+		if(end == -1) end = body.length();
+		String line = body.substring(start, end);
+		start = end + 1;
+		if(!line.startsWith(name)) continue;
+		auto rest = line.c_str() + strlen(name);
+		if(*rest != ' ' && *rest != '{') continue;
+		total += strtoul(strrchr(rest, ' ') + 1, nullptr, 10);
+	}
+	return total;
+}
+String scrapeMetrics() {
+	AsyncWebServerRequest request(HTTP_GET, "/metrics");
+	server.handle(&request);
+	TEST_ASSERT_NOT_NULL(request.response());
+	return request.response()->body();
+}
+
+uint32_t percentile(double p) {
+	if(!stats.latencyCount) return 0;
+	return stats.latencies[std::min(stats.latencyCount - 1, (size_t)(stats.latencyCount * p))];
+}
+
+// Runs loop() until a config broadcast gives Rainbow on the first strip this Speed. One already
+// due when the change came in may still carry the old one.
+bool broadcastsSpeed(AsyncWebSocketClient *socket, double expected) {
+	socket->deliver(SIZE_MAX);
+	double speed = -1;
+	socket->onSend([&speed](uint8_t opcode, const uint8_t *data, size_t len) {
+		if(deserializeMsgPack(received, data, len) != DeserializationError::Ok) return;
+		if(strcmp(received["type"] | "", "config") != 0) return;
+		speed = received[strips[0].name]["Rainbow"]["Speed"] | -1.0;
+	});
+	auto start = millis();
+	while(speed != expected && millis() - start < 2000) {
+		loop();
+		socket->deliver(SIZE_MAX);
+	}
+	socket->onSend(nullptr);
+	return speed == expected;
+}
+// Encodes doc and runs it through decodeMessage() and handleMessage() as the WebSocket handler
+// does, over and over. Returns the encoded size; micros is the time per message.
+size_t timeUpdateEffect(AsyncWebSocketClient *socket, JsonDocument &doc, double &micros) {
+	uint8_t encoded[256];
+	auto len = serializeMsgPack(doc, encoded, sizeof(encoded));
+	uint8_t data[sizeof(encoded)];
+	auto start = ::micros();
+	for(auto i = 0; i < UPDATE_EFFECT_ROUNDS; i++) {
+		// Decoding is in place, so every round starts from a fresh copy, as every message does.
+		memcpy(data, encoded, len);
+		decodeMessage(socket, data, len);
+	}
+	micros = (double)(::micros() - start) / UPDATE_EFFECT_ROUNDS;
+	return len;
+}
+
+std::string directory;
+} // namespace
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_control_plane_under_load() {
+	// Boot: the stages that bring up SPIFFS, the server and the schema run one per frame.
+	setup();
+	for(auto i = 0; i < 10; i++) {
+		loop();
+	}
+	auto before = scrapeMetrics();
+
+	std::atomic<bool> running(true);
+	std::thread networkTask(network, std::ref(running));
+	auto start = millis();
+	while(millis() - start < LOADGEN_SECONDS * 1000) {
+		loop();
+	}
+	running = false;
+	networkTask.join();
+	auto seconds = (millis() - start) / 1000.0;
+	for(auto i = 0; i < 10; i++) {
+		loop();
+	}
+	auto after = scrapeMetrics();
+	auto delta = [&](const char *name) { return metric(after, name) - metric(before, name); };
+
+	uint32_t receivedCount = 0;
+	for(auto count : stats.broadcasts) {
+		receivedCount += count;
+	}
+	std::sort(stats.latencies, stats.latencies + stats.latencyCount);
+	auto heap = Host::heapStats();
+	printf("%u clients for %.1fs, %u connects\n", LOADGEN_CLIENTS, seconds, stats.connects);
+	printf("commands: %u (%.1f/s), %u oversized, %u fragmented\n", stats.commands,
+	       stats.commands / seconds, stats.oversized, stats.fragmented);
+	printf("controller: %u messages in, %u out, %u dropped\n",
+	       delta("lighting_ws_messages_in_total"), delta("lighting_ws_messages_out_total"),
+	       delta("lighting_ws_messages_dropped_total"));
+	printf("fan-out: %u messages (%.1f/s), %.1f KiB/s across clients\n", receivedCount,
+	       receivedCount / seconds, stats.bytesIn / seconds / 1024);
+	for(size_t i = 0; i <= broadcastTypeCount; i++) {
+		if(stats.broadcasts[i]) {
+			auto name = i < broadcastTypeCount ? broadcastTypes[i] : "other";
+			printf("  %s: %u\n", name, stats.broadcasts[i]);
+		}
+	}
+	printf("updateGlobal to globalStats: p50 %ums, p99 %ums, max %ums\n", percentile(0.5),
+	       percentile(0.99), percentile(1));
+	for(size_t i = 0; i <= errorCount; i++) {
+		if(stats.errors[i]) {
+			printf("error %s: %u\n", i < errorCount ? errorNames[i] : "other", stats.errors[i]);
+		}
+	}
+	printf("frames: %u, %u overruns, %u config saves\n", delta("lighting_frames_rendered_total"),
+	       delta("lighting_frame_overruns_total"), delta("lighting_config_saves_total"));
+	printf("heap: peak %u of %u bytes in use, %u min largest block\n",
+	       (unsigned)(heap.totalBytes - heap.minFreeBytes), (unsigned)heap.totalBytes,
+	       (unsigned)stats.minLargestBlock);
+
+	TEST_ASSERT_TRUE(haveSchema);
+	TEST_ASSERT_TRUE(stats.commands > 0);
+	TEST_ASSERT_TRUE(delta("lighting_frames_rendered_total") > 0);
+	// Only the oversized messages are refused; everything else, fragmented or not, is taken.
+	TEST_ASSERT_EQUAL_UINT32(stats.oversized, stats.errors[0]);
+	for(size_t i = 1; i <= errorCount; i++) {
+		TEST_ASSERT_EQUAL_UINT32(0, stats.errors[i]);
+	}
+	TEST_ASSERT_EQUAL_UINT32(stats.commands - stats.oversized,
+	                         delta("lighting_ws_messages_in_total"));
+	TEST_ASSERT_TRUE(stats.latencyCount > 0);
+}
+
+// The same slider change sent with names, as older clients do, and with the IDs from the schema.
+void test_update_effect_by_name_and_id() {
+	auto socket = ws.connect();
+	socket->deliver(SIZE_MAX);
+
+	StaticJsonDocument<1024> byName;
+	byName["type"] = "updateEffect";
+	byName["strip"] = strips[0].name;
+	byName["effect"] = "Rainbow";
+	byName["config"]["Speed"] = 7;
+	double nameMicros;
+	auto nameBytes = timeUpdateEffect(socket, byName, nameMicros);
+	TEST_ASSERT_TRUE(broadcastsSpeed(socket, 7));
+
+	StaticJsonDocument<1024> byId;
+	byId["type"] = messageType("updateEffect");
+	byId["strip"] = 0;
+	byId["effect"] = 0;
+	byId.createNestedArray("config").add(9);
+	double idMicros;
+	auto idBytes = timeUpdateEffect(socket, byId, idMicros);
+	TEST_ASSERT_TRUE(broadcastsSpeed(socket, 9));
+
+	TEST_ASSERT_TRUE(idBytes < nameBytes);
+	printf("updateEffect by name: %u bytes, %.2f us to decode and handle\n", (unsigned)nameBytes,
+	       nameMicros);
+	printf("updateEffect by ID:   %u bytes, %.2f us to decode and handle\n", (unsigned)idBytes,
+	       idMicros);
+	ws.disconnect(socket);
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	memset(padding, 'x', sizeof(padding) - 1);
+	char path[] = "/tmp/loadgen-XXXXXX";
+	TEST_ASSERT_NOT_NULL(mkdtemp(path));
+	directory = path;
+	SPIFFS.setRoot(directory + "/spiffs");
+	SPIFFS.mkdir("/");
+	auto partition = directory + "/config.bin";
+	Host::addPartition(partitionLabel, partitionSubtype, partitionSize, partition.c_str());
+	{
+		Preferences prefs;
+		prefs.begin("esp32_lighting");
+		prefs.putBytes("strips", strips, sizeof(strips));
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(test_control_plane_under_load);
+	RUN_TEST(test_update_effect_by_name_and_id);
+	auto result = UNITY_END();
+	Host::removePartitions();
+	unlink(partition.c_str());
+	SPIFFS.format();
+	SPIFFS.rmdir("/");
+	rmdir(path);
+	return result;
+}
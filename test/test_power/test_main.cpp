@@ -0,0 +1,84 @@
+#include "Configuration.h"
+#include "Effect.h"
+#include "Power.h"
+#include <Host.h>
+#include <math.h>
+#include <unity.h>
+
+namespace {
+const StripSettings strips[] = {
+	{ "desk", 60, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 60, 13, StripChipset::WS2812B, StripOrder::GRB, STRIP_HDR, 500 },
+};
+
+// Walks the pixels the way demand used to be measured.
+uint32_t measure(const GenericLightStrip &strip) {
+	uint32_t sum = 0;
+	for(uintptr_t i = 0; i < strip.len; i++) {
+		for(auto c = 0; c < 3; c++) {
+			uint32_t level = strip.data[i].raw[c];
+			if(strip.settings.flags & STRIP_HDR) level = lround(pow(level / 255.0, HDR_GAMMA) * 255);
+			sum += level * ledChannelMilliamps[c];
+		}
+	}
+	return sum / 255;
+}
+} // namespace
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// Whatever the effects write, the running total matches the pixels as they end up.
+void test_demand_follows_effects() {
+	for(auto &strip : Configuration::strips) {
+		for(uintptr_t effect = 0; effect < Configuration::effectCount; effect++) {
+			auto &creator = Configuration::effects[effect];
+			EffectConfigData config;
+			for(uintptr_t field = 0; field < creator.configLength; field++) {
+				if(creator.config[field].type == EffectConfig::DataType::Number) {
+					config[field] = (double)1;
+				} else if(creator.config[field].type == EffectConfig::DataType::Color) {
+					config[field] = (uint32_t)0x40C020;
+				}
+			}
+			auto instance = creator.create(&strip, config);
+			for(auto frame = 0; frame < 5; frame++) {
+				instance->display();
+				TEST_ASSERT_EQUAL_UINT32(measure(strip), strip.demand());
+				delay(3);
+			}
+		}
+		strip.pixels().fill(CRGB::Black);
+		TEST_ASSERT_EQUAL_UINT32(0, strip.demand());
+	}
+}
+
+// An HDR strip going from dark to full white is held to its own limit in that very frame.
+void test_hdr_limit_applies_to_current_frame() {
+	PowerLimiter limiter(0);
+	auto &strip = Configuration::strips[1];
+	for(auto &each : Configuration::strips) {
+		each.pixels().fill(CRGB::Black);
+	}
+	limiter.update(Configuration::strips, 255);
+	Configuration::composite(255);
+	TEST_ASSERT_EQUAL_UINT8(255, strip.powerLimit);
+
+	strip.pixels().fill(CRGB::White);
+	limiter.update(Configuration::strips, 255);
+	Configuration::composite(255);
+	TEST_ASSERT_TRUE(strip.powerLimit < 255);
+	TEST_ASSERT_TRUE(strip.draw <= strip.settings.maxMilliamps);
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	Configuration::beginStrips(strips, sizeof(strips) / sizeof(*strips));
+	UNITY_BEGIN();
+	RUN_TEST(test_demand_follows_effects);
+	RUN_TEST(test_hdr_limit_applies_to_current_frame);
+	return UNITY_END();
+}
@@ -0,0 +1,140 @@
+#include "SceneLibrary.h"
+#include <Host.h>
+#include <SPIFFS.h>
+#include <string>
+#include <unistd.h>
+#include <unity.h>
+
+namespace {
+constexpr int sceneCount = 50;
+constexpr int benchmarkRounds = 20;
+
+const StripSettings strips[] = {
+	{ "desk", 120, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 60, 13, StripChipset::WS2812B, StripOrder::GRB },
+	{ "window", 150, 25, StripChipset::WS2811, StripOrder::RGB },
+};
+constexpr size_t stripCount = sizeof(strips) / sizeof(*strips);
+
+std::string directory;
+
+std::string sceneName(int scene) {
+	return "scene " + std::to_string(scene);
+}
+// Every strip runs every effect, with values that differ from one scene to the next.
+std::vector<uint8_t> sceneConfig(int scene) {
+	std::vector<uint8_t> binary;
+	ConfigFormat::Writer writer(binary);
+	for(size_t strip = 0; strip < stripCount; strip++) {
+		for(uintptr_t effect = 0; effect < Configuration::effectCount; effect++) {
+			EffectConfigData config;
+			auto &creator = Configuration::effects[effect];
+			for(uintptr_t field = 0; field < creator.configLength; field++) {
+				if(creator.config[field].type == EffectConfig::DataType::Number) {
+					config[field] = (double)(1 + (scene + strip + effect) % 50);
+				} else if(creator.config[field].type == EffectConfig::DataType::Color) {
+					config[field] = (uint32_t)(0x010203 * scene + strip);
+				}
+			}
+			writer.addRecord(strip, effect, config);
+		}
+	}
+	writer.finish();
+	return binary;
+}
+// Libraries register with the persistence task for good, as they do on the device, so every
+// "boot" gets a fresh one that's never freed.
+SceneLibrary &boot() {
+	auto library = new SceneLibrary(SPIFFS);
+	library->begin();
+	return *library;
+}
+bool waitForSave(SceneLibrary &library, uint32_t writes) {
+	for(auto i = 0; i < 300 && library.getPersistenceStats().writes < writes; i++) {
+		delay(10);
+	}
+	return library.getPersistenceStats().writes >= writes;
+}
+void saveAll(SceneLibrary &library) {
+	for(auto scene = 0; scene < sceneCount; scene++) {
+		TEST_ASSERT_TRUE(library.save(sceneName(scene), sceneConfig(scene)));
+	}
+}
+void checkAll(SceneLibrary &library) {
+	for(auto scene = 0; scene < sceneCount; scene++) {
+		std::vector<uint8_t> config;
+		TEST_ASSERT_TRUE(library.get(sceneName(scene), config));
+		TEST_ASSERT_TRUE(config == sceneConfig(scene));
+	}
+}
+} // namespace
+
+void setUp() {
+	char path[] = "/tmp/scene-library-XXXXXX";
+	TEST_ASSERT_NOT_NULL(mkdtemp(path));
+	directory = path;
+	SPIFFS.setRoot(directory);
+}
+
+void tearDown() {
+	SPIFFS.format();
+	rmdir(directory.c_str());
+}
+
+// Scenes read the same before the file holds them, after, and after a reboot.
+void test_scenes_are_read_back_from_the_file() {
+	auto &library = boot();
+	saveAll(library);
+	checkAll(library);
+	TEST_ASSERT_TRUE(waitForSave(library, 1));
+	checkAll(library);
+
+	auto &rebooted = boot();
+	checkAll(rebooted);
+	TEST_ASSERT_TRUE(rebooted.remove(sceneName(0)));
+	std::vector<uint8_t> config;
+	TEST_ASSERT_FALSE(rebooted.get(sceneName(0), config));
+	TEST_ASSERT_TRUE(rebooted.get(sceneName(1), config));
+	TEST_ASSERT_TRUE(config == sceneConfig(1));
+	TEST_ASSERT_TRUE(waitForSave(rebooted, 1));
+}
+
+void test_oversized_scene_is_refused() {
+	auto &library = boot();
+	std::vector<uint8_t> config(SCENE_CONFIG_MAX + 1);
+	TEST_ASSERT_FALSE(library.save("big", config));
+	TEST_ASSERT_FALSE(library.get("big", config));
+}
+
+// Recall latency with 50 scenes on flash, and the RAM the library keeps for them.
+void test_recall_latency() {
+	auto &saved = boot();
+	saveAll(saved);
+	TEST_ASSERT_TRUE(waitForSave(saved, 1));
+	auto before = Host::heapStats().freeBytes;
+	auto library = &boot();
+	auto indexBytes = before - Host::heapStats().freeBytes;
+
+	std::vector<uint8_t> config;
+	auto start = micros();
+	for(auto round = 0; round < benchmarkRounds; round++) {
+		for(auto scene = 0; scene < sceneCount; scene++) {
+			TEST_ASSERT_TRUE(library->get(sceneName(scene), config));
+		}
+	}
+	auto recallMicros = micros() - start;
+	checkAll(*library);
+	printf("scene library: %d scenes of %u bytes, %.1f us per recall, %u bytes in RAM\n",
+	       sceneCount, (unsigned)sceneConfig(0).size(),
+	       (double)recallMicros / (benchmarkRounds * sceneCount), (unsigned)indexBytes);
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	Configuration::beginStrips(strips, stripCount);
+	UNITY_BEGIN();
+	RUN_TEST(test_scenes_are_read_back_from_the_file);
+	RUN_TEST(test_oversized_scene_is_refused);
+	RUN_TEST(test_recall_latency);
+	return UNITY_END();
+}
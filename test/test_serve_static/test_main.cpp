@@ -0,0 +1,128 @@
+#include "ServeStatic.h"
+#include <Host.h>
+#include <SPIFFS.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <unity.h>
+
+namespace {
+std::string directory;
+
+void writeFile(const char *path, const std::string &content) {
+	File file = SPIFFS.open(path, FILE_WRITE);
+	TEST_ASSERT_TRUE(file);
+	TEST_ASSERT_EQUAL_UINT32(content.size(), file.write((const uint8_t *)content.data(), content.size()));
+}
+// A manifest line as frontend/modules/asset-manifest.ts writes it.
+std::string manifestLine(const char *url, const char *encoding, size_t size, const char *hash) {
+	return std::string(url) + "\t" + encoding + "\t" + std::to_string(size) + "\t" + hash +
+	       "\tapplication/javascript\n";
+}
+std::unique_ptr<AsyncWebServerRequest> get(ServeStatic &handler, const char *url,
+                                           const char *ifNoneMatch = nullptr) {
+	std::unique_ptr<AsyncWebServerRequest> request(new AsyncWebServerRequest(HTTP_GET, url));
+	if(ifNoneMatch) request->setHeader("If-None-Match", ifNoneMatch);
+	TEST_ASSERT_TRUE(handler.canHandle(request.get()));
+	handler.handleRequest(request.get());
+	TEST_ASSERT_NOT_NULL(request->response());
+	return request;
+}
+} // namespace
+
+void setUp() {
+	char path[] = "/tmp/serve-static-XXXXXX";
+	TEST_ASSERT_NOT_NULL(mkdtemp(path));
+	directory = path;
+	SPIFFS.setRoot(directory);
+}
+
+void tearDown() {
+	SPIFFS.format();
+	rmdir(directory.c_str());
+}
+
+// Files in the manifest are validated by their content hash.
+void test_manifest_files_get_strong_etags() {
+	writeFile("/www/app.js", "console.log(1)");
+	writeFile("/www/assets.txt", manifestLine("/app.js", "identity", 14, "0123456789abcdef"));
+	ServeStatic handler("/", SPIFFS, "/www/");
+	handler.setManifest("/www/assets.txt");
+
+	auto request = get(handler, "/app.js");
+	TEST_ASSERT_EQUAL(200, request->response()->code());
+	TEST_ASSERT_EQUAL_STRING("\"0123456789abcdef\"", request->response()->header("ETag").c_str());
+	request = get(handler, "/app.js", "\"0123456789abcdef\"");
+	TEST_ASSERT_EQUAL(304, request->response()->code());
+}
+
+// Files the manifest doesn't list, or lists with another size, go without an ETag, so a
+// different file of the same size is never taken for the cached one.
+void test_unlisted_files_get_no_etag() {
+	writeFile("/www/app.js", "console.log(2)");
+	writeFile("/www/other.js", "console.log(3)");
+	writeFile("/www/assets.txt", manifestLine("/app.js", "identity", 15, "0123456789abcdef"));
+	ServeStatic handler("/", SPIFFS, "/www/");
+	handler.setManifest("/www/assets.txt");
+
+	for(auto url : { "/app.js", "/other.js" }) {
+		auto request = get(handler, url);
+		TEST_ASSERT_EQUAL(200, request->response()->code());
+		TEST_ASSERT_EQUAL_STRING("", request->response()->header("ETag").c_str());
+		request = get(handler, url, "W/\"14\"");
+		TEST_ASSERT_EQUAL(200, request->response()->code());
+	}
+}
+
+// The "/" handler leaves _nuxt/ to the handler that serves it.
+void test_excluded_subtree_is_not_indexed() {
+	writeFile("/www/index.html", "<html></html>");
+	writeFile("/www/_nuxt/app.js", "console.log(4)");
+	ServeStatic root("/", SPIFFS, "/www/", "_nuxt/");
+	ServeStatic nuxt("/_nuxt/", SPIFFS, "/www/_nuxt/");
+
+	TEST_ASSERT_EQUAL(200, get(root, "/index.html")->response()->code());
+	AsyncWebServerRequest request(HTTP_GET, "/_nuxt/app.js");
+	TEST_ASSERT_FALSE(root.canHandle(&request));
+	TEST_ASSERT_EQUAL(200, get(nuxt, "/_nuxt/app.js")->response()->code());
+}
+
+// Index build and lookup latency for a bundle the size of a large frontend build, each file
+// with gzip and brotli copies.
+void test_index_latency() {
+	const int files = 400;
+	for(int i = 0; i < files; i++) {
+		std::string path = "/www/_nuxt/chunk" + std::to_string(i) + ".js";
+		writeFile(path.c_str(), "x");
+		writeFile((path + ".gz").c_str(), "x");
+		writeFile((path + ".br").c_str(), "x");
+	}
+	writeFile("/www/index.html", "<html></html>");
+
+	auto start = std::chrono::steady_clock::now();
+	ServeStatic root("/", SPIFFS, "/www/", "_nuxt/");
+	ServeStatic nuxt("/_nuxt/", SPIFFS, "/www/_nuxt/");
+	auto built = std::chrono::steady_clock::now();
+	for(int i = 0; i < files; i++) {
+		std::string url = "/_nuxt/chunk" + std::to_string(i) + ".js";
+		auto request = get(nuxt, url.c_str());
+		TEST_ASSERT_EQUAL(200, request->response()->code());
+	}
+	auto served = std::chrono::steady_clock::now();
+
+	using us = std::chrono::microseconds;
+	printf("serve static: %d files x 3 encodings, index build %lld us, %lld us per request\n",
+	       files, (long long)std::chrono::duration_cast<us>(built - start).count(),
+	       (long long)std::chrono::duration_cast<us>(served - built).count() / files);
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	UNITY_BEGIN();
+	RUN_TEST(test_manifest_files_get_strong_etags);
+	RUN_TEST(test_unlisted_files_get_no_etag);
+	RUN_TEST(test_excluded_subtree_is_not_indexed);
+	RUN_TEST(test_index_latency);
+	return UNITY_END();
+}
@@ -0,0 +1,118 @@
+#include "Configuration.h"
+#include "FrameWatch.h"
+#include <Host.h>
+#include <unity.h>
+
+namespace {
+const StripSettings strips[] = {
+	{ "desk", 30, 12, StripChipset::WS2812B, StripOrder::GRB },
+	{ "shelf", 30, 13, StripChipset::WS2812B, StripOrder::GRB, STRIP_HDR },
+};
+
+FrameWatch frameWatch;
+
+void frame(uint8_t brightness) {
+	frameWatch.beginFrame(Configuration::strips);
+	for(auto &strip : Configuration::strips) {
+		if(strip.active) strip.pixels().fill(CRGB::White);
+	}
+	Configuration::composite(brightness);
+	Configuration::show();
+}
+} // namespace
+
+void setUp() {
+	for(auto &strip : Configuration::strips) {
+		strip.setQuality(StripQuality::Full);
+	}
+}
+
+void tearDown() {
+}
+
+// One show per frame sends every strip, each at its own brightness.
+void test_strips_go_out_in_one_show() {
+	auto shows = FastLED.showCount();
+	Configuration::strips[0].powerLimit = 127;
+	frame(255);
+	TEST_ASSERT_EQUAL_UINT32(shows + 1, FastLED.showCount());
+	for(auto &strip : Configuration::strips) {
+		TEST_ASSERT_EQUAL_UINT32(shows + 1, strip.controller->showCount());
+	}
+	auto &plain = Configuration::strips[0].controller->lastSent();
+	TEST_ASSERT_EQUAL_UINT8(127, plain[0].r);
+	// HDR strips are sent as quantized.
+	auto &hdr = Configuration::strips[1];
+	TEST_ASSERT_EQUAL_UINT8(255, hdr.controller->lastSent()[0].r);
+	TEST_ASSERT_EQUAL_UINT8(hdr.output[0].r, hdr.controller->lastSent()[0].r);
+	Configuration::strips[0].powerLimit = 255;
+}
+
+// A strip below full rate is still sent on the frames it sits out, as it last was.
+void test_inactive_strips_are_sent_again() {
+	auto &strip = Configuration::strips[0];
+	strip.setQuality(StripQuality::HalfRate);
+	frame(200);
+	if(!strip.active) frame(200);
+	TEST_ASSERT_TRUE(strip.active);
+	auto sent = strip.controller->lastSent();
+	auto shows = strip.controller->showCount();
+
+	frame(100);
+	TEST_ASSERT_FALSE(strip.active);
+	TEST_ASSERT_EQUAL_UINT32(shows + 1, strip.controller->showCount());
+	TEST_ASSERT_EQUAL_UINT8(sent[0].r, strip.controller->lastSent()[0].r);
+	frame(100);
+	TEST_ASSERT_TRUE(strip.active);
+	TEST_ASSERT_EQUAL_UINT8(100, strip.controller->lastSent()[0].r);
+}
+
+// Short strips are held to the frame period; a frame that misses it by a little is an overrun.
+void test_deadline_is_the_frame_period() {
+	FrameWatch watch;
+	watch.begin(Configuration::strips);
+	StaticJsonDocument<1024> doc;
+	watch.toJson(doc, Configuration::strips);
+	TEST_ASSERT_EQUAL_UINT32(FRAME_PERIOD_MICROS, doc["deadline"].as<uint32_t>());
+
+	auto period = FRAME_PERIOD_MICROS;
+	watch.endFrame(Configuration::strips, period - 200, 100, period - 100);
+	watch.endFrame(Configuration::strips, period, 100, period + 100);
+	doc.clear();
+	watch.toJson(doc, Configuration::strips);
+	TEST_ASSERT_EQUAL_UINT32(1, doc["overruns"]["render"].as<uint32_t>());
+}
+
+// Frames that keep running over because of rendering take the costliest strip down; frames held
+// up by showing don't, since every strip is sent whatever its quality.
+void test_only_render_overruns_degrade() {
+	FrameWatch watch;
+	watch.begin(Configuration::strips);
+	auto slow = FRAME_PERIOD_MICROS * 2;
+	for(auto i = 0; i < FRAME_WINDOW; i++) {
+		watch.endFrame(Configuration::strips, 100, slow, slow + 100);
+	}
+	for(auto &strip : Configuration::strips) {
+		TEST_ASSERT_EQUAL(StripQuality::Full, strip.quality);
+	}
+	for(auto i = 0; i < FRAME_WINDOW; i++) {
+		watch.endFrame(Configuration::strips, slow, 100, slow + 100);
+	}
+	auto degraded = 0;
+	for(auto &strip : Configuration::strips) {
+		if(strip.quality != StripQuality::Full) degraded++;
+	}
+	TEST_ASSERT_EQUAL(1, degraded);
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	Configuration::beginStrips(strips, sizeof(strips) / sizeof(*strips));
+	Configuration::setCorrection(UncorrectedColor);
+	UNITY_BEGIN();
+	RUN_TEST(test_strips_go_out_in_one_show);
+	RUN_TEST(test_inactive_strips_are_sent_again);
+	RUN_TEST(test_deadline_is_the_frame_period);
+	RUN_TEST(test_only_render_overruns_degrade);
+	return UNITY_END();
+}
@@ -0,0 +1,53 @@
+#include "Configuration.h"
+#include "Protocol.h"
+#include <unity.h>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_integers_that_dont_fit_are_rejected() {
+	StaticJsonDocument<JSON_OBJECT_SIZE(6)> doc;
+	doc["fits"] = 840;
+	doc["tooLong"] = 70000;
+	doc["negative"] = -1;
+	doc["fraction"] = 1.5;
+	doc["text"] = "12";
+	uint16_t length = 1;
+	TEST_ASSERT_TRUE(readInteger(doc["fits"], length));
+	TEST_ASSERT_EQUAL_UINT16(840, length);
+	TEST_ASSERT_TRUE(readInteger(doc["missing"], length));
+	TEST_ASSERT_EQUAL_UINT16(0, length);
+	TEST_ASSERT_FALSE(readInteger(doc["tooLong"], length));
+	TEST_ASSERT_FALSE(readInteger(doc["negative"], length));
+	TEST_ASSERT_FALSE(readInteger(doc["fraction"], length));
+	TEST_ASSERT_FALSE(readInteger(doc["text"], length));
+	uint8_t pin;
+	TEST_ASSERT_FALSE(readInteger(doc["fits"], pin));
+}
+
+void test_strips_need_pins_of_their_own() {
+	StripSettings strips[] = {
+		{ "desk", 100, 12, StripChipset::WS2812B, StripOrder::GRB },
+		{ "shelf", 100, 13, StripChipset::WS2812B, StripOrder::GRB },
+	};
+	TEST_ASSERT_TRUE(Configuration::validStrips(strips, 2));
+	strips[1].pin = 12;
+	TEST_ASSERT_FALSE(Configuration::validStrips(strips, 2));
+}
+
+void test_default_strip_fits_with_hdr() {
+	StripSettings strip = Configuration::defaultStrips[0];
+	strip.flags |= STRIP_HDR;
+	TEST_ASSERT_TRUE(Configuration::validStrips(&strip, 1));
+}
+
+int main(int argc, char **argv) {
+	UNITY_BEGIN();
+	RUN_TEST(test_integers_that_dont_fit_are_rejected);
+	RUN_TEST(test_strips_need_pins_of_their_own);
+	RUN_TEST(test_default_strip_fits_with_hdr);
+	return UNITY_END();
+}
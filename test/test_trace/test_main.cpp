@@ -0,0 +1,99 @@
+#include "Trace.h"
+#include <ArduinoJson.h>
+#include <Host.h>
+#include <atomic>
+#include <string>
+#include <unity.h>
+
+namespace {
+std::atomic<int> workerScopes(0);
+
+// Records from a task of its own, so the trace has a second track.
+void worker(void *scopes) {
+	for(auto i = 0; i < (intptr_t)scopes; i++) {
+		TRACE_SCOPE("worker");
+		workerScopes++;
+	}
+}
+void recordOnWorker(int scopes) {
+	workerScopes = 0;
+	xTaskCreatePinnedToCore(worker, "worker", 4096, (void *)(intptr_t)scopes, 1, nullptr, 0);
+	while(workerScopes < scopes) {
+		delay(1);
+	}
+}
+// Fetches /trace.json through the same chunked response the server sends.
+std::string fetchTrace() {
+	AsyncWebServerRequest request(HTTP_GET, "/trace.json");
+	Trace::handleRequest(&request);
+	TEST_ASSERT_NOT_NULL(request.response());
+	TEST_ASSERT_EQUAL(200, request.response()->code());
+	return request.response()->body().c_str();
+}
+} // namespace
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+// More events than the ring holds, from two tasks, come out as Chrome trace_event JSON: one
+// thread_name record per track, then the newest TRACE_RING_SIZE events oldest first.
+void test_trace_is_chrome_trace_json() {
+	// A ring's worth from the worker, then half a ring from loop(), which overwrites the oldest
+	// half of the worker's.
+	recordOnWorker(TRACE_RING_SIZE / 2);
+	for(auto i = 0; i < TRACE_RING_SIZE / 4; i++) {
+		TRACE_SCOPE("loop");
+	}
+	auto json = fetchTrace();
+
+	DynamicJsonDocument doc(json.size() * 8);
+	TEST_ASSERT_EQUAL(DeserializationError::Ok, deserializeJson(doc, json).code());
+	TEST_ASSERT_EQUAL_STRING("ms", doc["displayTimeUnit"].as<const char *>());
+	JsonArray events = doc["traceEvents"];
+	TEST_ASSERT_FALSE(events.isNull());
+
+	size_t names = 0, recorded = 0, loop = 0;
+	uint32_t last = 0;
+	std::string lastPhase = "E";
+	for(JsonObject event : events) {
+		std::string phase = event["ph"].as<const char *>();
+		TEST_ASSERT_TRUE(event.containsKey("pid"));
+		TEST_ASSERT_TRUE(event.containsKey("tid"));
+		if(phase == "M") {
+			TEST_ASSERT_EQUAL_STRING("thread_name", event["name"].as<const char *>());
+			JsonObject args = event["args"];
+			TEST_ASSERT_NOT_NULL(args["name"].as<const char *>());
+			TEST_ASSERT_EQUAL(0, recorded);
+			names++;
+			continue;
+		}
+		// Every scope is a B and an E, and none of them nest.
+		TEST_ASSERT_TRUE(phase == (lastPhase == "E" ? "B" : "E"));
+		lastPhase = phase;
+		uint32_t time = event["ts"];
+		TEST_ASSERT_TRUE(time >= last);
+		last = time;
+		if(std::string(event["name"].as<const char *>()) == "loop") {
+			loop++;
+		} else {
+			// The worker's events all come before loop()'s.
+			TEST_ASSERT_EQUAL(0, loop);
+		}
+		recorded++;
+	}
+	// The loop task, the worker and the shared track.
+	TEST_ASSERT_EQUAL(3, names);
+	TEST_ASSERT_EQUAL(TRACE_RING_SIZE, recorded);
+	TEST_ASSERT_EQUAL(TRACE_RING_SIZE / 2, loop);
+	printf("trace: %u events, %u bytes of JSON\n", (unsigned)recorded, (unsigned)json.size());
+}
+
+int main(int argc, char **argv) {
+	Host::silenceSerial(true);
+	UNITY_BEGIN();
+	RUN_TEST(test_trace_is_chrome_trace_json);
+	return UNITY_END();
+}